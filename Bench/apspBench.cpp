@@ -0,0 +1,97 @@
+/*
+** apspBench -- floydWarshall against a Dijkstra per source on a random sparse graph
+**
+** usage: ./apsp-bench [threads] [vertices] [edges]
+** Builds a connected random graph, computes all the shortest paths with floydWarshall, dijkstraAllPairs and the
+** streamed rows on an LFP pool of "threads" threads, checks that the distances agree and prints the times, then
+** packs them in a DistanceStore, checks it unpacks to the same rows and prints its memory against the matrices.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <future>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+#include "../LFP/LFP.hpp"
+#include "../GraphObj/graph.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t n = argc > 2 ? static_cast<size_t>(atol(argv[2])) : 1000;
+    size_t m = argc > 3 ? static_cast<size_t>(atol(argv[3])) : 4 * n;
+
+    // a random spanning tree, then random edges up to m (a pair once, the graph keeps one weight per pair)
+    m = min(m, n * (n - 1) / 2);
+    mt19937_64 random(42);
+    uniform_int_distribution<size_t> weight(1, 1000);
+    vector<Edge> edges;
+    set<pair<size_t, size_t>> pairs;
+    auto add = [&](size_t u, size_t v)
+    {
+        if (u != v && pairs.insert({min(u, v), max(u, v)}).second)
+            edges.push_back(Edge(Vertex(u), Vertex(v), weight(random)));
+    };
+    for (size_t v = 1; v < n; v++)
+        add(uniform_int_distribution<size_t>(0, v - 1)(random), v);
+    uniform_int_distribution<size_t> vertex(0, n - 1);
+    while (edges.size() < m)
+        add(vertex(random), vertex(random));
+    Graph g(n);
+    g.addEdges(edges);
+    printf("%zu vertices, %zu edges, %d threads\n", g.numVertices(), g.numEdges(), threads);
+
+    LFP lfp(threads);
+    lfp.start();
+    promise<int> result;
+    lfp.addTask([&g, &result, n]()
+                {
+                    Clock::time_point start = Clock::now();
+                    vector<vector<size_t>> floyd = g.floydWarshall().first;
+                    printf("floydWarshall:     %8.3f s\n", secondsSince(start));
+
+                    start = Clock::now();
+                    vector<vector<size_t>> dijkstra, parents;
+                    tie(dijkstra, parents) = g.dijkstraAllPairs();
+                    printf("dijkstraAllPairs:  %8.3f s\n", secondsSince(start));
+
+                    start = Clock::now();
+                    size_t streamedMismatches = 0;
+                    g.forEachShortestPathRow([&](size_t source, const size_t *dist, const size_t *)
+                                             {
+                                                 for (size_t v = 0; v < n; v++)
+                                                     streamedMismatches += dist[v] != dijkstra[source][v];
+                                             });
+                    printf("streamed rows:     %8.3f s\n", secondsSince(start));
+
+                    start = Clock::now();
+                    DistanceStore store(dijkstra, parents);
+                    printf("packed store:      %8.3f s\n", secondsSince(start));
+                    size_t packedMismatches = 0;
+                    vector<size_t> dist(n), parent(n);
+                    for (size_t source = 0; source < n; source++)
+                    {
+                        store.row(source, dist.data(), parent.data());
+                        packedMismatches += dist != dijkstra[source] || parent != parents[source];
+                    }
+                    size_t matrixBytes = 2 * n * (sizeof(vector<size_t>) + n * sizeof(size_t));
+                    printf("matrices %zu bytes, store %zu bytes (%zu per distance): %.2fx\n", matrixBytes,
+                           store.memoryBytes(), store.width(), static_cast<double>(matrixBytes) / static_cast<double>(store.memoryBytes()));
+
+                    bool same = floyd == dijkstra && streamedMismatches == 0 && packedMismatches == 0;
+                    printf("distances %s\n", same ? "agree" : "DIFFER");
+                    result.set_value(same ? 0 : 1);
+                });
+    return result.get_future().get();
+}
@@ -0,0 +1,84 @@
+/*
+** lfpBench -- latency and context switches of the LFP thread pool
+**
+** usage: ./lfp-bench [threads] [requests] [work us] [interval us]
+** Submits the requests from one thread, one every "interval" microseconds, each task spins for "work" microseconds.
+** Prints the submit-to-completion latency percentiles and the context switches (voluntary + involuntary,
+** of the whole process) per request.
+*/
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../LFP/LFP.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Busy work standing in for a request
+static void spin(long micros)
+{
+    Clock::time_point end = Clock::now() + chrono::microseconds(micros);
+    while (Clock::now() < end)
+        ;
+}
+
+static long contextSwitches()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    long count = argc > 2 ? atol(argv[2]) : 20000;
+    long work = argc > 3 ? atol(argv[3]) : 20;
+    long interval = argc > 4 ? atol(argv[4]) : 100;
+    if (threads <= 0 || count <= 0)
+    { // the percentiles need at least one request
+        fprintf(stderr, "usage: %s [threads] [requests] [work us] [interval us], threads and requests at least 1\n", argv[0]);
+        return 1;
+    }
+    size_t requests = static_cast<size_t>(count);
+
+    vector<double> latency(requests); // microseconds, filled by the tasks
+    atomic<size_t> done(0);
+    long switchesBefore;
+    Clock::time_point start;
+    {
+        LFP lfp(threads);
+        lfp.start();
+        this_thread::sleep_for(chrono::milliseconds(100)); // let the threads settle
+        switchesBefore = contextSwitches();
+        start = Clock::now();
+        for (size_t i = 0; i < requests; i++)
+        {
+            Clock::time_point submitted = Clock::now();
+            lfp.addTask([&latency, &done, i, submitted, work]()
+                        {
+                            spin(work);
+                            latency[i] = chrono::duration<double, micro>(Clock::now() - submitted).count();
+                            done++; });
+            if (interval > 0)
+                this_thread::sleep_for(chrono::microseconds(interval));
+        }
+        while (done < requests)
+            this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    long switches = contextSwitches() - switchesBefore;
+
+    sort(latency.begin(), latency.end());
+    printf("threads %d, requests %zu, work %ldus, interval %ldus\n", threads, requests, work, interval);
+    printf("latency us: p50 %.1f  p99 %.1f  max %.1f\n", latency[requests / 2], latency[requests * 99 / 100], latency[requests - 1]);
+    printf("context switches per request: %.2f\n", static_cast<double>(switches) / static_cast<double>(requests));
+    printf("throughput: %.0f requests/s\n", static_cast<double>(requests) / seconds);
+    return 0;
+}
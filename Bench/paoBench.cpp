@@ -0,0 +1,116 @@
+/*
+** paoBench -- hand-off cost of the PAO pipeline
+**
+** usage: ./pao-bench [stages] [tasks] [work ns] [replicas] [slow stage work ns]
+** Pushes the tasks into a pipeline of "stages" workers as fast as addTask allows, every stage spins for "work"
+** nanoseconds on each task, except the middle one which spins for "slow stage work" (default: work).
+** The middle stage runs "replicas" threads (0 = automatic), the others one. Prints the time per task at the end of
+** the pipeline (sustained throughput), the submit-to-exit latency percentiles, the context switches per task and
+** the tasks that left the pipeline out of order.
+*/
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../PAO/PAO.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct BenchTask
+{
+    size_t index;
+    Clock::time_point submitted;
+    double latency; // microseconds, set by the last stage
+};
+
+static void spin(long nanos)
+{
+    if (nanos <= 0)
+        return;
+    Clock::time_point end = Clock::now() + chrono::nanoseconds(nanos);
+    while (Clock::now() < end)
+        ;
+}
+
+static long contextSwitches()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t stages = argc > 1 ? static_cast<size_t>(atol(argv[1])) : 6;
+    size_t tasks = argc > 2 ? static_cast<size_t>(atol(argv[2])) : 200000;
+    long work = argc > 3 ? atol(argv[3]) : 0;
+    size_t replicas = argc > 4 ? static_cast<size_t>(atol(argv[4])) : 1;
+    long slowWork = argc > 5 ? atol(argv[5]) : work;
+    if (stages < 1)
+        stages = 1;
+
+    vector<BenchTask> items(tasks);
+    atomic<size_t> done(0);
+    size_t outOfOrder = 0; // the last stage has a single replica
+    vector<function<void(void *)>> functions;
+    vector<size_t> replicaCounts(stages, 1);
+    for (size_t s = 0; s + 1 < stages; s++)
+    {
+        long stageWork = s == stages / 2 ? slowWork : work;
+        functions.push_back([stageWork](void *)
+                            { spin(stageWork); });
+    }
+    if (stages > 1)
+        replicaCounts[stages / 2] = replicas;
+    functions.push_back([work, &done, &outOfOrder](void *task)
+                        {
+                            spin(work);
+                            BenchTask *t = static_cast<BenchTask *>(task);
+                            if (t->index != done.load(memory_order_relaxed))
+                                outOfOrder++;
+                            t->latency = chrono::duration<double, micro>(Clock::now() - t->submitted).count();
+                            done.fetch_add(1, memory_order_release); });
+
+    long switchesBefore;
+    Clock::time_point start;
+    vector<size_t> active;
+    {
+        PAO pao(functions, replicaCounts);
+        pao.start();
+        this_thread::sleep_for(chrono::milliseconds(100)); // let the threads settle
+        switchesBefore = contextSwitches();
+        start = Clock::now();
+        for (size_t i = 0; i < tasks; i++)
+        {
+            items[i].index = i;
+            items[i].submitted = Clock::now();
+            pao.addTask(&items[i]);
+        }
+        while (done.load(memory_order_acquire) < tasks)
+            this_thread::sleep_for(chrono::microseconds(200));
+        active = pao.activeReplicas();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    long switches = contextSwitches() - switchesBefore;
+
+    vector<double> latency(tasks);
+    for (size_t i = 0; i < tasks; i++)
+        latency[i] = items[i].latency;
+    sort(latency.begin(), latency.end());
+    printf("stages %zu, tasks %zu, work %ldns per stage, %ldns in stage %zu\n", stages, tasks, work, slowWork, stages / 2);
+    printf("replicas:");
+    for (size_t count : active)
+        printf(" %zu", count);
+    printf("\n");
+    printf("time per task: %.0f ns (%.0f tasks/s)\n", seconds * 1e9 / static_cast<double>(tasks), static_cast<double>(tasks) / seconds);
+    printf("latency us: p50 %.1f  p99 %.1f  max %.1f\n", latency[tasks / 2], latency[tasks * 99 / 100], latency[tasks - 1]);
+    printf("context switches per task: %.2f\n", static_cast<double>(switches) / static_cast<double>(tasks));
+    printf("out of order: %zu\n", outOfOrder);
+    return 0;
+}
@@ -2,11 +2,14 @@
 #include <stdexcept>
 #include <algorithm> // For std::find
 #include <map>
+#include <memory_resource>
 
 template <typename T, typename Comparator = std::less<T>>
 class BinaryHeap {
 public:
     BinaryHeap() = default;
+    // The heap and its index take their memory from resource (e.g. a ScratchScope)
+    explicit BinaryHeap(std::pmr::memory_resource* resource) : heap(resource), indexMap(resource) {}
 
     void push(const T& value) {
         heap.push_back(value);
@@ -63,9 +66,9 @@ public:
     }
 
 private:
-    std::vector<T> heap;
+    std::pmr::vector<T> heap;
     Comparator comp;
-    std::map<T, size_t> indexMap;
+    std::pmr::map<T, size_t> indexMap;
 
     void heapifyUp(size_t index) {
         while (index > 0) {
@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * Chase-Lev work-stealing deque (the C11 version of Le, Pop, Cohen and Zappa Nardelli, PPoPP'13).
+ * The owner thread pushes and pops at the bottom (LIFO), any other thread steals from the top (FIFO).
+ * push/pop take no lock and no atomic read-modify-write except when racing for the last element.
+ * T must be trivially copyable (task pointers), slots are read while a thief may be racing for them.
+ * The ring grows when full; old rings are kept until the deque is destroyed, thieves may still read them.
+ */
+template <typename T>
+class ChaseLevDeque
+{
+public:
+    explicit ChaseLevDeque(size_t capacity = 256) : top(0), bottom(0)
+    {
+        size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+        Ring *ring = new Ring(cap);
+        rings.push_back(ring);
+        array.store(ring, std::memory_order_relaxed);
+    }
+
+    ~ChaseLevDeque()
+    {
+        for (Ring *ring : rings)
+            delete ring;
+    }
+
+    ChaseLevDeque(const ChaseLevDeque &) = delete;
+    ChaseLevDeque &operator=(const ChaseLevDeque &) = delete;
+
+    // Owner only
+    void push(T value)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Ring *ring = array.load(std::memory_order_relaxed);
+        if (b - t > static_cast<int64_t>(ring->mask))
+            ring = grow(ring, t, b);
+        ring->put(b, value);
+        bottom.store(b + 1, std::memory_order_release); // publishes the value (and what it points to) to the thieves
+    }
+
+    // Owner only, takes the most recently pushed value
+    bool pop(T &out)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring *ring = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        { // empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        out = ring->get(b);
+        if (t == b)
+        { // the last element, race the thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread, takes the oldest value. Fails if the deque is empty or another thread won the race.
+    bool steal(T &out)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        Ring *ring = array.load(std::memory_order_acquire);
+        T value = ring->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+        out = value;
+        return true;
+    }
+
+    // Approximate number of elements, any thread
+    size_t size() const
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+private:
+    struct Ring
+    {
+        size_t mask;
+        std::atomic<T> *slots;
+
+        explicit Ring(size_t capacity) : mask(capacity - 1), slots(new std::atomic<T>[capacity]) {}
+        ~Ring() { delete[] slots; }
+
+        T get(int64_t i) const { return slots[static_cast<size_t>(i) & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T value) { slots[static_cast<size_t>(i) & mask].store(value, std::memory_order_relaxed); }
+    };
+
+    Ring *grow(Ring *old, int64_t t, int64_t b)
+    {
+        Ring *ring = new Ring((old->mask + 1) * 2);
+        for (int64_t i = t; i < b; i++)
+            ring->put(i, old->get(i));
+        rings.push_back(ring);
+        array.store(ring, std::memory_order_release);
+        return ring;
+    }
+
+    alignas(64) std::atomic<int64_t> top;    // thieves' end
+    alignas(64) std::atomic<int64_t> bottom; // owner's end
+    alignas(64) std::atomic<Ring *> array;
+    std::vector<Ring *> rings; // every ring ever used, owner only
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+
+// Memory resource forwarding to an upstream one and counting the bytes it currently holds from it.
+// Not thread-safe, like the arenas it sits under.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    explicit CountingResource(std::pmr::memory_resource *upstream = std::pmr::new_delete_resource()) : upstream(upstream) {}
+
+    size_t bytes() const { return held; }
+
+private:
+    void *do_allocate(size_t size, size_t alignment) override
+    {
+        void *p = upstream->allocate(size, alignment);
+        held += size;
+        return p;
+    }
+
+    void do_deallocate(void *p, size_t size, size_t alignment) override
+    {
+        upstream->deallocate(p, size, alignment);
+        held -= size;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+    std::pmr::memory_resource *upstream;
+    size_t held = 0;
+};
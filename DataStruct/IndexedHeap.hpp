@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+/**
+ * Min-heap of the items 0 .. n - 1 by their keys, indexed by item: every item's position in the heap is kept in an
+ * array, so lowering a key finds the item in O(1) where BinaryHeap looks its values up in a map.
+ * Meant for Dijkstra over vertex ids, one heap serves many runs (it is empty again after the last pop).
+ */
+template <typename Key>
+class IndexedHeap
+{
+public:
+    // A heap for the items 0 .. n - 1, its arrays come from resource (e.g. a ScratchScope)
+    explicit IndexedHeap(size_t n, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : heap(resource), position(n, ABSENT, resource), keys(n, Key(), resource)
+    {
+        heap.reserve(n);
+    }
+
+    bool empty() const { return heap.empty(); }
+
+    // Insert item with key, or lower its key if it is in the heap with a higher one
+    void push(size_t item, Key key)
+    {
+        size_t index = position[item];
+        if (index == ABSENT)
+        {
+            index = heap.size();
+            heap.push_back(item);
+        }
+        else if (!(key < keys[item]))
+            return;
+        keys[item] = key;
+        siftUp(index);
+    }
+
+    // Remove the item of the least key, returns it with its key
+    std::pair<size_t, Key> pop()
+    {
+        size_t item = heap.front();
+        position[item] = ABSENT;
+        size_t last = heap.back();
+        heap.pop_back();
+        if (!heap.empty())
+        {
+            heap.front() = last;
+            siftDown(0);
+        }
+        return {item, keys[item]};
+    }
+
+private:
+    static constexpr size_t ABSENT = std::numeric_limits<size_t>::max();
+
+    // Move the item at index up to its place
+    void siftUp(size_t index)
+    {
+        size_t item = heap[index];
+        while (index > 0)
+        {
+            size_t parent = (index - 1) / 2;
+            if (!(keys[item] < keys[heap[parent]]))
+                break;
+            heap[index] = heap[parent];
+            position[heap[index]] = index;
+            index = parent;
+        }
+        heap[index] = item;
+        position[item] = index;
+    }
+
+    // Move the item at index down to its place
+    void siftDown(size_t index)
+    {
+        size_t item = heap[index];
+        size_t size = heap.size();
+        while (2 * index + 1 < size)
+        {
+            size_t child = 2 * index + 1;
+            if (child + 1 < size && keys[heap[child + 1]] < keys[heap[child]])
+                child++;
+            if (!(keys[heap[child]] < keys[item]))
+                break;
+            heap[index] = heap[child];
+            position[heap[index]] = index;
+            index = child;
+        }
+        heap[index] = item;
+        position[item] = index;
+    }
+
+    std::pmr::vector<size_t> heap;     // the items, a binary min-heap by key
+    std::pmr::vector<size_t> position; // position[item]: its index in heap, ABSENT when it isn't in the heap
+    std::pmr::vector<Key> keys;        // the key of every item pushed
+};
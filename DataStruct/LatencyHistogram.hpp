@@ -0,0 +1,116 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <stdio.h>
+
+// Nanoseconds on the steady clock, for timestamps that are only compared to each other
+inline uint64_t steadyNanos()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// "850ns", "12.3us", "4.1ms", "1.20s"
+inline std::string formatNanos(double nanos)
+{
+    char buf[32];
+    if (nanos < 1e3)
+        snprintf(buf, sizeof buf, "%.0fns", nanos);
+    else if (nanos < 1e6)
+        snprintf(buf, sizeof buf, "%.1fus", nanos / 1e3);
+    else if (nanos < 1e9)
+        snprintf(buf, sizeof buf, "%.1fms", nanos / 1e6);
+    else
+        snprintf(buf, sizeof buf, "%.2fs", nanos / 1e9);
+    return buf;
+}
+
+// Counter written by a single thread and read by any: a relaxed load and store, no read-modify-write
+inline void bumpCounter(std::atomic<uint64_t> &counter, uint64_t by = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+// Merged view of one or more histograms
+struct HistogramSummary
+{
+    static constexpr size_t BUCKETS = 40; // bucket b counts the samples in [2^b, 2^(b+1)) ns, the last one everything above
+    std::array<uint64_t, BUCKETS> buckets{};
+    uint64_t count = 0;
+    uint64_t sumNanos = 0;
+
+    // Upper bound of the bucket holding the p-quantile (0 < p <= 1), 0 without samples
+    uint64_t percentile(double p) const
+    {
+        uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(count) + 0.5);
+        if (rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++)
+        {
+            seen += buckets[b];
+            if (seen >= rank)
+                return (uint64_t(1) << (b + 1)) - 1;
+        }
+        return 0;
+    }
+
+    double mean() const
+    {
+        return count == 0 ? 0 : static_cast<double>(sumNanos) / static_cast<double>(count);
+    }
+
+    // "mean 3.4us p50 <4.1us p99 <16.4us", "-" without samples
+    std::string format() const
+    {
+        if (count == 0)
+            return "-";
+        return "mean " + formatNanos(mean()) + " p50 <" + formatNanos(static_cast<double>(percentile(0.5))) +
+               " p99 <" + formatNanos(static_cast<double>(percentile(0.99)));
+    }
+};
+
+/**
+ * Log2-bucketed latency histogram, recorded by a single thread and read by any.
+ * Recording is two relaxed load/store pairs, so it can stay on in production; a reader may miss the sample
+ * being recorded, it never sees a torn counter.
+ */
+class LatencyHistogram
+{
+public:
+    void record(uint64_t nanos)
+    {
+        bumpCounter(buckets[bucketOf(nanos)]);
+        bumpCounter(sumNanos, nanos);
+    }
+
+    // record() for a histogram shared by several writers, with read-modify-writes
+    void recordShared(uint64_t nanos)
+    {
+        buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+        sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    void addTo(HistogramSummary &summary) const
+    {
+        for (size_t b = 0; b < HistogramSummary::BUCKETS; b++)
+        {
+            uint64_t n = buckets[b].load(std::memory_order_relaxed);
+            summary.buckets[b] += n;
+            summary.count += n;
+        }
+        summary.sumNanos += sumNanos.load(std::memory_order_relaxed);
+    }
+
+private:
+    static size_t bucketOf(uint64_t nanos)
+    {
+        size_t b = nanos == 0 ? 0 : static_cast<size_t>(63 - __builtin_clzll(nanos));
+        return b < HistogramSummary::BUCKETS ? b : HistogramSummary::BUCKETS - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, HistogramSummary::BUCKETS> buckets{};
+    std::atomic<uint64_t> sumNanos{0};
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include "CountingResource.hpp"
+
+/**
+ * Per-thread scratch memory for the temporaries of one computation (edge lists, heaps, union-find arrays).
+ * A monotonic arena over a buffer the thread keeps between computations: an allocation is a pointer bump, nothing is
+ * freed one by one, and the arena is reset when the thread's outermost ScratchScope ends. What did not fit in the
+ * buffer came from the heap and is counted, the buffer grows by that much at the reset, so a warmed-up worker runs
+ * its computations without calling malloc.
+ * Memory from the arena must not outlive the scope (results go to the graph's own arena).
+ */
+class ScratchArena
+{
+public:
+    // The calling thread's arena
+    static ScratchArena &local()
+    {
+        static thread_local ScratchArena arena;
+        return arena;
+    }
+
+    std::pmr::memory_resource *resource() { return &*arena; }
+
+private:
+    friend class ScratchScope;
+
+    static constexpr size_t INITIAL_SIZE = 64 << 10;
+    static constexpr size_t MAX_RETAINED = 64 << 20; // a thread doesn't keep more than this between computations
+
+    ScratchArena() : size(INITIAL_SIZE), buffer(new std::byte[INITIAL_SIZE])
+    {
+        arena.emplace(buffer.get(), size, &overflow);
+    }
+
+    void enter() { depth++; }
+
+    void leave()
+    {
+        if (--depth > 0)
+            return;
+        size_t spilled = overflow.bytes();
+        if (spilled == 0)
+        {
+            arena->release(); // back to the start of the buffer
+            return;
+        }
+        size_t grown = std::min(size + spilled, MAX_RETAINED);
+        arena.reset(); // returns the overflow blocks to the heap
+        if (grown > size)
+        {
+            size = grown;
+            buffer.reset(new std::byte[size]);
+        }
+        arena.emplace(buffer.get(), size, &overflow);
+    }
+
+    size_t depth = 0;
+    size_t size;
+    std::unique_ptr<std::byte[]> buffer;
+    CountingResource overflow; // upstream of the arena once the buffer is full
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+};
+
+// Scratch memory of the calling thread until the end of the scope, scopes nest (the outermost one resets the arena)
+class ScratchScope
+{
+public:
+    ScratchScope() : arena(ScratchArena::local()) { arena.enter(); }
+    ~ScratchScope() { arena.leave(); }
+    ScratchScope(const ScratchScope &) = delete;
+    ScratchScope &operator=(const ScratchScope &) = delete;
+
+    std::pmr::memory_resource *resource() { return arena.resource(); }
+
+private:
+    ScratchArena &arena;
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Bounded ring of sequence-numbered values, between a stage that may finish them out of order and a stage that must
+ * take them in order.
+ * Producers put() the value of sequence number n into slot n % capacity, in any order. Consumers take() by claiming
+ * the next sequence number and waiting for exactly that value, so the values leave in sequence order whatever the
+ * number of producers and consumers: the slots are the reorder buffer. Every slot carries a stamp (n when it is free
+ * for n, n + 1 when it holds n), written with release and read with acquire; slots and the claim counter each sit on
+ * their own cache line. With one producer and one consumer a hand-off is a slot write, a stamp store and one
+ * uncontended fetch_add.
+ * Waiting is adaptive spin-then-park: spin while the other side keeps up (the spin budget grows when spinning pays
+ * off and shrinks when it doesn't), then yield, then sleep on a condition variable that is only signalled when a
+ * thread is actually parked.
+ */
+template <typename T>
+class SequencedRing
+{
+public:
+    explicit SequencedRing(size_t capacity = 1024) : next(0), producerSpin(MIN_SPIN), consumerSpin(MIN_SPIN), parked(0)
+    {
+        size_t cap = 2; // with a single slot a free stamp and a full one could not be told apart
+        while (cap < capacity)
+            cap <<= 1;
+        slots.reset(new Slot[cap]);
+        for (size_t i = 0; i < cap; i++)
+            slots[i].stamp.store(i, std::memory_order_relaxed);
+        mask = cap - 1;
+    }
+
+    SequencedRing(const SequencedRing &) = delete;
+    SequencedRing &operator=(const SequencedRing &) = delete;
+
+    // Put the value of sequence number seq, waits while its slot still holds seq - capacity. False if stop was set.
+    bool put(size_t seq, const T &value, const std::atomic<bool> &stop)
+    {
+        Slot &slot = slots[seq & mask];
+        if (!waitFor([&]()
+                     { return slot.stamp.load(std::memory_order_acquire) == seq; },
+                     producerSpin, stop))
+            return false;
+        slot.value = value;
+        slot.stamp.store(seq + 1, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    // Claim the next sequence number and wait for its value. False if stop was set.
+    bool take(T &out, size_t &seq, const std::atomic<bool> &stop)
+    {
+        seq = next.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = slots[seq & mask];
+        if (!waitFor([&]()
+                     { return slot.stamp.load(std::memory_order_acquire) == seq + 1; },
+                     consumerSpin, stop))
+            return false;
+        out = slot.value;
+        slot.stamp.store(seq + mask + 1, std::memory_order_release); // free for the next lap
+        notify();
+        return true;
+    }
+
+    // Call f on every value still in the ring, once no thread uses it anymore
+    template <typename F>
+    void drain(F f)
+    {
+        for (size_t i = 0; i <= mask; i++)
+        {
+            if (((slots[i].stamp.load(std::memory_order_acquire) - i) & mask) == 1) // holds i + k * capacity
+                f(slots[i].value);
+        }
+    }
+
+    // Wake every parked thread (after setting their stop flag)
+    void wake()
+    {
+        std::lock_guard<std::mutex> lock(parkMutex);
+        parkCondition.notify_all();
+    }
+
+private:
+    static constexpr int MIN_SPIN = 16;
+    static constexpr int MAX_SPIN = 4096;
+    static constexpr int YIELDS = 8;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<size_t> stamp;
+        T value;
+    };
+
+    static void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+    template <typename Ready>
+    bool waitFor(Ready ready, std::atomic<int> &spinBudget, const std::atomic<bool> &stop)
+    {
+        if (ready())
+            return true;
+        int budget = spinBudget.load(std::memory_order_relaxed);
+        for (int i = 0; i < budget; i++)
+        {
+            cpuRelax();
+            if (ready())
+            {
+                spinBudget.store(std::min(budget * 2, MAX_SPIN), std::memory_order_relaxed); // spinning paid off
+                return true;
+            }
+        }
+        spinBudget.store(std::max(budget / 2, MIN_SPIN), std::memory_order_relaxed);
+        for (int i = 0; i < YIELDS; i++)
+        {
+            std::this_thread::yield();
+            if (ready())
+                return true;
+        }
+        std::unique_lock<std::mutex> lock(parkMutex);
+        parked.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with notify: we see the change or it sees us parked
+        while (!ready() && !stop)
+            parkCondition.wait(lock);
+        parked.fetch_sub(1, std::memory_order_relaxed);
+        return ready();
+    }
+
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(parkMutex);
+            parkCondition.notify_all();
+        }
+    }
+
+    alignas(64) std::atomic<size_t> next; // next sequence number to claim
+    alignas(64) std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    std::atomic<int> producerSpin;
+    std::atomic<int> consumerSpin;
+    std::mutex parkMutex;
+    std::condition_variable parkCondition;
+    std::atomic<int> parked; // threads sleeping on parkCondition
+};
@@ -5,7 +5,7 @@
 
     // Constructor to create and 
     // initialize sets of n items 
-    UnionFind::UnionFind(size_t n): n(n), rank(n), parent(n)
+    UnionFind::UnionFind(size_t n, std::pmr::memory_resource *resource): n(n), rank(n, resource), parent(n, resource)
     { 
         makeSet(); 
     } 
@@ -2,6 +2,7 @@
   
 #pragma once
 #include <vector>
+#include <memory_resource>
 #include <stddef.h>
 
   
@@ -9,14 +10,15 @@ class UnionFind {
 
 private:
     size_t n; 
-    std::vector<size_t> rank, parent;
+    std::pmr::vector<size_t> rank, parent;
 
   
 public: 
     
     // Constructor to create and 
-    // initialize sets of n items 
-    UnionFind(size_t n);
+    // initialize sets of n items, the arrays
+    // come from resource (e.g. a ScratchScope)
+    UnionFind(size_t n, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
   
     // Creates n single item sets 
     void makeSet();
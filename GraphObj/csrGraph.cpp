@@ -0,0 +1,197 @@
+#include "csrGraph.hpp"
+#include "graph.hpp"
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'M', 'S', 'T', 'G', 'R', 'P', 'H', '\0'};
+
+// Files that are currently mapped, so all connections share one mapping of the same file.
+// The key identifies the file's content: device, inode, size and modification time.
+static std::map<std::string, std::weak_ptr<const CSRGraph>> openFiles;
+static std::mutex openFilesMutex;
+
+// Size of the neighbors array in the file, padded so the weights are 8 byte aligned
+static size_t paddedNeighborsSize(uint64_t adjCount)
+{
+    return static_cast<size_t>((adjCount * sizeof(uint32_t) + 7) & ~static_cast<uint64_t>(7));
+}
+
+uint64_t newGraphId()
+{
+    static std::atomic<uint64_t> next(1);
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+CSRGraph::~CSRGraph()
+{
+    if (mapping != nullptr)
+        munmap(mapping, mappingSize);
+}
+
+std::shared_ptr<const CSRGraph> CSRGraph::fromGraph(const Graph &g)
+{
+    std::shared_ptr<CSRGraph> csr(new CSRGraph());
+    csr->n = g.numVertices();
+    csr->m = g.numEdges();
+
+    // count the degrees, then turn them into row offsets
+    csr->ownedOffsets.assign(csr->n + 1, 0);
+    g.forEachEdge([&](size_t u, size_t v, size_t)
+                  {
+                      csr->ownedOffsets[u + 1]++;
+                      if (u != v)
+                          csr->ownedOffsets[v + 1]++; });
+    for (size_t v = 0; v < csr->n; v++)
+        csr->ownedOffsets[v + 1] += csr->ownedOffsets[v];
+
+    // fill the rows, next[v] is the next free slot in v's row
+    uint64_t adjCount = csr->ownedOffsets[csr->n];
+    csr->ownedNeighbors.resize(static_cast<size_t>(adjCount));
+    csr->ownedWeights.resize(static_cast<size_t>(adjCount));
+    std::vector<uint64_t> next(csr->ownedOffsets.begin(), csr->ownedOffsets.end() - 1);
+    g.forEachEdge([&](size_t u, size_t v, size_t w)
+                  {
+                      csr->ownedNeighbors[next[u]] = static_cast<uint32_t>(v);
+                      csr->ownedWeights[next[u]++] = w;
+                      if (u != v)
+                      {
+                          csr->ownedNeighbors[next[v]] = static_cast<uint32_t>(u);
+                          csr->ownedWeights[next[v]++] = w;
+                      } });
+
+    csr->offsets = csr->ownedOffsets.data();
+    csr->neighbors = csr->ownedNeighbors.data();
+    csr->weights = csr->ownedWeights.data();
+    return csr;
+}
+
+std::shared_ptr<const CSRGraph> CSRGraph::open(const std::string &path)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    throw std::runtime_error("Graph files can only be mapped on little-endian hosts");
+#endif
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Can't open " + path + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Can't stat " + path + ": " + strerror(errno));
+    }
+
+    std::string key = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+    std::lock_guard<std::mutex> lock(openFilesMutex);
+    auto it = openFiles.find(key);
+    if (it != openFiles.end())
+    {
+        if (std::shared_ptr<const CSRGraph> mapped = it->second.lock())
+        {
+            close(fd);
+            return mapped;
+        }
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(Header))
+    {
+        close(fd);
+        throw std::runtime_error(path + " is not a graph file");
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Can't map " + path + ": " + strerror(errno));
+
+    std::shared_ptr<CSRGraph> csr(new CSRGraph());
+    csr->mapping = mapping;
+    csr->mappingSize = size;
+    csr->path = path;
+
+    // Validate the header and the offsets, O(n), and the neighbour ids, O(m): any path can be loaded, a hand-made or
+    // damaged file must not send forEachNeighbor out of the arrays
+    const Header *header = static_cast<const Header *>(mapping);
+    if (memcmp(header->magic, MAGIC, sizeof MAGIC) != 0)
+        throw std::runtime_error(path + " is not a graph file");
+    if (header->version != VERSION || header->headerSize != sizeof(Header))
+        throw std::runtime_error(path + " has unsupported graph file version " + std::to_string(header->version));
+    // every edge has one (a self loop) or two adjacency entries: m <= adjCount <= 2 m, a bigger m would be believed by
+    // numEdges() and the memory estimates
+    if (header->n >= (1ull << 32) || header->adjCount > (1ull << 40) || header->m > header->adjCount || header->adjCount > 2 * header->m)
+        throw std::runtime_error(path + " has a corrupted header");
+    size_t n = static_cast<size_t>(header->n);
+    size_t expected = sizeof(Header) + (n + 1) * sizeof(uint64_t) + paddedNeighborsSize(header->adjCount) + static_cast<size_t>(header->adjCount) * sizeof(uint64_t);
+    if (expected != size)
+        throw std::runtime_error(path + " is truncated or has trailing data");
+
+    const char *base = static_cast<const char *>(mapping);
+    csr->n = n;
+    csr->m = static_cast<size_t>(header->m);
+    csr->offsets = reinterpret_cast<const uint64_t *>(base + sizeof(Header));
+    csr->neighbors = reinterpret_cast<const uint32_t *>(base + sizeof(Header) + (n + 1) * sizeof(uint64_t));
+    csr->weights = reinterpret_cast<const uint64_t *>(base + sizeof(Header) + (n + 1) * sizeof(uint64_t) + paddedNeighborsSize(header->adjCount));
+    if (csr->offsets[0] != 0 || csr->offsets[n] != header->adjCount)
+        throw std::runtime_error(path + " has corrupted offsets");
+    for (size_t v = 0; v < n; v++)
+    {
+        if (csr->offsets[v] > csr->offsets[v + 1])
+            throw std::runtime_error(path + " has corrupted offsets");
+    }
+    for (size_t k = 0; k < header->adjCount; k++)
+    {
+        if (csr->neighbors[k] >= n)
+            throw std::runtime_error(path + " has corrupted neighbours");
+    }
+
+    // forget files whose mappings were released
+    for (auto entry = openFiles.begin(); entry != openFiles.end();)
+    {
+        if (entry->second.expired())
+            entry = openFiles.erase(entry);
+        else
+            entry++;
+    }
+    openFiles[key] = csr;
+    return csr;
+}
+
+void CSRGraph::save(const Graph &g, const std::string &path)
+{
+    std::shared_ptr<const CSRGraph> csr = g.csrView();
+    if (csr == nullptr)
+        csr = fromGraph(g);
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.version = VERSION;
+    header.headerSize = sizeof(Header);
+    header.n = csr->n;
+    header.m = csr->m;
+    header.adjCount = csr->offsets[csr->n];
+
+    std::string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+        throw std::runtime_error("Can't create " + tmpPath + ": " + strerror(errno));
+    size_t adjCount = static_cast<size_t>(header.adjCount);
+    static const char zeros[8] = {0};
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1 &&
+              fwrite(csr->offsets, sizeof(uint64_t), csr->n + 1, file) == csr->n + 1 &&
+              fwrite(csr->neighbors, sizeof(uint32_t), adjCount, file) == adjCount &&
+              fwrite(zeros, 1, paddedNeighborsSize(adjCount) - adjCount * sizeof(uint32_t), file) == paddedNeighborsSize(adjCount) - adjCount * sizeof(uint32_t) &&
+              fwrite(csr->weights, sizeof(uint64_t), adjCount, file) == adjCount;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) < 0)
+    {
+        unlink(tmpPath.c_str());
+        throw std::runtime_error("Can't write " + path + ": " + strerror(errno));
+    }
+}
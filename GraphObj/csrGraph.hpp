@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Graph;
+
+// A process-unique id for a graph or a CSR graph, never reused (see Graph::identity)
+uint64_t newGraphId();
+
+/**
+ * Read-only graph in compressed sparse row (CSR) form.
+ * The arrays are either owned vectors or a read-only mmap of a graph file, in both cases
+ * the graph is never copied again: a Graph built on top of it is a zero-copy view.
+ *
+ * Graph file layout (version 1, all integers little-endian):
+ *      header    { char magic[8] = "MSTGRPH\0"; u32 version; u32 headerSize; u64 n; u64 m; u64 adjCount; }
+ *      offsets   u64[n + 1]      neighbours of v are neighbors[offsets[v] .. offsets[v + 1])
+ *      neighbors u32[adjCount]   every undirected edge appears in both endpoints' rows (self loops once)
+ *      padding   to a multiple of 8 bytes
+ *      weights   u64[adjCount]   weights[i] is the weight of the edge to neighbors[i]
+ */
+class CSRGraph
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t n;        // number of vertices
+        uint64_t m;        // number of undirected edges
+        uint64_t adjCount; // number of entries in the neighbors/weights arrays
+    };
+
+    ~CSRGraph();
+    CSRGraph(const CSRGraph &) = delete;
+    CSRGraph &operator=(const CSRGraph &) = delete;
+
+    // Build an in-memory CSR copy of a graph
+    static std::shared_ptr<const CSRGraph> fromGraph(const Graph &g);
+
+    // Map a graph file read-only, the same file is mapped once per process while it is in use.
+    // Throws std::runtime_error if the file can't be mapped or is not a valid graph file.
+    static std::shared_ptr<const CSRGraph> open(const std::string &path);
+
+    // Write a graph to a graph file (through a temporary file renamed into place)
+    static void save(const Graph &g, const std::string &path);
+
+    size_t numVertices() const { return n; }
+    size_t numEdges() const { return m; }
+    size_t degree(size_t v) const { return static_cast<size_t>(offsets[v + 1] - offsets[v]); }
+
+    const uint64_t *offsetsData() const { return offsets; }
+    const uint32_t *neighborsData() const { return neighbors; }
+    const uint64_t *weightsData() const { return weights; }
+
+    // Call f(neighbour, weight) for every neighbour of v
+    template <typename F>
+    void forEachNeighbor(size_t v, F f) const
+    {
+        for (uint64_t i = offsets[v]; i < offsets[v + 1]; i++)
+            f(static_cast<size_t>(neighbors[i]), static_cast<size_t>(weights[i]));
+    }
+
+    // Call f(u, v, weight) once for every undirected edge
+    template <typename F>
+    void forEachEdge(F f) const
+    {
+        for (size_t u = 0; u < n; u++)
+        {
+            for (uint64_t i = offsets[u]; i < offsets[u + 1]; i++)
+            {
+                if (u <= neighbors[i])
+                    f(u, static_cast<size_t>(neighbors[i]), static_cast<size_t>(weights[i]));
+            }
+        }
+    }
+
+    // Path of the mapped file, empty for in-memory graphs
+    const std::string &source() const { return path; }
+
+    // The id shared by every view of this CSR graph
+    uint64_t id() const { return uid; }
+
+private:
+    CSRGraph() = default;
+
+    uint64_t uid = newGraphId();
+    size_t n = 0;
+    size_t m = 0;
+    const uint64_t *offsets = nullptr;
+    const uint32_t *neighbors = nullptr;
+    const uint64_t *weights = nullptr;
+
+    // In-memory storage (fromGraph)
+    std::vector<uint64_t> ownedOffsets;
+    std::vector<uint32_t> ownedNeighbors;
+    std::vector<uint64_t> ownedWeights;
+
+    // File mapping (open)
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    std::string path;
+};
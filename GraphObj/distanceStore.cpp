@@ -0,0 +1,93 @@
+#include "distanceStore.hpp"
+#include <limits>
+
+static constexpr size_t UNREACHABLE = std::numeric_limits<size_t>::max(); // INF of graph.hpp
+
+DistanceStore::DistanceStore(size_t n, size_t longest) : n(n), bytesPerDistance(widthFor(longest)), parents(n * n, NO_PARENT)
+{
+    size_t pairs = n * (n - 1) / 2;
+    if (bytesPerDistance == 2)
+        narrow.assign(pairs, UINT16_MAX);
+    else if (bytesPerDistance == 4)
+        middle.assign(pairs, UINT32_MAX);
+    else
+        wide.assign(pairs, UINT64_MAX);
+}
+
+DistanceStore::DistanceStore(const std::vector<std::vector<size_t>> &dist, const std::vector<std::vector<size_t>> &parent)
+{
+    // the width is chosen from the longest path actually there
+    size_t longest = 0;
+    for (const auto &row : dist)
+        for (size_t d : row)
+            if (d != UNREACHABLE && d > longest)
+                longest = d;
+    *this = DistanceStore(dist.size(), longest);
+    for (size_t i = 0; i < n; i++)
+        setRow(i, dist[i].data(), parent[i].data());
+}
+
+size_t DistanceStore::widthFor(size_t longest)
+{
+    // the largest value of each width is INF
+    if (longest < UINT16_MAX)
+        return 2;
+    if (longest < UINT32_MAX)
+        return 4;
+    return 8;
+}
+
+size_t DistanceStore::load(size_t k) const
+{
+    if (bytesPerDistance == 2)
+        return narrow[k] == UINT16_MAX ? UNREACHABLE : narrow[k];
+    if (bytesPerDistance == 4)
+        return middle[k] == UINT32_MAX ? UNREACHABLE : middle[k];
+    return wide[k];
+}
+
+void DistanceStore::store(size_t k, size_t d)
+{
+    if (bytesPerDistance == 2)
+        narrow[k] = d == UNREACHABLE ? UINT16_MAX : static_cast<uint16_t>(d);
+    else if (bytesPerDistance == 4)
+        middle[k] = d == UNREACHABLE ? UINT32_MAX : static_cast<uint32_t>(d);
+    else
+        wide[k] = d;
+}
+
+size_t DistanceStore::distance(size_t i, size_t j) const
+{
+    if (i == j)
+        return 0;
+    return i < j ? load(index(i, j)) : load(index(j, i));
+}
+
+void DistanceStore::setRow(size_t i, const size_t *dist, const size_t *parent)
+{
+    for (size_t j = i + 1; j < n; j++)
+        store(index(i, j), dist[j]);
+    uint32_t *out = &parents[i * n];
+    for (size_t j = 0; j < n; j++)
+        out[j] = parent[j] == UNREACHABLE ? NO_PARENT : static_cast<uint32_t>(parent[j]);
+}
+
+void DistanceStore::row(size_t i, size_t *dist, size_t *parent) const
+{
+    for (size_t j = 0; j < n; j++)
+    {
+        dist[j] = distance(i, j);
+        parent[j] = unpackParent(parents[i * n + j]);
+    }
+}
+
+size_t DistanceStore::memoryBytes() const
+{
+    return narrow.capacity() * sizeof(uint16_t) + middle.capacity() * sizeof(uint32_t) + wide.capacity() * sizeof(uint64_t) +
+           parents.capacity() * sizeof(uint32_t);
+}
+
+size_t DistanceStore::estimateBytes(size_t n, size_t longest)
+{
+    return n * (n - 1) / 2 * widthFor(longest) + n * n * sizeof(uint32_t);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * The cached shortest paths of an undirected graph, packed.
+ * The distance between i and j is the same both ways: it is stored once (the upper triangle, row by row), in the
+ * narrowest of u16/u32/u64 that holds the longest path (the width's largest value stands for INF).
+ * The parents are u32 vertex ids, a full matrix: the parent of j on the path from i is not the one of i from j.
+ * Two n x n size_t matrices take 16 n^2 bytes, the store 4 n^2 plus 1, 2 or 4 n^2 for the distances.
+ */
+class DistanceStore
+{
+public:
+    DistanceStore() = default;
+
+    // An empty store of n vertices whose longest path is at most longest (INF if unknown), every pair unreachable
+    DistanceStore(size_t n, size_t longest);
+
+    // Pack the distance and parent matrices of floydWarshall or dijkstraAllPairs
+    DistanceStore(const std::vector<std::vector<size_t>> &dist, const std::vector<std::vector<size_t>> &parent);
+
+    bool empty() const { return n == 0; }
+    size_t numVertices() const { return n; }
+    // Bytes per distance: 2, 4 or 8
+    size_t width() const { return bytesPerDistance; }
+
+    // The distance between i and j, INF when unreachable
+    size_t distance(size_t i, size_t j) const;
+    // The vertex before j on the shortest path from i, INF when unreachable
+    size_t parent(size_t i, size_t j) const { return unpackParent(parents[i * n + j]); }
+
+    // Store the row of i: its distances to the vertices after it and its parents (n entries each, INF when unreachable)
+    void setRow(size_t i, const size_t *dist, const size_t *parent);
+    // Unpack the row of i into dist and parent (n entries each)
+    void row(size_t i, size_t *dist, size_t *parent) const;
+
+    // Heap memory of the store
+    size_t memoryBytes() const;
+
+    // Memory of the store of a graph of n vertices whose longest path is at most longest
+    static size_t estimateBytes(size_t n, size_t longest);
+
+private:
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    static size_t widthFor(size_t longest);
+    static size_t unpackParent(uint32_t p) { return p == NO_PARENT ? static_cast<size_t>(-1) : p; }
+    // The index of the pair i < j in the upper triangle
+    size_t index(size_t i, size_t j) const { return i * n - i * (i + 1) / 2 + (j - i - 1); }
+    size_t load(size_t k) const;
+    void store(size_t k, size_t d);
+
+    size_t n = 0;
+    size_t bytesPerDistance = 0;
+    // the upper triangle, only the vector of the store's width is used
+    std::vector<uint16_t> narrow;
+    std::vector<uint32_t> middle;
+    std::vector<uint64_t> wide;
+    std::vector<uint32_t> parents; // parents[i * n + j]
+};
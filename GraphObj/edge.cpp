@@ -1,8 +1,8 @@
 #include "edge.hpp"
 #include "vertex.hpp"
 
-// Constructor to create a weighted edge
-Edge::Edge(Vertex s, Vertex e, size_t w ) : start(s), end(e), weight(w) {}
+// Constructor to create a weighted edge, the endpoints are kept by id only (not with their edge lists)
+Edge::Edge(const Vertex &s, const Vertex &e, size_t w) : start(s.getId()), end(e.getId()), weight(w) {}
 
 // Copy constructor to create an edge
 Edge::Edge(const Edge &other) : start(other.start), end(other.end), weight(other.weight) {}
@@ -17,12 +17,12 @@ size_t &Edge::getWeight() { return weight; }
 size_t Edge::getWeight() const { return weight; }
 
 // Get the vertex at the other end of the edge
-Vertex &Edge::getOther(Vertex v)
+Vertex &Edge::getOther(const Vertex &v)
 {
     return start == v ? end : start;
 }
 
-const Vertex &Edge::getOther(Vertex v) const
+const Vertex &Edge::getOther(const Vertex &v) const
 {
     return start == v ? end : start;
 }
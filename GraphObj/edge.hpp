@@ -15,7 +15,7 @@ private:
 
 public:
     // Constructor to create a weighted edge
-    Edge(Vertex s, Vertex e, size_t w = 1);
+    Edge(const Vertex &s, const Vertex &e, size_t w = 1);
 
     // Default constructor
     Edge() = default;
@@ -33,8 +33,8 @@ public:
     size_t getWeight() const;
 
     // Get the vertex at the other end of the edge
-    Vertex &getOther(Vertex v);
-    const Vertex &getOther(Vertex v) const;
+    Vertex &getOther(const Vertex &v);
+    const Vertex &getOther(const Vertex &v) const;
 
     // Check if the edge contains a specific vertex
     bool contains(Vertex &target) const;
@@ -68,7 +68,7 @@ namespace std
         {
             std::size_t h1 = std::hash<Vertex>{}(e.getStart());
             std::size_t h2 =std::hash<Vertex>{}(e.getEnd());
-            return h1 ^ (h2 << 1);
+            return h1 * 0x9E3779B97F4A7C15ull ^ h2; // h1 ^ (h2 << 1) put the edges of small ids in a few thousand buckets
         }
     };
 }
@@ -1,10 +1,29 @@
 #include "graph.hpp"
+#include "../LFP/TaskGroup.hpp"
+#include "../LFP/CancelToken.hpp"
+#include "../Trace/Trace.hpp"
+#include "../DataStruct/ScratchArena.hpp"
+#include "../DataStruct/IndexedHeap.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <unordered_map>
+
+static std::atomic<uint64_t> distanceCacheHits(0);   // stats calls that used the cached distances
+static std::atomic<uint64_t> distanceCacheMisses(0); // stats calls that had to compute the shortest paths
+
+std::pair<uint64_t, uint64_t> Graph::distanceCacheStats()
+{
+    return {distanceCacheHits.load(std::memory_order_relaxed), distanceCacheMisses.load(std::memory_order_relaxed)};
+}
 
 // Check if the graph is connected
 bool Graph::isConnected() const
-{ // use bfs for connected
+{ // use bfs for connected, walking the neighbour lists instead of an adjacency matrix
+    TRACE_SPAN("isConnected");
     size_t n = numVertices();
-    std::vector<std::vector<size_t>> adjMat = adjacencyMatrix();
+    if (n == 0)
+        return true;
     std::vector<bool> visited(n, false);
     std::queue<size_t> q;
     q.push(0);
@@ -14,26 +33,27 @@ bool Graph::isConnected() const
     {
         size_t current = q.front();
         q.pop();
-        for (size_t i = 0; i < n; i++)
-        {
-            if (adjMat[current][i] != INF && !visited[i])
-            {
-                visited[i] = true;
-                q.push(i);
-                count++;
-            }
-        }
+        forEachNeighbor(current, [&](size_t i, size_t)
+                        {
+                            if (!visited[i])
+                            {
+                                visited[i] = true;
+                                q.push(i);
+                                count++;
+                            } });
     }
     return count == n;
 }
 
+GraphArena::GraphArena(size_t vertices) : buffer(std::max<size_t>(vertices * 256, 1024), &heap), pool(&buffer) {}
+
 // Constructor to create an empty graph
-Graph::Graph() : vertices(), edges(), distances(), parent() {}
+Graph::Graph() : arena(new GraphArena(0)), vertices(&arena->pool), edges(&arena->pool), cached() {}
 
 
 
 // Constructor to create a graph from a set of vertices that may already contain edges
-Graph::Graph(std::unordered_set<Vertex> inputVxs) : vertices(), edges(), distances(), parent()
+Graph::Graph(std::unordered_set<Vertex> inputVxs) : arena(new GraphArena(inputVxs.size())), vertices(&arena->pool), edges(&arena->pool), cached()
 {
     // Add vertices to the graph
     for (auto v : inputVxs)
@@ -52,94 +72,117 @@ Graph::Graph(std::unordered_set<Vertex> inputVxs) : vertices(), edges(), distanc
 
 
 
+// Constructor to create a graph of n vertices and no edges
+Graph::Graph(size_t n) : arena(new GraphArena(n)), vertices(&arena->pool), edges(&arena->pool), cached()
+{
+    for (size_t i = 0; i < n; i++)
+        vertices.emplace_hint(vertices.end(), static_cast<int>(i), Vertex(i));
+}
+
 // Copy constructor with option to not copy edges
-Graph::Graph(const Graph &other, bool copyEdges) : vertices(), edges(), distances(), parent()
+Graph::Graph(const Graph &other, bool copyEdges) : arena(new GraphArena(other.numVertices())), vertices(&arena->pool), edges(&arena->pool), cached()
 {   
+    if (other.csr != nullptr && copyEdges)
+    { // views share the (immutable) CSR graph
+        csr = other.csr;
+        cached = other.cached;
+        return;
+    }
+    if (other.csr != nullptr || !copyEdges)
+    { // only the vertices, without their edges (a view has vertices 0..n-1)
+        if (other.csr != nullptr)
+        {
+            for (size_t i = 0; i < other.numVertices(); i++)
+                vertices.emplace_hint(vertices.end(), static_cast<int>(i), Vertex(i));
+        }
+        else
+        {
+            for (const auto &pair : other.vertices)
+                vertices.emplace_hint(vertices.end(), pair.first, Vertex(pair.second.getId()));
+        }
+        return;
+    }
+
     // Copy all vertices:
     for (const auto &pair : other.vertices)
     {
-        vertices[pair.first] = pair.second;  // deep copy vertices
+        vertices.emplace_hint(vertices.end(), pair.first, pair.second);  // deep copy vertices, into this graph's arena
     }
 
-    if (copyEdges)
+    // Copy all edges:
+    for (const auto &e : other.edges)
     {
-        // Copy all edges:
-        for (const auto &e : other.edges)
-        {
-            edges.insert(e);
-        }
+        edges.insert(e);
+    }
+
+    // Copy the cached distances and parents
+    cached = other.cached;
+}
 
 
-        // Copy all distances:
-        if (other.distances.size() != 0)
-        {
-            // deep copy distances:
-            size_t n = other.distances.size();
-            distances = std::vector<std::vector<size_t>>(n, std::vector<size_t>(n, INF));
-            for (size_t i = 0; i < n; i++)
-            {
-                for (size_t j = 0; j < n; j++)
-                {
-                    distances[i][j] = other.distances[i][j];
-                }
-            }
-        }
-        
-        // Copy all parents:
-        if (other.parent.size() != 0)
-        {
-            // deep copy distances, notice it's unique_ptr
-            size_t n = other.parent.size();
-            parent = std::vector<std::vector<size_t>>(n, std::vector<size_t>(n, INF));
-            for (size_t i = 0; i < n; i++)
-            {
-                for (size_t j = 0; j < n; j++)
-                {
-                    parent[i][j] = other.parent[i][j];
-                }
-            }
-        }
-    }
+// Constructor to create a zero-copy view of a CSR graph
+Graph::Graph(std::shared_ptr<const CSRGraph> view) : arena(new GraphArena(0)), vertices(&arena->pool), edges(&arena->pool), csr(std::move(view)), cached() {}
 
-    else
-    { // Remove all edges
-        for (auto &pair : vertices)
-        {
-            pair.second.removeAllEdges();
-            pair.second.getAdj().clear();
-        }
-    }
+std::shared_ptr<const CSRGraph> Graph::csrView() const
+{
+    return csr;
 }
 
+GraphIdentity Graph::identity() const
+{
+    if (csr != nullptr)
+        return GraphIdentity{csr->id(), 0};
+    return GraphIdentity{id, version};
+}
 
+// Turn a CSR view into the map based representation, the cached distances stay valid
+void Graph::materialize()
+{
+    if (csr == nullptr)
+        return;
+    std::shared_ptr<const CSRGraph> view = std::move(csr);
+    csr = nullptr;
+    for (size_t i = 0; i < view->numVertices(); i++)
+        vertices[static_cast<int>(i)] = Vertex(i);
+    view->forEachEdge([this](size_t u, size_t v, size_t w)
+                      { insertEdge(Edge(Vertex(u), Vertex(v), w)); });
+}
 
 // Get the number of vertices in the graph
 size_t Graph::numVertices() const
 {
+    if (csr != nullptr)
+        return csr->numVertices();
     return vertices.size();
 }
 
 // Get the number of edges in the graph
 size_t Graph::numEdges() const
 {
+    if (csr != nullptr)
+        return csr->numEdges();
     return edges.size();
 }
 
 // Check if the graph has a vertex
 bool Graph::hasVertex(Vertex v) const
 {
+    if (csr != nullptr)
+        return v.getId() < csr->numVertices();
     return vertices.find(v.getId()) != vertices.end();
 }
 
 // Get an iterator for the start of edges in the graph
-std::unordered_set<Edge>::iterator Graph::edgesBegin()
+std::pmr::unordered_set<Edge>::iterator Graph::edgesBegin()
 {
+    materialize();
     return edges.begin();
 }
 
 // Get an iterator for the end of edges in the graph
-std::unordered_set<Edge>::iterator Graph::edgesEnd()
+std::pmr::unordered_set<Edge>::iterator Graph::edgesEnd()
 {
+    materialize();
     return edges.end();
 }
 
@@ -150,18 +193,54 @@ std::unordered_set<Edge>::iterator Graph::edgesEnd()
 // Add an edge to the graph, the edge is directed from start to end
 void Graph::addEdge(Edge e)
 {
+    materialize();
     cleanDistParent();
-    vertices[e.getStart().getId()].addEdge(e);
-    vertices[e.getEnd().getId()].addEdge(e);
-    vertices[e.getStart().getId()].getAdj()[e.getOther(vertices[e.getStart().getId()]).getId()] = e.getWeight();
-    vertices[e.getEnd().getId()].getAdj()[e.getOther(vertices[e.getEnd().getId()]).getId()] = e.getWeight();
+    version++;
+    insertEdge(e);
+}
+
+void Graph::insertEdge(const Edge &e)
+{
+    Vertex &start = vertices[e.getStart().getId()];
+    Vertex &end = vertices[e.getEnd().getId()];
+    start.addEdge(e);
+    end.addEdge(e);
+    start.getAdj()[e.getEnd().getId()] = e.getWeight();
+    end.getAdj()[e.getStart().getId()] = e.getWeight();
     edges.insert(e);
 }
 
+// Add a batch of edges: the view is materialized, the distances dropped and the version bumped once
+void Graph::addEdges(const std::vector<Edge> &batch)
+{
+    if (batch.empty())
+        return;
+    materialize();
+    cleanDistParent();
+    version++;
+    edges.reserve(edges.size() + batch.size());
+    // the edge lists of the vertices are extended once per vertex, not searched once per edge
+    std::unordered_map<size_t, std::vector<Edge>> incident;
+    for (const Edge &e : batch)
+    {
+        size_t u = e.getStart().getId(), v = e.getEnd().getId();
+        incident[u].push_back(e);
+        if (v != u)
+            incident[v].push_back(e);
+        vertices[static_cast<int>(u)].getAdj()[v] = e.getWeight();
+        vertices[static_cast<int>(v)].getAdj()[u] = e.getWeight();
+        edges.insert(e);
+    }
+    for (const auto &list : incident)
+        vertices[static_cast<int>(list.first)].addEdges(list.second);
+}
+
 // Remove an edge from the graph
 void Graph::removeEdge(Edge e)
 {
+    materialize();
     cleanDistParent();
+    version++;
     vertices[e.getStart().getId()].removeEdge(e);
     vertices[e.getEnd().getId()].removeEdge(e);
     vertices[e.getStart().getId()].getAdj().erase(e.getOther(vertices[e.getStart().getId()]).getId());
@@ -171,6 +250,32 @@ void Graph::removeEdge(Edge e)
 
 }
 
+// Remove a batch of edges, with a single invalidation like addEdges
+void Graph::removeEdges(const std::vector<Edge> &batch)
+{
+    if (batch.empty())
+        return;
+    materialize();
+    cleanDistParent();
+    version++;
+    std::unordered_set<Edge> removed(batch.begin(), batch.end());
+    std::vector<size_t> touched;
+    for (const Edge &e : batch)
+    {
+        size_t u = e.getStart().getId(), v = e.getEnd().getId();
+        vertices[static_cast<int>(u)].getAdj().erase(v);
+        vertices[static_cast<int>(v)].getAdj().erase(u);
+        edges.erase(e);
+        edges.erase(Edge(e.getEnd(), e.getStart(), e.getWeight()));
+        touched.push_back(u);
+        touched.push_back(v);
+    }
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (size_t u : touched)
+        vertices[static_cast<int>(u)].removeEdges(removed);
+}
+
 void Graph::addEdge(Vertex &start, Vertex &end, size_t weight)
 {
     Edge e(start, end, weight);
@@ -178,14 +283,16 @@ void Graph::addEdge(Vertex &start, Vertex &end, size_t weight)
 }
 
 // Get an iterator for the vertices in the graph
-std::map<int, Vertex>::iterator Graph::begin()
+std::pmr::map<int, Vertex>::iterator Graph::begin()
 {
+    materialize();
     return vertices.begin();
 }
 
 // Get an iterator for the end of the vertices in the graph
-std::map<int, Vertex>::iterator Graph::end()
+std::pmr::map<int, Vertex>::iterator Graph::end()
 {
+    materialize();
     return vertices.end();
 }
 
@@ -194,11 +301,10 @@ std::vector<std::vector<size_t>> Graph::adjacencyMatrix() const
 {
     size_t n = numVertices();
     std::vector<std::vector<size_t>> adjMat(n, std::vector<size_t>(n, INF)); // Initialize all distances to -1, actually infinity, because of using size_t
-    for (auto Edge : edges)
-    {
-        adjMat[Edge.getStart().getId()][Edge.getEnd().getId()] = Edge.getWeight();
-        adjMat[Edge.getEnd().getId()][Edge.getStart().getId()] = Edge.getWeight();
-    }
+    forEachEdge([&adjMat](size_t u, size_t v, size_t w)
+                {
+                    adjMat[u][v] = w;
+                    adjMat[v][u] = w; });
     for (size_t i = 0; i < n; i++)
     {
         adjMat[i][i] = 0;
@@ -209,6 +315,7 @@ std::vector<std::vector<size_t>> Graph::adjacencyMatrix() const
 // Get a vertex by its ID
 Vertex &Graph::getVertex(int id)
 {
+    materialize();
     return vertices[id];
 }
 
@@ -220,14 +327,12 @@ const Vertex &Graph::getVertex(int id) const
 size_t Graph::totalWeight() const
 {
     size_t total = 0;
-    for (const auto &e : edges)
-    {
-        total += e.getWeight();
-    }
+    forEachEdge([&total](size_t, size_t, size_t w)
+                { total += w; });
     return total;
 }
 
-std::string Graph::longestPath(const std::vector<std::vector<size_t>> &dist) const
+std::tuple<size_t, size_t, size_t> Graph::longestPathInfo(const std::vector<std::vector<size_t>> &dist) const
 {
     size_t n = numVertices();
     size_t maxDist = 0;
@@ -244,17 +349,26 @@ std::string Graph::longestPath(const std::vector<std::vector<size_t>> &dist) con
             }
         }
     }
+    return {maxDistIndex, maxDistIndex2, maxDist};
+}
+
+std::string Graph::longestPath(const std::vector<std::vector<size_t>> &dist) const
+{
+    size_t maxDist, maxDistIndex, maxDistIndex2;
+    std::tie(maxDistIndex, maxDistIndex2, maxDist) = longestPathInfo(dist);
     return "Longest path is from " + std::to_string(maxDistIndex) + " to " + std::to_string(maxDistIndex2) + " with a distance of " + std::to_string(maxDist);
 }
 
 // gets the distances between vertices in the graph and the parent matrix for undirected graph
 std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> Graph::getDistances() const
 {
-    if (this->distances.empty())
+    if (cached.empty())
         throw std::runtime_error("Distances not calculated");
-    if (this->parent.empty())
-        throw std::runtime_error("Parent not calculated");
-    return std::make_pair(distances, parent);
+    size_t n = cached.numVertices();
+    std::vector<std::vector<size_t>> dist(n, std::vector<size_t>(n)), parents(n, std::vector<size_t>(n));
+    for (size_t i = 0; i < n; i++)
+        cached.row(i, dist[i].data(), parents[i].data());
+    return std::make_pair(std::move(dist), std::move(parents));
 }
 
 double Graph::avgDistance(const std::vector<std::vector<size_t>> &dist) const
@@ -281,8 +395,12 @@ std::string Graph::shortestPath(size_t start, size_t end, const std::vector<std:
     {
         return "Invalid vertices\n";
     }
+    return shortestPath(start, end, dist[start].data(), parents[start].data());
+}
 
-    if (parents[start][end] == INF)
+std::string Graph::shortestPath(size_t start, size_t end, const size_t *dist, const size_t *parents) const
+{
+    if (parents[end] == INF)
     {
         return "No path exists between " + std::to_string(start) + " and " + std::to_string(end) + "\n";
     }
@@ -294,7 +412,7 @@ std::string Graph::shortestPath(size_t start, size_t end, const std::vector<std:
     size_t current = end;
     while (current != start)
     {
-        current = parents[start][current];
+        current = parents[current];
         pathVec.push_back(current);
     }
     // using reverse iterator to get the path in the correct order
@@ -306,16 +424,18 @@ std::string Graph::shortestPath(size_t start, size_t end, const std::vector<std:
     path.pop_back();
     path.pop_back(); // Remove the last arrow
 
-    return path + " with a distance of " + std::to_string(dist[start][end]) + "\n";
+    return path + " with a distance of " + std::to_string(dist[end]) + "\n";
 }
 
 // gets the shortest path between all vertices in the graph, returns a string with all the paths in the graph for undirected graph
 std::string Graph::allShortestPaths(const std::vector<std::vector<size_t>> &dist, const std::vector<std::vector<size_t>> &parent) const
 {
+    TRACE_SPAN("allShortestPaths");
     size_t n = numVertices();
     std::string paths = "Shortest paths between all vertices in the graph are: \n";
     for (size_t i = 0; i < n; i++)
     {
+        CancelToken::check();
         for (size_t j = i + 1; j < n; j++)
         {
             paths += shortestPath(i, j, dist, parent);
@@ -326,6 +446,7 @@ std::string Graph::allShortestPaths(const std::vector<std::vector<size_t>> &dist
 
 std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> Graph::floydWarshall() const
 {
+    TRACE_SPAN("floydWarshall");
     size_t n = numVertices();
     std::vector<std::vector<size_t>> dist = adjacencyMatrix();
     std::vector<std::vector<size_t>> parent(n, std::vector<size_t>(n, INF));
@@ -341,69 +462,398 @@ std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> Gr
         }
     }
 
+    // rows are independent for a fixed k (row k itself doesn't change), split them on the LFP pool when called from it.
+    // A cancelled request stops between two values of k, its row blocks skip the rest of the current one
+    size_t grain = std::max<size_t>(1, 16384 / std::max<size_t>(n, 1));
     for (size_t k = 0; k < n; k++)
     {
-        for (size_t i = 0; i < n; i++)
+        CancelToken::check();
+        parallelFor(0, n, grain, [&dist, &parent, k, n](size_t lo, size_t hi)
+                    {
+                        if (CancelToken::requested())
+                            return;
+                        for (size_t i = lo; i < hi; i++)
+                        {
+                            if (dist[i][k] == INF)
+                                continue;
+                            for (size_t j = 0; j < n; j++)
+                            {
+                                if (dist[k][j] != INF && dist[i][j] > dist[i][k] + dist[k][j])
+                                {
+                                    dist[i][j] = dist[i][k] + dist[k][j];
+                                    parent[i][j] = parent[k][j];
+                                }
+                            }
+                        } });
+    }
+
+    return {std::move(dist), std::move(parent)};
+}
+
+// One Dijkstra from source over the CSR arrays: the distances and the parents on the paths (INF when unreachable)
+static void dijkstraRow(const CSRGraph &g, size_t source, size_t *dist, size_t *parent, IndexedHeap<size_t> &heap)
+{
+    size_t n = g.numVertices();
+    const uint64_t *offsets = g.offsetsData();
+    const uint32_t *neighbors = g.neighborsData();
+    const uint64_t *weights = g.weightsData();
+    std::fill(dist, dist + n, INF);
+    std::fill(parent, parent + n, INF);
+    dist[source] = 0;
+    parent[source] = source;
+    heap.push(source, 0);
+    while (!heap.empty())
+    {
+        std::pair<size_t, size_t> top = heap.pop();
+        size_t u = top.first;
+        for (uint64_t i = offsets[u]; i < offsets[u + 1]; i++)
         {
-            for (size_t j = 0; j < n; j++)
+            size_t v = neighbors[i];
+            size_t candidate = top.second + weights[i];
+            if (candidate < dist[v])
             {
-                if (dist[i][k] != INF && dist[k][j] != INF && dist[i][j] > dist[i][k] + dist[k][j])
-                {
-                    dist[i][j] = dist[i][k] + dist[k][j];
-                    parent[i][j] = parent[k][j];
-                }
+                dist[v] = candidate;
+                parent[v] = u;
+                heap.push(v, candidate);
             }
         }
     }
+}
+
+std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> Graph::dijkstraAllPairs() const
+{
+    TRACE_SPAN("dijkstraAllPairs");
+    size_t n = numVertices();
+    std::shared_ptr<const CSRGraph> view = csr != nullptr ? csr : CSRGraph::fromGraph(*this);
+    std::vector<std::vector<size_t>> dist(n, std::vector<size_t>(n)), parent(n, std::vector<size_t>(n));
 
-    return {dist, parent};
+    // the sources are independent, a block of them takes about 16K relaxations
+    size_t grain = std::max<size_t>(1, 16384 / (n + 2 * view->numEdges() + 1));
+    parallelFor(0, n, grain, [&](size_t lo, size_t hi)
+                {
+                    ScratchScope scratch;
+                    IndexedHeap<size_t> heap(n, scratch.resource());
+                    for (size_t s = lo; s < hi; s++)
+                    {
+                        if (CancelToken::requested())
+                            return;
+                        dijkstraRow(*view, s, dist[s].data(), parent[s].data(), heap);
+                    } });
+    CancelToken::check();
+    return {std::move(dist), std::move(parent)};
+}
+
+std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> Graph::shortestPathMatrices() const
+{
+    return prefersDijkstra() ? dijkstraAllPairs() : floydWarshall();
+}
+
+void Graph::forEachShortestPathRow(const std::function<void(size_t, const size_t *, const size_t *)> &row) const
+{
+    TRACE_SPAN("shortestPathRows");
+    size_t n = numVertices();
+    if (n == 0)
+        return;
+    std::shared_ptr<const CSRGraph> view = csr != nullptr ? csr : CSRGraph::fromGraph(*this);
+    // a block of about 256K entries of each matrix at a time
+    size_t block = std::min(n, std::max<size_t>(8, (256 << 10) / n));
+    std::vector<size_t> dist(block * n), parent(block * n);
+    for (size_t first = 0; first < n; first += block)
+    {
+        size_t last = std::min(n, first + block);
+        parallelFor(first, last, 1, [&](size_t lo, size_t hi)
+                    {
+                        ScratchScope scratch;
+                        IndexedHeap<size_t> heap(n, scratch.resource());
+                        for (size_t s = lo; s < hi; s++)
+                        {
+                            if (CancelToken::requested())
+                                return;
+                            dijkstraRow(*view, s, &dist[(s - first) * n], &parent[(s - first) * n], heap);
+                        } });
+        CancelToken::check();
+        for (size_t s = first; s < last; s++)
+            row(s, &dist[(s - first) * n], &parent[(s - first) * n]);
+    }
+}
+
+bool Graph::prefersDijkstra() const
+{
+    double n = static_cast<double>(numVertices());
+    double m = static_cast<double>(numEdges());
+    return (n + m) * std::log2(n + 2) < n * n;
+}
+
+void Graph::forEachCachedRow(const std::function<void(size_t, const size_t *, const size_t *)> &row) const
+{
+    size_t n = cached.numVertices();
+    std::vector<size_t> dist(n), parents(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        CancelToken::check();
+        cached.row(i, dist.data(), parents.data());
+        row(i, dist.data(), parents.data());
+    }
+}
+
+void Graph::streamedStats(bool fromCache, std::tuple<size_t, size_t, size_t> &longest, double &average, std::string *paths) const
+{
+    size_t n = numVertices();
+    longest = {0, 0, 0};
+    size_t totalDist = 0;
+    if (paths != nullptr)
+        *paths = "Shortest paths between all vertices in the graph are: \n";
+    // the same order and sums as the matrix versions, one row at a time
+    auto visit = [&](size_t i, const size_t *dist, const size_t *parents)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            if (dist[j] > std::get<2>(longest) && dist[j] != INF && i != j)
+                longest = {i, j, dist[j]};
+            if (j >= i)
+                totalDist += dist[j];
+            if (paths != nullptr && j > i)
+                *paths += shortestPath(i, j, dist, parents);
+        }
+    };
+    if (fromCache)
+        forEachCachedRow(visit);
+    else
+        forEachShortestPathRow(visit);
+    size_t count = n * (n + 1) / 2 - n; // Don't count the diagonal
+    average = static_cast<double>(totalDist) / count;
 }
 
 std::string Graph::longestPath() const
 {
-    if (distances.empty())
+    size_t maxDist, maxDistIndex, maxDistIndex2;
+    std::tie(maxDistIndex, maxDistIndex2, maxDist) = longestPathInfo();
+    return "Longest path is from " + std::to_string(maxDistIndex) + " to " + std::to_string(maxDistIndex2) + " with a distance of " + std::to_string(maxDist);
+}
+std::tuple<size_t, size_t, size_t> Graph::longestPathInfo() const
+{
+    // Without cached distances a tree doesn't need the matrices, a sparse graph streams its rows, a dense one runs
+    // floydWarshall
+    if (cached.empty())
     {
-        std::vector<std::vector<size_t>> dist = getDistances().first;
-        return longestPath(dist);
+        if (isTree())
+            return treeLongestPathInfo();
+        distanceCacheMisses.fetch_add(1, std::memory_order_relaxed);
+        if (prefersDijkstra())
+        {
+            std::tuple<size_t, size_t, size_t> longest;
+            double average;
+            streamedStats(false, longest, average, nullptr);
+            return longest;
+        }
+        return longestPathInfo(floydWarshall().first);
     }
-    return longestPath(distances);
+    distanceCacheHits.fetch_add(1, std::memory_order_relaxed);
+    std::tuple<size_t, size_t, size_t> longest;
+    double average;
+    streamedStats(true, longest, average, nullptr);
+    return longest;
 }
 double Graph::avgDistance() const
 {
-    if (distances.empty())
+    if (cached.empty())
+    {
+        if (isTree())
+            return treeAvgDistance();
+        distanceCacheMisses.fetch_add(1, std::memory_order_relaxed);
+        if (prefersDijkstra())
+        {
+            std::tuple<size_t, size_t, size_t> longest;
+            double average;
+            streamedStats(false, longest, average, nullptr);
+            return average;
+        }
+        return avgDistance(floydWarshall().first);
+    }
+    distanceCacheHits.fetch_add(1, std::memory_order_relaxed);
+    std::tuple<size_t, size_t, size_t> longest;
+    double average;
+    streamedStats(true, longest, average, nullptr);
+    return average;
+}
+
+bool Graph::isTree() const
+{
+    size_t n = numVertices();
+    return n > 0 && numEdges() == n - 1 && isConnected();
+}
+
+std::tuple<size_t, size_t, size_t> Graph::treeLongestPathInfo() const
+{
+    TRACE_SPAN("treeLongestPath");
+    ScratchScope scratch;
+    size_t n = numVertices();
+    std::pmr::vector<size_t> dist(n, INF, scratch.resource());
+    std::pmr::vector<size_t> stack(scratch.resource());
+    // the vertex farthest from root (the lowest id on a tie), the farthest vertex of a tree is an end of a longest path
+    auto farthest = [&](size_t root)
+    {
+        std::fill(dist.begin(), dist.end(), INF);
+        dist[root] = 0;
+        stack.push_back(root);
+        size_t far = root;
+        while (!stack.empty())
+        {
+            size_t u = stack.back();
+            stack.pop_back();
+            if (dist[u] > dist[far] || (dist[u] == dist[far] && u < far))
+                far = u;
+            forEachNeighbor(u, [&](size_t v, size_t w)
+                            {
+                                if (dist[v] == INF)
+                                {
+                                    dist[v] = dist[u] + w;
+                                    stack.push_back(v);
+                                } });
+        }
+        return far;
+    };
+    size_t a = farthest(0);
+    size_t b = farthest(a);
+    if (dist[b] == 0) // like the matrix version: no pair is farther than 0
+        return {0, 0, 0};
+    return {std::min(a, b), std::max(a, b), dist[b]};
+}
+
+double Graph::treeAvgDistance() const
+{
+    TRACE_SPAN("treeAvgDistance");
+    ScratchScope scratch;
+    size_t n = numVertices();
+    std::pmr::vector<size_t> parentOf(n, INF, scratch.resource());
+    std::pmr::vector<size_t> weightUp(n, 0, scratch.resource()); // weight of the edge to the parent
+    std::pmr::vector<size_t> order(scratch.resource());          // a parent before its children
+    std::pmr::vector<size_t> size(n, 1, scratch.resource());     // subtree sizes
+    order.reserve(n);
+    parentOf[0] = 0;
+    order.push_back(0);
+    for (size_t i = 0; i < order.size(); i++)
     {
-        std::vector<std::vector<size_t>> dist = getDistances().first;
-        return avgDistance(dist);
+        size_t u = order[i];
+        forEachNeighbor(u, [&](size_t v, size_t w)
+                        {
+                            if (parentOf[v] == INF)
+                            {
+                                parentOf[v] = u;
+                                weightUp[v] = w;
+                                order.push_back(v);
+                            } });
+    }
+    // the edge above a subtree of s vertices is on the paths of its s * (n - s) pairs
+    size_t totalDist = 0;
+    for (size_t i = order.size(); i-- > 1;)
+    {
+        size_t v = order[i];
+        size[parentOf[v]] += size[v];
+        totalDist += weightUp[v] * size[v] * (n - size[v]);
+    }
+    size_t count = n * (n - 1) / 2;
+    return static_cast<double>(totalDist) / count;
+}
+
+std::string Graph::treeStats() const
+{
+    TRACE_SPAN("treeStats");
+    std::string stats = "Graph with " + std::to_string(numVertices()) + " vertices and " + std::to_string(numEdges()) + " edges\n";
+    stats += "Total weight of edges: " + std::to_string(totalWeight()) + "\n";
+    stats += longestPath() + "\n";
+    stats += "The average distance between vertices is: " + std::to_string(avgDistance()) + "\n";
+    stats += "The shortest paths are not listed (computed without the distance matrices)\n";
+    return stats;
+}
+
+void Graph::cacheDistances()
+{
+    if (prefersDijkstra())
+    { // the rows go straight into the store, no path is longer than all the edges together
+        DistanceStore store(numVertices(), totalWeight());
+        forEachShortestPathRow([&store](size_t i, const size_t *dist, const size_t *parents)
+                               { store.setRow(i, dist, parents); });
+        cached = std::move(store);
+        return;
     }
-    return avgDistance(distances);
+    std::vector<std::vector<size_t>> dist, parents;
+    std::tie(dist, parents) = floydWarshall();
+    cached = DistanceStore(dist, parents);
+}
+
+size_t Graph::memoryBytes() const
+{
+    size_t bytes = sizeof(Graph) + sizeof(GraphArena) + arena->heap.bytes();
+    return bytes + cached.memoryBytes();
+}
+
+size_t Graph::estimateBytes(size_t n, size_t m)
+{
+    // a map node per vertex; a set node and a bucket per edge, and in both end vertices an Edge and an adjacency
+    // map node. The neighbour lists grow by doubling (the pool keeps their old blocks), the pool rounds blocks up and
+    // the arena's blocks grow geometrically: a vertex takes about twice its nodes, an edge three times
+    constexpr size_t NODE = 4 * sizeof(void *); // red-black tree node header
+    size_t vertexBytes = NODE + sizeof(std::pair<const int, Vertex>);
+    size_t edgeBytes = 3 * sizeof(void *) + sizeof(Edge) + 2 * (sizeof(Edge) + NODE + 2 * sizeof(size_t));
+    return sizeof(Graph) + sizeof(GraphArena) + std::max(n * 256, 2 * n * vertexBytes) + 3 * m * edgeBytes;
+}
+
+size_t Graph::estimateDistanceBytes(size_t n, size_t longest)
+{
+    return DistanceStore::estimateBytes(n, longest);
 }
 std::string Graph::allShortestPaths() const
 {
     // If distances are not calculated, calculate them
-    if (distances.empty())
+    if (cached.empty())
     {
+        distanceCacheMisses.fetch_add(1, std::memory_order_relaxed);
+        if (prefersDijkstra())
+        { // a row at a time instead of the matrices
+            std::tuple<size_t, size_t, size_t> longest;
+            double average;
+            std::string paths;
+            streamedStats(false, longest, average, &paths);
+            return paths;
+        }
         // Get the distances between vertices in the graph and the parent matrix
         std::vector<std::vector<size_t>> dist, parent;
         std::tie(dist, parent) = floydWarshall();
         return allShortestPaths(dist, parent);
     }
-    return allShortestPaths(distances, parent);
+    distanceCacheHits.fetch_add(1, std::memory_order_relaxed);
+    std::tuple<size_t, size_t, size_t> longest;
+    double average;
+    std::string paths;
+    streamedStats(true, longest, average, &paths);
+    return paths;
 }
 
 
 std::string Graph::stats() const
 {
-    std::vector<std::vector<size_t>> dist, parents;
-    // Get the distances between vertices in the graph and the parent matrix
-    if (distances.empty() || parent.empty())
-    {
-        std::tie(dist, parents) = floydWarshall();
+    TRACE_SPAN("stats");
+    if (!cached.empty() || prefersDijkstra())
+    { // all the stats from one pass over the rows of the store, or streamed without the matrices
+        bool fromCache = !cached.empty();
+        (fromCache ? distanceCacheHits : distanceCacheMisses).fetch_add(1, std::memory_order_relaxed);
+        std::tuple<size_t, size_t, size_t> longest;
+        double average;
+        std::string paths;
+        streamedStats(fromCache, longest, average, &paths);
+        std::string stats = "Graph with " + std::to_string(numVertices()) + " vertices and " + std::to_string(numEdges()) + " edges\n";
+        stats += "Total weight of edges: " + std::to_string(totalWeight()) + "\n";
+        stats += "Longest path is from " + std::to_string(std::get<0>(longest)) + " to " + std::to_string(std::get<1>(longest)) + " with a distance of " + std::to_string(std::get<2>(longest)) + "\n";
+        stats += "The average distance between vertices is: " + std::to_string(average) + "\n";
+        stats += "The shortest paths are: \n" + paths + "\n";
+        return stats;
     }
-    else
-    {
-        std::tie(dist, parents) = getDistances();
-    }
-    std::string stats = "Graph with " + std::to_string(numVertices()) + " vertices and " + std::to_string(edges.size()) + " edges\n";
+    // Get the distances between vertices in the graph and the parent matrix
+    std::vector<std::vector<size_t>> dist, parents;
+    std::tie(dist, parents) = floydWarshall();
+    distanceCacheMisses.fetch_add(1, std::memory_order_relaxed);
+    std::string stats = "Graph with " + std::to_string(numVertices()) + " vertices and " + std::to_string(numEdges()) + " edges\n";
     stats += "Total weight of edges: " + std::to_string(totalWeight()) + "\n";
     stats += longestPath(dist) + "\n";
     stats += "The average distance between vertices is: " + std::to_string(avgDistance(dist)) + "\n";
@@ -411,26 +861,13 @@ std::string Graph::stats() const
     return stats;
 }
 
-void Graph::setDistances(std::vector<std::vector<size_t>> dist)
+void Graph::setDistances(DistanceStore store)
 {
-    distances = std::move(dist);
-}
-
-void Graph::setParent(std::vector<std::vector<size_t>> pare)
-{
-   parent = std::move(pare);
+    cached = std::move(store);
 }
 
 void Graph::cleanDistParent()
 {
-    //clearing the dist matrix and parent matrix
-    for(size_t i = 0; i< distances.size(); i++){
-        distances[i].clear();
-    }
-    for(size_t i = 0; i< parent.size(); i++){
-        parent[i].clear();
-    }
-    parent.clear();
-    distances.clear();
+    // dropping the packed distances and parents
+    cached = DistanceStore();
 }
-  
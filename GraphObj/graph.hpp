@@ -1,37 +1,97 @@
 #pragma once
 #include "vertex.hpp"
 #include "edge.hpp"
+#include "csrGraph.hpp"
+#include "distanceStore.hpp"
+#include "../DataStruct/CountingResource.hpp"
 #include <map>
 #include <unordered_set>
 #include <vector>
 #include <iostream>
 #include <queue>
 #include <cstddef>
+#include <functional>
 #include <memory>
+#include <memory_resource>
+#include <tuple>
 #define INF static_cast<size_t>(-1)
 
+// Memory of one graph: the nodes of its vertex map, edge set and neighbour lists.
+// A monotonic arena, sized from the vertex count, with a pool on top that recycles the nodes of removed edges.
+struct GraphArena
+{
+    CountingResource heap; // what the arena took from the heap, see Graph::memoryBytes
+    std::pmr::monotonic_buffer_resource buffer;
+    std::pmr::unsynchronized_pool_resource pool;
+
+    explicit GraphArena(size_t vertices);
+};
+
+// What a graph's content is: graphs with equal identities have the same vertices and edges.
+// The source is the graph's id, or the CSR graph's for a view (the views of one file share it until they change).
+struct GraphIdentity
+{
+    uint64_t source;
+    uint64_t version; // changes of the source graph
+
+    bool operator==(const GraphIdentity &other) const { return source == other.source && version == other.version; }
+};
+
 class Graph
 {
 
 private:
+    // Building the graph takes its nodes from the arena instead of a malloc per node, and freeing it gives the
+    // arena's few blocks back at once. Declared first: it outlives the containers using it.
+    // Not thread-safe, like the rest of the graph: one thread changes a graph at a time.
+    std::unique_ptr<GraphArena> arena;
     // Map to store vertices by their IDs
-    std::map<int, Vertex> vertices;
+    std::pmr::map<int, Vertex> vertices;
     // Set to store edges in the graph
-    std::unordered_set<Edge, std::hash<Edge>> edges;
+    std::pmr::unordered_set<Edge, std::hash<Edge>> edges;
+
+    // When set, the graph is a read-only view of this CSR graph and vertices/edges are empty.
+    // They are filled from the view (materialize) the first time the graph is changed or iterated by Vertex/Edge.
+    std::shared_ptr<const CSRGraph> csr;
 
-    std::vector<std::vector<size_t>> distances;  // Matrix to store the distances between vertices
-    std::vector<std::vector<size_t>> parent;  // Matrix to store the parent of each vertex in the shortest path
+    uint64_t id = newGraphId(); // copies get their own
+    uint64_t version = 0;       // bumped by every added or removed edge
+
+    DistanceStore cached; // The distances between vertices and the parents on the shortest paths, packed
 
     // Get the longest path in the graph given the distances
     std::string longestPath(const std::vector<std::vector<size_t>> &dist) const;
+    // Get the ends and the length of the longest path given the distances
+    std::tuple<size_t, size_t, size_t> longestPathInfo(const std::vector<std::vector<size_t>> &dist) const;
     double avgDistance(const std::vector<std::vector<size_t>> &dist) const;
     // Get the shortest path in the graph given the distances
     std::string shortestPath(size_t start, size_t end, const std::vector<std::vector<size_t>> &dist, const std::vector<std::vector<size_t>> &parent) const;
+    // The same given start's row of the distances and of the parents
+    std::string shortestPath(size_t start, size_t end, const size_t *dist, const size_t *parents) const;
     // Get the distances between vertices in the graph and the parent matrix
     std::string allShortestPaths(const std::vector<std::vector<size_t>> &dist, const std::vector<std::vector<size_t>> &parent) const;
 
     void cleanDistParent();
 
+    // Matrix-free stats of a tree, O(n) time and memory: the farthest pair by two traversals, the sum of all the
+    // distances from every edge's weight times the number of paths through it
+    std::tuple<size_t, size_t, size_t> treeLongestPathInfo() const;
+    double treeAvgDistance() const;
+
+    // Whether a Dijkstra per source beats floydWarshall: n (n + m) log n against n^3
+    bool prefersDijkstra() const;
+    // Call row(source, dist, parents) for every source in order with its row of the cached store
+    void forEachCachedRow(const std::function<void(size_t, const size_t *, const size_t *)> &row) const;
+    // The stats from the rows of the cached store, or when fromCache is false of a sparse graph streamed by
+    // forEachShortestPathRow, without the matrices: the longest path, the average distance and, when paths isn't
+    // null, the listing of the shortest paths
+    void streamedStats(bool fromCache, std::tuple<size_t, size_t, size_t> &longest, double &average, std::string *paths) const;
+
+    // Turn a CSR view into the map based representation
+    void materialize();
+    // Add an edge without invalidating the cached distances
+    void insertEdge(const Edge &e);
+
    
     
 
@@ -46,9 +106,47 @@ public:
     // Constructor to create a graph from a set of vertices that may already contain edges
     Graph(std::unordered_set<Vertex> inputVxs);
 
+    // Constructor to create a graph of n vertices (0..n-1) and no edges
+    explicit Graph(size_t n);
+
     //Copy constructor with option to not copy edges
     Graph(const Graph &other, bool copyEdges = false);
 
+    // Constructor to create a zero-copy view of a CSR graph (e.g. a mapped graph file)
+    explicit Graph(std::shared_ptr<const CSRGraph> view);
+
+    // The CSR graph this graph is a view of, nullptr if the graph was materialized or built edge by edge
+    std::shared_ptr<const CSRGraph> csrView() const;
+
+    // The identity of the graph's current content, it changes with every added or removed edge
+    GraphIdentity identity() const;
+
+    // Call f(u, v, weight) once for every edge, works on both representations without copying
+    template <typename F>
+    void forEachEdge(F f) const
+    {
+        if (csr != nullptr)
+        {
+            csr->forEachEdge(f);
+            return;
+        }
+        for (const auto &e : edges)
+            f(e.getStart().getId(), e.getEnd().getId(), e.getWeight());
+    }
+
+    // Call f(neighbour, weight) for every neighbour of vertex u
+    template <typename F>
+    void forEachNeighbor(size_t u, F f) const
+    {
+        if (csr != nullptr)
+        {
+            csr->forEachNeighbor(u, f);
+            return;
+        }
+        for (const auto &adj : vertices.at(static_cast<int>(u)).getAdj())
+            f(adj.first, adj.second);
+    }
+
     // Get the number of vertices in the graph
     size_t numVertices() const;
     // Get the number of edges in the graph
@@ -56,23 +154,27 @@ public:
     // Check if the graph has a vertex
     bool hasVertex(Vertex v) const;
     // Get an iterator for the start of edges in the graph
-    std::unordered_set<Edge>::iterator edgesBegin();
+    std::pmr::unordered_set<Edge>::iterator edgesBegin();
     // Get an iterator for the end of edges in the graph
-    std::unordered_set<Edge>::iterator edgesEnd();
+    std::pmr::unordered_set<Edge>::iterator edgesEnd();
 
     // Add an edge to the graph, the edge is directed from start to end
     void addEdge(Edge e);
     // Remove an edge from the graph
     void removeEdge(Edge e);
+
+    // Add or remove a batch of edges, the cached distances are dropped and the version changes once for all of them
+    void addEdges(const std::vector<Edge> &batch);
+    void removeEdges(const std::vector<Edge> &batch);
  
     //add edge to the graph by vertices
     void addEdge(Vertex &start, Vertex &end, size_t weight = 1);
 
     // Get an iterator for the vertices in the graph
-    std::map<int, Vertex>::iterator begin();
+    std::pmr::map<int, Vertex>::iterator begin();
 
     // Get an iterator for the end of the vertices in the graph
-    std::map<int, Vertex>::iterator end();
+    std::pmr::map<int, Vertex>::iterator end();
 
     // Get the adjacency matrix of the graph
     std::vector<std::vector<size_t>> adjacencyMatrix() const;
@@ -80,7 +182,7 @@ public:
     // Check if the graph is connected
     bool isConnected() const;
 
-    // Get a vertex by its ID
+    // Get a vertex by its ID (the const version is for graphs that are not CSR views)
     Vertex &getVertex(int id);
     const Vertex &getVertex(int id) const;
 
@@ -92,16 +194,52 @@ public:
     // Get total weight of the graph
     size_t totalWeight() const;
     
-    void setDistances(std::vector<std::vector<size_t>>);
-    void setParent(std::vector<std::vector<size_t>>);
+    void setDistances(DistanceStore store);
 
-     // Get the distances between vertices in the graph and the parent matrix
+     // Get the distances between vertices in the graph and the parent matrix.
+     // floydWarshall and the path listings throw Cancelled when the calling thread's request is cancelled (CancelToken)
     std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> floydWarshall() const;
 
+    // The same with a Dijkstra per source over the graph's CSR arrays and an indexed heap, the sources split on the
+    // LFP pool when called from it: O(n m log n), for sparse graphs (an MST)
+    std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> dijkstraAllPairs() const;
+
+    // dijkstraAllPairs on a sparse graph, floydWarshall on a dense one
+    std::pair<std::vector<std::vector<size_t>>, std::vector<std::vector<size_t>>> shortestPathMatrices() const;
+
+    // Call row(source, dist, parents) for every source in order, with its distances and the parents on its shortest
+    // paths (INF when unreachable), without holding the matrices: the rows are computed by Dijkstra a block of
+    // sources at a time, in parallel on the LFP pool, and handed over from the calling thread
+    void forEachShortestPathRow(const std::function<void(size_t, const size_t *, const size_t *)> &row) const;
+
     std::string longestPath() const;
+    // Get {from, to, distance} of the longest shortest path
+    std::tuple<size_t, size_t, size_t> longestPathInfo() const;
     std::string allShortestPaths() const;
     double avgDistance() const;
 
+    // Cache the distances and parents (what the stats use) in the packed store: a sparse graph's rows are streamed
+    // into it, a dense one's floydWarshall matrices packed
+    void cacheDistances();
+
+    // Check if the graph is a tree (connected, with n - 1 edges)
+    bool isTree() const;
+
+    // Stats of a tree without the distance matrices (the shortest paths are not listed)
+    std::string treeStats() const;
+
+    // Heap memory of the graph: its arena and its cached matrices (a CSR view's arrays are shared and not counted)
+    size_t memoryBytes() const;
+
+    // Estimated memory of a graph of n vertices and m edges built edge by edge
+    static size_t estimateBytes(size_t n, size_t m);
+
+    // Memory of the cached distances and parents of a graph of n vertices whose paths are at most longest
+    static size_t estimateDistanceBytes(size_t n, size_t longest = INF);
+
+    // {hits, misses} of the cached distances, over all the graphs: a miss is a stats call that ran floydWarshall
+    static std::pair<uint64_t, uint64_t> distanceCacheStats();
+
 
 
 
@@ -0,0 +1,342 @@
+#include "treeIndex.hpp"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include "../DataStruct/ScratchArena.hpp"
+#include "../DataStruct/UnionFind.hpp"
+
+static constexpr uint32_t UNSEEN = std::numeric_limits<uint32_t>::max();
+
+TreeIndex::TreeIndex(const Graph &tree, GraphIdentity source)
+    : n(tree.numVertices()), levels(1), src(source)
+{
+    while ((static_cast<size_t>(1) << levels) < n)
+        levels++;
+    up.assign(levels * n, 0);
+    heaviest.assign(levels * n, 0);
+    weight.assign(n, 0);
+    rootDist.assign(n, 0);
+    depth.assign(n, 0);
+    component.assign(n, UNSEEN);
+
+    // breadth first from the lowest vertex of every component: parents come before their children
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    for (size_t root = 0; root < n; root++)
+    {
+        if (component[root] != UNSEEN)
+            continue;
+        uint32_t r = static_cast<uint32_t>(root);
+        component[root] = r;
+        up[root] = r;
+        heaviest[root] = r;
+        order.push_back(r);
+        for (size_t head = order.size() - 1; head < order.size(); head++)
+        {
+            uint32_t u = order[head];
+            tree.forEachNeighbor(u, [&](size_t v, size_t w)
+                                 {
+                                     if (component[v] != UNSEEN)
+                                         return;
+                                     component[v] = r;
+                                     up[v] = u;
+                                     heaviest[v] = static_cast<uint32_t>(v);
+                                     weight[v] = w;
+                                     rootDist[v] = rootDist[u] + w;
+                                     depth[v] = depth[u] + 1;
+                                     order.push_back(static_cast<uint32_t>(v)); });
+        }
+    }
+
+    // a climb of 2^k is two climbs of 2^(k-1)
+    for (size_t k = 1; k < levels; k++)
+    {
+        const uint32_t *prevUp = &up[(k - 1) * n];
+        const uint32_t *prevHeaviest = &heaviest[(k - 1) * n];
+        uint32_t *curUp = &up[k * n];
+        uint32_t *curHeaviest = &heaviest[k * n];
+        for (size_t v = 0; v < n; v++)
+        {
+            uint32_t mid = prevUp[v];
+            curUp[v] = prevUp[mid];
+            curHeaviest[v] = heavier(prevHeaviest[v], prevHeaviest[mid]);
+        }
+    }
+
+    // Kruskal again on the tree's edges, every merge becomes the parent of the two components it merges
+    std::vector<uint32_t> byWeight;
+    byWeight.reserve(n);
+    for (size_t v = 0; v < n; v++)
+        if (up[v] != v)
+            byWeight.push_back(static_cast<uint32_t>(v));
+    std::sort(byWeight.begin(), byWeight.end(), [&](uint32_t a, uint32_t b)
+              { return weight[a] < weight[b]; });
+    merges.resize(n + byWeight.size());
+    std::iota(merges.begin(), merges.end(), 0); // every node is a root until it is merged
+    mergedBy.reserve(byWeight.size());
+    ScratchScope scratch;
+    UnionFind sets(n, scratch.resource());
+    std::pmr::vector<uint32_t> top(n, scratch.resource()); // the node of every component in the reconstruction tree
+    std::iota(top.begin(), top.end(), 0);
+    for (uint32_t v : byWeight)
+    {
+        size_t a = sets.find(v), b = sets.find(up[v]);
+        uint32_t node = static_cast<uint32_t>(n + mergedBy.size());
+        merges[top[a]] = node;
+        merges[top[b]] = node;
+        mergedBy.push_back(v);
+        sets.Union(a, b);
+        top[sets.find(a)] = node;
+    }
+}
+
+size_t TreeIndex::climb(size_t u, uint32_t delta, uint32_t &best) const
+{
+    for (size_t k = 0; delta != 0; k++, delta >>= 1)
+    {
+        if (delta & 1)
+        {
+            best = heavier(best, heaviest[k * n + u]);
+            u = up[k * n + u];
+        }
+    }
+    return u;
+}
+
+size_t TreeIndex::lca(size_t u, size_t v) const
+{
+    if (depth[u] < depth[v])
+        std::swap(u, v);
+    uint32_t ignored = static_cast<uint32_t>(u);
+    u = climb(u, depth[u] - depth[v], ignored);
+    if (u == v)
+        return u;
+    for (size_t k = levels; k-- > 0;)
+    {
+        if (up[k * n + u] != up[k * n + v])
+        {
+            u = up[k * n + u];
+            v = up[k * n + v];
+        }
+    }
+    return up[u];
+}
+
+uint64_t TreeIndex::distance(size_t u, size_t v) const
+{
+    return rootDist[u] + rootDist[v] - 2 * rootDist[lca(u, v)];
+}
+
+bool TreeIndex::bottleneck(size_t u, size_t v, TreeEdge &edge) const
+{
+    if (u == v)
+        return false;
+    if (depth[u] < depth[v])
+        std::swap(u, v);
+    uint32_t best = static_cast<uint32_t>(u); // u is deeper, so it isn't the root and has a parent edge
+    u = climb(u, depth[u] - depth[v], best);
+    if (u != v)
+    {
+        for (size_t k = levels; k-- > 0;)
+        {
+            if (up[k * n + u] != up[k * n + v])
+            {
+                best = heavier(best, heavier(heaviest[k * n + u], heaviest[k * n + v]));
+                u = up[k * n + u];
+                v = up[k * n + v];
+            }
+        }
+        best = heavier(best, heavier(static_cast<uint32_t>(u), static_cast<uint32_t>(v))); // the last edges to the LCA
+    }
+    edge = TreeEdge{best, up[best], weight[best]};
+    return true;
+}
+
+std::vector<size_t> TreeIndex::path(size_t u, size_t v) const
+{
+    size_t top = lca(u, v);
+    std::vector<size_t> vertices;
+    vertices.reserve(depth[u] + depth[v] - 2 * depth[top] + 1);
+    for (size_t x = u; x != top; x = up[x])
+        vertices.push_back(x);
+    vertices.push_back(top);
+    size_t half = vertices.size();
+    for (size_t x = v; x != top; x = up[x])
+        vertices.push_back(x);
+    std::reverse(vertices.begin() + static_cast<std::ptrdiff_t>(half), vertices.end());
+    return vertices;
+}
+
+std::vector<TreeIndex::BatchAnswer> TreeIndex::answerBatch(const std::vector<size_t> &pairs) const
+{
+    size_t k = pairs.size() / 2;
+    std::vector<BatchAnswer> answers(k, BatchAnswer{0, NO_EDGE});
+    ScratchScope scratch; // the forests' arrays and the queries, released with the answers
+    std::pmr::vector<uint32_t> lca(k, NO_EDGE, scratch.resource());
+
+    offlineLCA(up.data(), n, pairs, lca); // the first level of up is the tree
+    for (size_t q = 0; q < k; q++)
+        if (lca[q] != NO_EDGE)
+            answers[q].distance = rootDist[pairs[2 * q]] + rootDist[pairs[2 * q + 1]] - 2 * rootDist[lca[q]];
+
+    offlineLCA(merges.data(), merges.size(), pairs, lca);
+    for (size_t q = 0; q < k; q++)
+        if (lca[q] != NO_EDGE)
+            answers[q].heaviest = mergedBy[lca[q] - n];
+    return answers;
+}
+
+void TreeIndex::offlineLCA(const uint32_t *parent, size_t nodes, const std::vector<size_t> &pairs, std::pmr::vector<uint32_t> &lca) const
+{
+    std::pmr::memory_resource *resource = lca.get_allocator().resource();
+    size_t k = pairs.size() / 2;
+
+    // the children of every node and the pairs of every vertex, as ranges of one array each
+    std::pmr::vector<uint32_t> childStart(nodes + 1, 0, resource), children(nodes, resource);
+    for (size_t x = 0; x < nodes; x++)
+        if (parent[x] != x)
+            childStart[parent[x] + 1]++;
+    std::partial_sum(childStart.begin(), childStart.end(), childStart.begin());
+    std::pmr::vector<uint32_t> cursor(childStart.begin(), childStart.end() - 1, resource);
+    for (size_t x = 0; x < nodes; x++)
+        if (parent[x] != x)
+            children[cursor[parent[x]]++] = static_cast<uint32_t>(x);
+
+    std::pmr::vector<uint32_t> pairStart(n + 1, 0, resource), pairOf(resource);
+    for (size_t q = 0; q < k; q++)
+        if (askable(pairs[2 * q], pairs[2 * q + 1]))
+        {
+            pairStart[pairs[2 * q] + 1]++;
+            pairStart[pairs[2 * q + 1] + 1]++;
+        }
+    std::partial_sum(pairStart.begin(), pairStart.end(), pairStart.begin());
+    pairOf.resize(pairStart[n]);
+    cursor.assign(pairStart.begin(), pairStart.end() - 1);
+    for (size_t q = 0; q < k; q++)
+        if (askable(pairs[2 * q], pairs[2 * q + 1]))
+        {
+            pairOf[cursor[pairs[2 * q]]++] = static_cast<uint32_t>(q);
+            pairOf[cursor[pairs[2 * q + 1]]++] = static_cast<uint32_t>(q);
+        }
+
+    // depth first, a finished subtree joins its parent's set, the set's ancestor is the deepest node still open
+    UnionFind sets(nodes, resource);
+    std::pmr::vector<uint32_t> ancestor(nodes, resource);
+    std::pmr::vector<char> done(nodes, 0, resource);
+    std::pmr::vector<std::pair<uint32_t, uint32_t>> stack(resource); // a node and its next child
+    for (size_t root = 0; root < nodes; root++)
+    {
+        if (parent[root] != root)
+            continue;
+        ancestor[root] = static_cast<uint32_t>(root);
+        stack.emplace_back(static_cast<uint32_t>(root), childStart[root]);
+        while (!stack.empty())
+        {
+            uint32_t x = stack.back().first;
+            if (stack.back().second < childStart[x + 1])
+            {
+                uint32_t child = children[stack.back().second++];
+                ancestor[child] = child;
+                stack.emplace_back(child, childStart[child]);
+                continue;
+            }
+            stack.pop_back();
+            done[x] = 1;
+            if (x < n)
+                for (uint32_t i = pairStart[x]; i < pairStart[x + 1]; i++)
+                {
+                    size_t q = pairOf[i];
+                    size_t other = pairs[2 * q] == x ? pairs[2 * q + 1] : pairs[2 * q];
+                    if (done[other]) // the pair is answered at its second end
+                        lca[q] = ancestor[sets.find(other)];
+                }
+            if (!stack.empty())
+            {
+                uint32_t p = stack.back().first;
+                sets.Union(p, x);
+                ancestor[sets.find(p)] = p;
+            }
+        }
+    }
+}
+
+TreeIndex::Centrality TreeIndex::centrality() const
+{
+    Centrality stats;
+    stats.eccentricity.assign(n, 0);
+    stats.distanceSum.assign(n, 0);
+    if (n == 0)
+        return stats;
+    ScratchScope scratch;
+    std::pmr::memory_resource *resource = scratch.resource();
+
+    // the vertices by depth, parents before their children
+    std::pmr::vector<uint32_t> levelStart(n + 1, 0, resource), order(n, resource);
+    for (size_t v = 0; v < n; v++)
+        levelStart[depth[v] + 1]++;
+    std::partial_sum(levelStart.begin(), levelStart.end(), levelStart.begin());
+    for (size_t v = 0; v < n; v++)
+        order[levelStart[depth[v]]++] = static_cast<uint32_t>(v);
+
+    // bottom up: the subtree's size, the distances down to its vertices, and the two longest ways down from
+    // different children
+    std::pmr::vector<uint64_t> size(n, 1, resource), down(n, 0, resource), secondDown(n, 0, resource), upward(n, 0, resource);
+    std::pmr::vector<uint32_t> downChild(n, NO_EDGE, resource);
+    for (size_t i = n; i-- > 0;)
+    {
+        uint32_t v = order[i];
+        if (component[v] == v)
+            continue;
+        uint32_t p = up[v];
+        size[p] += size[v];
+        stats.distanceSum[p] += stats.distanceSum[v] + weight[v] * size[v];
+        uint64_t length = down[v] + weight[v];
+        if (length > down[p])
+        {
+            secondDown[p] = down[p];
+            down[p] = length;
+            downChild[p] = v;
+        }
+        else if (length > secondDown[p])
+            secondDown[p] = length;
+    }
+
+    // top down, rerooting at every child: crossing the edge to v brings v's subtree closer and the rest farther,
+    // the longest way up from v goes through its parent and either further up or down another child
+    for (uint32_t v : order)
+    {
+        if (component[v] != v)
+        {
+            uint32_t p = up[v];
+            uint64_t rest = size[component[v]] - size[v];
+            stats.distanceSum[v] = stats.distanceSum[p] + weight[v] * rest - weight[v] * size[v];
+            upward[v] = weight[v] + std::max(upward[p], downChild[p] == v ? secondDown[p] : down[p]);
+        }
+        stats.eccentricity[v] = std::max(down[v], upward[v]);
+    }
+
+    stats.radius = *std::min_element(stats.eccentricity.begin(), stats.eccentricity.end());
+    for (size_t v = 0; v < n; v++)
+    {
+        if (stats.eccentricity[v] == stats.radius)
+            stats.centers.push_back(v);
+        if (stats.distanceSum[v] < stats.distanceSum[stats.median])
+            stats.median = v;
+    }
+    return stats;
+}
+
+size_t TreeIndex::estimateBytes(size_t n)
+{
+    size_t levels = 1;
+    while ((static_cast<size_t>(1) << levels) < n)
+        levels++;
+    return levels * n * 2 * sizeof(uint32_t) + n * (2 * sizeof(uint64_t) + 5 * sizeof(uint32_t)) + sizeof(TreeIndex);
+}
+
+size_t TreeIndex::batchBytes(size_t n, size_t k)
+{
+    // up to 2n nodes: the children, the sets, the ancestors and the stack; the pairs of every vertex and the LCAs
+    size_t perNode = 6 * sizeof(uint32_t) + 2 * sizeof(size_t) + 1;
+    return 2 * n * perNode + n * sizeof(uint32_t) + k * (3 * sizeof(uint32_t) + sizeof(BatchAnswer));
+}
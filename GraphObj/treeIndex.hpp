@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+#include "graph.hpp"
+
+/**
+ * Path queries on a tree (an MST), answered without the distance matrices.
+ * Every vertex keeps its 2^k-th ancestors and the heaviest edge on the way to each of them (binary lifting),
+ * built in O(n log n) time and memory: the lowest common ancestor, the distance and the heaviest edge between
+ * two vertices take O(log n) and allocate nothing, a path takes O(log n + its length).
+ * The heaviest edge on the MST path between u and v is the bottleneck of the minimax path between them in the graph
+ * the MST was computed from.
+ * A batch of k pairs is answered offline with Tarjan's LCA instead, in O(n + k α(n)): on the tree for the distances,
+ * and on its Kruskal reconstruction tree (a node per edge, merging the components lightest edge first) for the
+ * heaviest edges, the last merge between two vertices being the heaviest edge between them.
+ * The centrality stats (every vertex's eccentricity and distance sum) take two passes over the tree, O(n) with rerooting.
+ * Immutable once built, so several threads and clients can share one.
+ */
+class TreeIndex
+{
+public:
+    // An edge of the tree, from a vertex to its parent
+    struct TreeEdge
+    {
+        size_t from;
+        size_t to;
+        uint64_t weight;
+    };
+
+    // The answer to one pair of a batch
+    struct BatchAnswer
+    {
+        uint64_t distance;
+        uint32_t heaviest; // the vertex whose parent edge is the heaviest on the path, NO_EDGE if there is none
+    };
+    static constexpr uint32_t NO_EDGE = UINT32_MAX;
+
+    // Where to place a facility on the tree: the distances from every vertex to the others of its component
+    struct Centrality
+    {
+        std::vector<uint64_t> eccentricity; // the distance to the farthest vertex
+        std::vector<uint64_t> distanceSum;  // the sum of the distances to all the vertices
+        std::vector<size_t> centers;        // the vertices of the least eccentricity, the middle of a longest path
+        uint64_t radius = 0;                // their eccentricity
+        size_t median = 0;                  // the vertex of the least distance sum (the lowest one on a tie)
+    };
+
+    // Index a tree (a forest is indexed per component), source is the identity of the graph it is the MST of
+    TreeIndex(const Graph &tree, GraphIdentity source);
+
+    size_t numVertices() const { return n; }
+    GraphIdentity source() const { return src; }
+
+    // Whether u and v are in the same component of the tree
+    bool connected(size_t u, size_t v) const { return component[u] == component[v]; }
+
+    // The lowest common ancestor of two connected vertices
+    size_t lca(size_t u, size_t v) const;
+
+    // The weight of the tree path between two connected vertices
+    uint64_t distance(size_t u, size_t v) const;
+
+    // The heaviest edge on the tree path between two connected vertices, false if u == v (the path has no edges)
+    bool bottleneck(size_t u, size_t v, TreeEdge &edge) const;
+
+    // The vertices of the tree path from u to v, both included
+    std::vector<size_t> path(size_t u, size_t v) const;
+
+    // The answers to the pairs u0 v0 u1 v1 ..., in their order. A pair of invalid or disconnected vertices gets
+    // {0, NO_EDGE} like u == u, the caller tells them apart.
+    std::vector<BatchAnswer> answerBatch(const std::vector<size_t> &pairs) const;
+
+    // Every vertex's eccentricity and distance sum, the center(s) and the median of the tree, in O(n)
+    Centrality centrality() const;
+
+    // The edge from v to its parent
+    TreeEdge edgeAbove(uint32_t v) const { return TreeEdge{v, up[v], weight[v]}; }
+
+    // Memory of the index of a tree of n vertices
+    static size_t estimateBytes(size_t n);
+    // Memory of answerBatch for k pairs on a tree of n vertices, the answers included
+    static size_t batchBytes(size_t n, size_t k);
+
+private:
+    // Lift u by delta levels, keeping the heaviest edge passed in best (a vertex, the edge to its parent)
+    size_t climb(size_t u, uint32_t delta, uint32_t &best) const;
+    // Tarjan's offline LCA of the pairs in the forest of the given nodes' parents (a root is its own parent, the
+    // vertices are nodes 0 .. n - 1), lca[q] is left alone for the pairs answerBatch skips
+    void offlineLCA(const uint32_t *parent, size_t nodes, const std::vector<size_t> &pairs, std::pmr::vector<uint32_t> &lca) const;
+    // Whether a pair of a batch is answered with an LCA
+    bool askable(size_t u, size_t v) const { return u < n && v < n && u != v && connected(u, v); }
+    // The heavier of the edges from a and b to their parents
+    uint32_t heavier(uint32_t a, uint32_t b) const { return weight[b] > weight[a] ? b : a; }
+
+    size_t n;
+    size_t levels;                  // ancestors 2^0 .. 2^(levels - 1) are kept
+    GraphIdentity src;
+    std::vector<uint32_t> up;       // up[k * n + v]: the 2^k-th ancestor of v (a root is its own parent)
+    std::vector<uint32_t> heaviest; // heaviest[k * n + v]: the vertex whose parent edge is the heaviest on that climb
+    std::vector<uint64_t> weight;   // the weight of the edge from v to its parent, 0 for a root
+    std::vector<uint64_t> rootDist; // the weight of the path from v's root to v
+    std::vector<uint32_t> depth;    // edges from v's root to v
+    std::vector<uint32_t> component; // the root of v's component
+    std::vector<uint32_t> merges;   // the parents in the Kruskal reconstruction tree, node n + i merges by the i-th lightest edge
+    std::vector<uint32_t> mergedBy; // mergedBy[i]: the vertex whose parent edge is the i-th lightest
+};
@@ -4,6 +4,10 @@
 
 // Constructor to create a vertex with a given ID
 Vertex::Vertex(size_t id) : id(id) {}
+Vertex::Vertex(size_t id, const allocator_type &alloc) : id(id), edges(alloc), adj(alloc) {}
+Vertex::Vertex(const allocator_type &alloc) : id(0), edges(alloc), adj(alloc) {}
+Vertex::Vertex(const Vertex &other, const allocator_type &alloc) : id(other.id), edges(other.edges, alloc), adj(other.adj, alloc) {}
+Vertex::Vertex(Vertex &&other, const allocator_type &alloc) : id(other.id), edges(std::move(other.edges), alloc), adj(std::move(other.adj), alloc) {}
 
 // Getters and setters for vertex properties
 
@@ -24,6 +28,23 @@ void Vertex::removeEdge(Edge e)
     adj.erase(e.getOther(*this).getId());
 }
 
+void Vertex::addEdges(const std::vector<Edge> &batch)
+{
+    std::unordered_set<Edge> present(edges.begin(), edges.end());
+    for (const Edge &e : batch)
+    {
+        if (present.insert(e).second)
+            edges.push_back(e);
+    }
+}
+
+void Vertex::removeEdges(const std::unordered_set<Edge> &batch)
+{
+    edges.erase(std::remove_if(edges.begin(), edges.end(), [&batch](const Edge &e)
+                               { return batch.count(e) > 0; }),
+                edges.end());
+}
+
 //Remove all edges from the vertex
 void Vertex::removeAllEdges()
 {
@@ -32,32 +53,32 @@ void Vertex::removeAllEdges()
 }
 
 // Get an iterator for the edges connected to the vertex
-std::vector<Edge>::iterator Vertex::begin()
+std::pmr::vector<Edge>::iterator Vertex::begin()
 {
     return edges.begin();
 }
-std::vector<Edge>::iterator Vertex::end()
+std::pmr::vector<Edge>::iterator Vertex::end()
 {
     return edges.end();
 }
 
-const std::map<size_t, size_t> &Vertex::getAdj() const
+const std::pmr::map<size_t, size_t> &Vertex::getAdj() const
 {
     return adj;
 }
 
-std::map<size_t, size_t> &Vertex::getAdj()
+std::pmr::map<size_t, size_t> &Vertex::getAdj()
 {
     return adj;
 }
 
 //iterator for the adj map
-std::map<size_t, size_t>::iterator Vertex::adjBegin()
+std::pmr::map<size_t, size_t>::iterator Vertex::adjBegin()
 {
     return adj.begin();
 }
 
-std::map<size_t, size_t>::iterator Vertex::adjEnd()
+std::pmr::map<size_t, size_t>::iterator Vertex::adjEnd()
 {
     return adj.end();
 }
@@ -81,10 +102,8 @@ bool Vertex::operator==(const Vertex &other) const
 Vertex &Vertex::operator=(const Vertex &other)
 {
     id = other.id;
-    for (Edge e : other.edges)
-    {
-        edges.push_back(e);
-    }
+    edges = other.edges;
+    adj = other.adj; // graph copies (snapshots) need the neighbours too
     return *this;
 }
 
@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <iostream>
 #include <map>
+#include <memory_resource>
+#include <unordered_set>
 
 class Edge;
 
@@ -16,17 +18,27 @@ private:
     size_t id;
 
     // List to store the edges connected to the vertex
-    std::vector<Edge> edges;
+    std::pmr::vector<Edge> edges;
 
     // <neighbour, weight to the neighbour>
-    std::map<size_t,size_t> adj;
+    std::pmr::map<size_t,size_t> adj;
 
 public:
+    // The lists come from the allocator's memory resource, a graph's vertices use the graph's arena
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
     // Constructor to create a vertex with a given ID
     Vertex(size_t id);
+    Vertex(size_t id, const allocator_type &alloc);
 
     // Default constructor
     Vertex() = default;
+    explicit Vertex(const allocator_type &alloc);
+
+    // Copies, with the lists in the given allocator's memory
+    Vertex(const Vertex &other) = default;
+    Vertex(const Vertex &other, const allocator_type &alloc);
+    Vertex(Vertex &&other, const allocator_type &alloc);
 
     // Getters and setters for vertex properties
     size_t &getId();
@@ -38,20 +50,26 @@ public:
     // Remove an edge from the vertex
     void removeEdge(Edge e);
 
+    // addEdge for every edge of a batch, in one pass over the vertex's edges instead of one per edge
+    void addEdges(const std::vector<Edge> &batch);
+
+    // Remove the edges equal to one of the batch from the list in one pass (the adjacency map is left to the caller)
+    void removeEdges(const std::unordered_set<Edge> &batch);
+
     //Remove all edges from the vertex
     void removeAllEdges();
 
     // Get an iterator for the edges connected to the vertex
-    std::vector<Edge>::iterator begin();
-    std::vector<Edge>::iterator end();
+    std::pmr::vector<Edge>::iterator begin();
+    std::pmr::vector<Edge>::iterator end();
 
-    const std::map<size_t,size_t>& getAdj() const;
-    std::map<size_t,size_t>& getAdj();
+    const std::pmr::map<size_t,size_t>& getAdj() const;
+    std::pmr::map<size_t,size_t>& getAdj();
 
     //iterator for the adj map
-    std::map<size_t,size_t>::iterator adjBegin();
+    std::pmr::map<size_t,size_t>::iterator adjBegin();
 
-    std::map<size_t,size_t>::iterator adjEnd();
+    std::pmr::map<size_t,size_t>::iterator adjEnd();
 
     // Check if the vertex has an edge connecting to a specific target vertex
     bool hasEdge(Vertex target) const;
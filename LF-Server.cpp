@@ -1,5 +1,5 @@
 /*
-** pollserver.c -- a cheezy multiperson chat server
+** LF-server -- MST server computing the results on a Leader-Follower thread pool
 */
 
 #include <stdio.h>
@@ -11,7 +11,6 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <poll.h>
 #include <algorithm>
 #include <string>
 #include <iostream>
@@ -21,232 +20,167 @@
 #include "MST/MST_Factory.hpp"
 #include "LFP/LFP.hpp"
 #include "ServerUtils/serverUtils.hpp"
+#include "ServerUtils/serverCore.hpp"
+#include "ServerUtils/metrics.hpp"
+#include "ServerUtils/mstFlights.hpp"
 
 // to handle the CTRL+C signal
 #include <signal.h>
 #include <atomic>
 
 #define NUM_THREADS 4 // Number of threads in LFP
-#define PORT "9036"   // Port we're listening on
-#define WELCOME_MSG_SIZE 510
 
 using namespace std;
 
 // global variable:
-LFP lfp(NUM_THREADS);             // Create an instance of LFP
-map<int, Graph *> clients_graphs; // dictionary to store the client file descriptor and its graph
-struct pollfd *pfds;              // set of file descriptors (global to maintain correct memory management when interrupting the server)
-int fd_count = 0;
+MSTFlights flights;            // the MST computations in progress, identical requests share one (outlives the pool's tasks)
+LFP lfp(NUM_THREADS);          // Create an instance of LFP
+ServerCore *server = nullptr;  // the connections and their graphs (global to maintain correct memory management when interrupting the server)
 
-pair<string, Graph *> MST(Graph *g, int clientFd, const string &strat) // many to do here
+pair<string, Graph *> MST(Graph *g, int clientFd, const string &strat, ReplyFormat fmt) // many to do here
 {
-    
-    // Perform the operation
-    Graph *mst = (*MST_Factory::getInstance()->createMST(strat))(g); // the strategy will create a new graph and return a pointer to it
+    bool matrixFree;
+    MemoryReservation memory = reserveMST(*g, clientFd, fmt, matrixFree);
+    if (!memory)
+        return {mstOverBudget(clientFd, fmt), nullptr};
+
+    // the reply is queued on the client's connection (ClientRef), even if the fd is reused meanwhile
+    shared_ptr<CancelToken> cancel = make_shared<CancelToken>(); // cancelled by the client's next mst or its hang up
+    shared_ptr<MSTFlight> flight = flights.join(MSTKey{g->identity(), strat, fmt, matrixFree}, MSTWaiter{clientRef(clientFd), steadyNanos(), cancel});
+    supersedeMST(clientFd, cancel); // after joining: a repeated command shares the computation instead of cancelling it
+    if (flight == nullptr)
+    { // the same MST is being computed, this client gets its result too
+        metrics::countCoalescedMST();
+        return {"", nullptr};
+    }
+
+    // the reactor keeps mutating g, the worker computes on a snapshot (a CSR graph is shared, not copied)
+    Graph *snapshot = new Graph(*g, true);
+    MST_Strategy *strategy = MST_Factory::getInstance()->createMST(strat);
     // implementing Leader-Follower with global variable "lfp":
-    lfp.addTask([clientFd, strat, mst]()
+    lfp.addTask([flight, snapshot, strategy, memory = std::move(memory)]() mutable
                 {
                     // sleep(7);
-                    string msg = "Client " + to_string(clientFd) + " requested to find MST of the Graph" + "\n";
-                    msg += "MST Strategy: " + strat + "\n";
-                    msg += "MSTs' stats: \n" + mst->stats();
-                    send(clientFd, msg.c_str(), msg.size(), 0);
-                    //cout << "User " << clientFd << "succesfuly finished finding MST of the Graph" << endl;
-                    delete mst; // deleting the mst graph
+                    const MSTKey &key = flight->key;
+                    unique_ptr<Graph> input(snapshot);
+                    string reply; // the same for every waiter, text replies are prefixed with the client
+                    shared_ptr<const TreeIndex> tree; // kept for the waiters' path/dist/bottleneck queries
+                    bool cancelled = false;
+                    {
+                        CancelScope cancelScope(flight->cancel.get()); // the strategy, floydWarshall and the paths poll the token
+                        try
+                        {
+                            unique_ptr<Graph> mst((*strategy)(input.get())); // the strategy will create a new graph and return a pointer to it
+                            input.reset();
+                            tree = make_shared<TreeIndex>(*mst, key.graph);
+                            if (!key.matrixFree)
+                                mst->cacheDistances();
+                            if (key.fmt == ReplyFormat::Binary) // binary clients get the MST edges and the numeric stats in one frame
+                                reply = binproto::encodeMSTResult(*mst, binproto::summarize(*mst, key.strat));
+                            else if (key.matrixFree)
+                                reply = "MST Strategy: " + key.strat + "\nThe distance matrices don't fit in the memory budget, MSTs' stats: \n" + mst->treeStats();
+                            else
+                                reply = "MST Strategy: " + key.strat + "\nMSTs' stats: \n" + mst->stats();
+                        }
+                        catch (const Cancelled &)
+                        { // the graphs built so far were freed on the way out
+                            cancelled = true;
+                        }
+                    }
+                    for (MSTWaiter &waiter : flights.finish(*flight))
+                    {
+                        if (cancelled || waiter.cancel->cancelled())
+                        { // every waiter hung up or was superseded, or this one sent a newer mst and the flight ran on for the others
+                            metrics::countCancelledMST();
+                            sendMSTCancelled(waiter.client, key.fmt);
+                            continue;
+                        }
+                        keepTree(waiter.client, tree);
+                        if (key.fmt == ReplyFormat::Binary)
+                            queueSend(waiter.client, reply);
+                        else
+                            queueSend(waiter.client, "Client " + to_string(waiter.client.fd) + " requested to find MST of the Graph\n" + reply);
+                        metrics::recordMST(key.strat, steadyNanos() - waiter.started);
+                    }
+                    memory.release(); // the replies are queued
                 });
     return {"", nullptr};
 }
 
 /**
- * Handle the signal, actually stopping the server's while loop
+ * Handle the signal, actually stopping the server's while loop: only reactor 0's thread takes SIGINT, the rest of the
+ * shutdown runs in main once run() returned (closeAll joins the reactors and takes locks, not in a signal handler)
  */
 void handleSig(int sig)
+{
+    if (server != nullptr)
+        server->stop();
+}
+
+/**
+ * Free the graphs and the clients after the server's while loop stopped
+ */
+void cleanUp()
 {
     cout << "\nLF-server: cleaning up resources..." << endl;
 
-    // graphs:
-    for (auto &graph : clients_graphs)
+    // graphs and clients:
+    if (server != nullptr)
     {
-        if (graph.second != nullptr)
-        {
-            delete graph.second;
-            graph.second = nullptr;
-        }
+        OutputStats stats = server->outputStats();
+        cout << "LF-server: " << stats.writtenBytes << " bytes sent, at most " << stats.peakQueuedBytes
+             << " bytes queued, reads paused " << stats.readPauses << " times" << endl;
+        server->closeAll();
     }
+    // the queued tasks run now, while the flights and the metrics they finish with still exist
+    lfp.stop();
 
     cout << "LF-server: Graphs freed," << endl;
-
-    // Clients: cleans the pfds
-    for (int i = 0; i < fd_count; i++)
-    {
-        if (pfds[i].fd != -1)
-        {
-            close(pfds[i].fd);
-        }
-    }
-    free(pfds);
     cout << "LF-server: Clients freed,\n"
          << "Good Bye!" << endl;
-    exit(0);
 }
 
 // Main
-int main(void)
+int main(int argc, char *argv[])
 {
+    ServerOptions options = parseServerOptions(argc, argv);
+    blockInterrupt(); // before any thread starts, they all inherit it
+    MST_Factory::getInstance(); // create the strategies before the workers use them
     lfp.start(); // Start the threads in LFP
-    const vector<string> graphActions = {"newgraph", "newedge", "removeedge", "mst"};
-    const vector<string> mstStrats = {"prim", "kruskal", "tarjan", "boruvka"};
-
-    string action= "";
-    string actualAction = "";
-    int n = 0; 
-    int m = 0;
-    int weight = 0;
-    string strat = "";
-    map<int, bool> connections_in_use;
-    char welcomeMsg[WELCOME_MSG_SIZE] =
+    string welcomeMsg =
         "Welcome to the LF-server!\n"
         "This server can perform the following actions:\n"
         "1. Create a new graph: newgraph n m where \"n\" is the number of vertices and \"m\" is the number of edges.\n"
         "2. Add an edge to the graph: newedge n m w where \"n\" and \"m\" are the vertices and \"w\" is the weight of the edge.\n"
         "3. Remove an edge from the graph: removeedge n m where \"n\" and \"m\" are the vertices.\n"
-        "4. Find the Minimum Spanning Tree of the graph: mst strat -  where strat is either 'prim', 'kruskal', 'tarjan' or 'boruvka'\n";
-
-    int newfd;                          // Newly accept()ed socket descriptor
-    struct sockaddr_storage remoteaddr; // Client address
-    socklen_t addrlen;
-    char buf[256]={0}; // Buffer for client data
-    char remoteIP[INET6_ADDRSTRLEN]={0};
-
-    // Start off with room for 5 connections (isnt it four? because one is the listener..)
-    // (We'll realloc as necessary)
-    fd_count = 0;
-    int fd_size = 5;
-    pfds = (struct pollfd *)malloc(sizeof *pfds * (size_t)fd_size);
-    memset(pfds, 0, sizeof *pfds * (size_t)fd_size);
-
-    // Set up and get a listening socket
-    int listener = getListenerSocket(); // Listening socket descriptor
-    if (listener == -1)
-    {
-        fprintf(stderr, "error getting listening socket\n");
-        exit(1);
-    }
-
-    cout << "LF- waiting for connections..." << endl;
-    // Add the listener to set
-    pfds[0].fd = listener;
-    pfds[0].events = POLLIN; // Report ready to read on incoming connection
-    fd_count = 1;            // For the listener
+        "4. Find the Minimum Spanning Tree of the graph: mst strat -  where strat is either 'prim', 'kruskal', 'tarjan' or 'boruvka'\n"
+        "5. Switch to the binary protocol: binary\n"
+        "6. Load a graph file: loadgraph name (a file in the server's -d directory)\n"
+        "7. Save the graph to a graph file: savegraph name (in the server's -d directory)\n"
+        "8. Show the server's counters: serverstats\n"
+        "9. Write the recorded request trace to a file on the server: tracedump name (in the server's -d directory)\n"
+        "10. Share your graph with the other clients under a name: creategraph name\n"
+        "11. Work on a graph another client shared (instead of your own): usegraph name\n"
+        "12. Add k edges at once: newedges k, then the k edges as \"u v w\" lines\n"
+        "13. Remove k edges at once: removeedges k, then the k edges as \"u v\" lines\n"
+        "14. Ask about the last MST: path u v, dist u v or bottleneck u v (the heaviest edge on the MST path)\n"
+        "15. Ask about many pairs at once: querybatch k, then the k pairs as \"u v\" lines\n"
+        "16. Get the center, radius, median and every vertex's eccentricity of the last MST: mststats\n"
+        "Every command ends with a newline, several commands can be sent at once.\n";
+
+    server = new ServerCore("LF-server", welcomeMsg, options);
+    server->statsReport = []() { return lfp.statsReport(); };  // the pool's counters in the serverstats reply
+    server->metricsReport = []() {  // and its queue on /metrics
+        string out;
+        metrics::appendMetric(out, "mstserver_lfp_queued_tasks", "gauge", "Tasks queued on the LF pool, not started yet.",
+                              static_cast<double>(lfp.queuedTasks()));
+        return out;
+    };
 
     signal(SIGINT, handleSig); // handle the CTRL+C signal
+    signal(SIGPIPE, SIG_IGN);  // a client that hung up is detected by recv, not by a signal
 
-    // Main loop
-    while (true)
-    {
-        int poll_count = poll(pfds, (size_t)fd_count, -1);
-
-        if (poll_count == -1)
-        {
-
-            perror("poll");
-            exit(1);
-        }
-
-        // Run through the existing connections looking for data to read
-        for (int i = 0; i < fd_count; i++)
-        {
-
-            // Check if someone's ready to read
-            if (pfds[i].revents & POLLIN)
-            { // We got one!!
-
-                if (pfds[i].fd == listener)
-                { // If listener is ready to read, handle new connection
-
-                    addrlen = sizeof remoteaddr;
-                    newfd = accept(listener, (struct sockaddr *)&remoteaddr, &addrlen);
-
-                    if (newfd == -1)
-                    {
-                        perror("accept");
-                    }
-                    else
-                    {
-                        add_to_pfds(&pfds, newfd, &fd_count, &fd_size);
-
-                        // Add the new client to the dictionary:
-                        clients_graphs[newfd] = nullptr;
-
-                        printf("LF-server new connection from %s on socket %d\n",
-                               inet_ntop(remoteaddr.ss_family,
-                                         getInAddr((struct sockaddr *)&remoteaddr),
-                                         remoteIP, INET6_ADDRSTRLEN),
-                               newfd);
-                        if (send(newfd, welcomeMsg, sizeof(welcomeMsg), 0) < 0)
-                        {
-                            perror("send");
-                        }
-                    }
-                }
-                else
-                {                                                      // handle existing connection
-                    int nbytes = recv(pfds[i].fd, buf, sizeof buf, 0); // receiving the msg from the client
-                    int sender_fd = pfds[i].fd;
-
-                    if (nbytes <= 0)
-                    { // Got error or connection closed by client
-                        if (nbytes == 0)
-                            printf("LF-server: socket %d hung up\n", sender_fd);
-                        else
-                            perror("ERROR: receiving data from client");
-
-                        close(pfds[i].fd);                 // close the connection
-                        del_from_pfds(pfds, i, &fd_count); // remove the connection from the set of connections
-                        if (clients_graphs[sender_fd] != nullptr)
-                        { // if the client has a graph, delete it
-                            delete clients_graphs[sender_fd];
-                            clients_graphs[sender_fd] = nullptr;
-                        }
-                        clients_graphs.erase(sender_fd); // remove the client from the dictionary
-                    }
-                    else
-                    { // the client sent a message
-                        parseInput(buf, nbytes, n, m, weight, strat, action, actualAction, graphActions, mstStrats);
-                        cout << "Action received: " << action << " from client " << sender_fd << endl;
-
-                        // handling the input:
-                        pair<string, Graph *> result = handleInput(clients_graphs[sender_fd], action, sender_fd, actualAction, n, m, weight, strat);
-                        // string msg = result.first;
-                        if (result.second != nullptr)
-                        { // if the result is not null, store it in the dictionary for this client
-                            clients_graphs[sender_fd] = result.second;
-                        }
-
-                        // print the message to the server
-                        if (actualAction == "message")
-                        {
-                            cout << result.first << endl;
-                            continue;
-                        }
-
-                        // if the actualAction is in the graphActions, then send the result to all the clients
-                        if (find(graphActions.begin(), graphActions.end(), actualAction) != graphActions.end())
-                        {
-                            for (int j = 0; j < fd_count; j++)
-                            {
-                                int dest_fd = pfds[j].fd;
-                                if (dest_fd != listener)                                                     // if the destination is not the listener
-                                    if (send(dest_fd, result.first.c_str(), result.first.size() + 1, 0) < 0) // send the result to the client include the null terminator
-                                        perror("send");
-                            }
-                        }
-                    }
-                }
-            } // END handle data from client
-        } // END got ready-to-read from poll()
-    } // END looping through file descriptors
-    // END for(;;)--and you thought it would never end!
-
-    return 0;
+    int status = server->run();
+    cleanUp();
+    return status;
 }
@@ -0,0 +1,95 @@
+#ifndef CANCEL_TOKEN_HPP
+#define CANCEL_TOKEN_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+
+// Thrown by CancelToken::check() out of a computation whose request was cancelled
+struct Cancelled : std::exception
+{
+    const char *what() const noexcept override { return "request cancelled"; }
+};
+
+/**
+ * Cooperative cancellation of a request.
+ * The server keeps the token of a connection's latest mst request and cancels it when the client hangs up or sends
+ * a newer one. The computation runs in a CancelScope and polls the token in its loops (a thread-local read and a
+ * relaxed load): check() throws Cancelled on the thread that owns the computation, which frees what it built on the
+ * way out. Subtasks on the LFP pool inherit the scope of the task that spawned them; they only test requested() and
+ * return early, exceptions don't cross threads.
+ * Requests that share one computation join a group token: the computation polls the group, which is cancelled once
+ * all of its members are.
+ */
+class CancelToken
+{
+public:
+    void cancel()
+    {
+        if (flag.exchange(true, std::memory_order_relaxed))
+            return;
+        if (group != nullptr && group->members.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            group->cancel(); // the last member
+    }
+
+    bool cancelled() const { return flag.load(std::memory_order_relaxed); }
+
+    // Make this token the first member of a new group
+    std::shared_ptr<CancelToken> startGroup()
+    {
+        std::shared_ptr<CancelToken> created = std::make_shared<CancelToken>();
+        created->members.store(1, std::memory_order_relaxed);
+        group = created;
+        return created;
+    }
+
+    // Make this token a member of a group, false if all of its members were cancelled already (so is the group).
+    // A token is a member of one group at most, it joins before it can be cancelled.
+    bool join(const std::shared_ptr<CancelToken> &joined)
+    {
+        size_t count = joined->members.load(std::memory_order_relaxed);
+        do
+        {
+            if (count == 0)
+                return false;
+        } while (!joined->members.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel));
+        group = joined;
+        return true;
+    }
+
+    // The token of the computation the calling thread runs, nullptr if none
+    static CancelToken *current() { return active; }
+
+    // Whether the calling thread's computation was cancelled
+    static bool requested() { return active != nullptr && active->cancelled(); }
+
+    // Throw Cancelled if the calling thread's computation was cancelled
+    static void check()
+    {
+        if (requested())
+            throw Cancelled();
+    }
+
+private:
+    friend class CancelScope;
+    std::atomic<bool> flag{false};
+    std::shared_ptr<CancelToken> group; // the group this token is a member of
+    std::atomic<size_t> members{0};     // of this token, as a group: the ones not cancelled
+    static inline thread_local CancelToken *active = nullptr;
+};
+
+// Makes the calling thread compute for token until the end of the scope (nullptr: not cancellable), scopes nest
+class CancelScope
+{
+public:
+    explicit CancelScope(CancelToken *token) : previous(CancelToken::active) { CancelToken::active = token; }
+    ~CancelScope() { CancelToken::active = previous; }
+    CancelScope(const CancelScope &) = delete;
+    CancelScope &operator=(const CancelScope &) = delete;
+
+private:
+    CancelToken *previous;
+};
+
+#endif // CANCEL_TOKEN_HPP
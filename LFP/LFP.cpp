@@ -1,8 +1,33 @@
 #include "LFP.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
 
 using namespace std;
 
-LFP::LFP(int num_threads) : stopFlag(false), leader(0){  // Constructor
+static thread_local LFP *currentPool = nullptr;  // the pool of the calling worker thread
+static thread_local size_t currentWorker = 0;  // its index in the pool
+
+LFP::LFP(int num_threads) : nextInbox(0), hasLeader(false), idle(0), stopFlag(false){  // Constructor
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    taskFd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);  // semaphore mode: every read is one wakeup
+    if (epfd < 0 || taskFd < 0) {
+        perror("LFP");
+        exit(1);
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;  // level-triggered: ready while wakeups are pending
+    ev.data.fd = taskFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, taskFd, &ev);
+
+    for (int i = 0; i < num_threads; ++i) {
+        workers.emplace_back(new Worker());
+        workers.back()->seed = (static_cast<uint64_t>(i) + 1) * UINT64_C(0x9E3779B97F4A7C15);
+    }
     for (int i = 0; i < num_threads; ++i) {  // Create threads and add them to the vector
         threads.emplace_back(&LFP::worker, this, i);  // arguments: function, object, id
         threadIDs.push_back(i);
@@ -10,35 +35,59 @@ LFP::LFP(int num_threads) : stopFlag(false), leader(0){  // Constructor
 }
 
 LFP::~LFP() {
-    stop();  
+    stop();
+    close(taskFd);
+    close(epfd);
 }
 
-void LFP::addTask(function<void()> task) {
-    // cout << "Adding task to the LFP queue\n" << endl;
+LFP *LFP::current() {
+    return currentPool;
+}
+
+void LFP::addTask(Task task) {
+    if (currentPool == this) {  // submitted by a task of this pool: keep it local, others can steal it
+        spawn(move(task), nullptr);
+        return;
+    }
+    Job *job = new Job{move(task), nullptr, steadyNanos(), trace::currentRequest(), nullptr};
+    Worker &target = *workers[nextInbox.fetch_add(1, memory_order_relaxed) % workers.size()];
     {
-        lock_guard<mutex> lock(queueMutex);  // Lock the mutex
-        taskQueue.push(task);  // Add the task to the queue
-        condition.notify_one();  // Notify one of the threads
+        lock_guard<mutex> lock(target.inboxMutex);
+        target.inbox.push(job);
+        target.inboxSize.fetch_add(1);
     }
+    signalWork();
 }
 
+void LFP::spawn(Task task, atomic<size_t> *pending) {
+    workers[currentWorker]->deque.push(new Job{move(task), pending, pending == nullptr ? steadyNanos() : 0, trace::currentRequest(),
+                                               pending == nullptr ? nullptr : CancelToken::current()});
+    signalWork();
+}
 
-void LFP::start() {
-    {
-        lock_guard<mutex> lock(stopMutex);  // Lock the mutex
-        stopFlag = false;  
+void LFP::signalWork() {
+    atomic_thread_fence(memory_order_seq_cst);  // pairs with the fence in waitForWork: either we see it idle or it sees the work
+    if (idle.load(memory_order_relaxed) > 0) {
+        uint64_t one = 1;
+        if (write(taskFd, &one, sizeof one) < 0)
+            perror("LFP signal");
     }
 }
 
+void LFP::start() {
+    stopFlag = false;
+}
+
 void LFP::stop() {
+    stopFlag = true;
+    uint64_t one = 1;
+    if (write(taskFd, &one, sizeof one) < 0)  // wake the leader, the count stays set from now on
+        perror("LFP stop");
     {
-        lock_guard<mutex> lock(stopMutex);  // Lock the mutex
-        stopFlag = true;
-    }
-    
-    {
-        lock_guard<mutex> lock(queueMutex);
-        condition.notify_all();
+        lock_guard<mutex> lock(leaderMutex);
+        for (auto &w : workers) {
+            w->follower.condition.notify_one();
+        }
     }
     for (thread &thread : threads) {
         if (thread.joinable()) {
@@ -48,34 +97,197 @@ void LFP::stop() {
 }
 
 void LFP::worker(int id) {
-    while (true) {  // Worker function to process tasks in the queue
-        function<void()> task;  // Task to be executed
-        {
-            unique_lock<mutex> lock(queueMutex);
-            condition.wait(lock, [this]() { 
-                lock_guard<mutex> stopLock(stopMutex);  // Lock the stop mutex
-                return stopFlag || !taskQueue.empty(); 
-            });
-            // std::cout << "Executing task from the LFP queue by thread " << id << endl << endl;
-            {
-                lock_guard<mutex> stopLock(stopMutex);  // Lock the stop mutex
-                if (stopFlag && taskQueue.empty()) return;
-            }
-            if (!taskQueue.empty() && this->leader == id) {
-                // std::cout << "Executing task from the LFP queue by thread " << id << endl << endl;
-                task = taskQueue.front();
-                taskQueue.pop();
-            } else {
-                continue;
+    size_t index = static_cast<size_t>(id);
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        Job *job = findJob(index, true);
+        if (job != nullptr) {
+            execute(job);  // Execute the task
+            continue;
+        }
+        if (!waitForWork(index)) return;  // the pool stopped and every task ran
+    }
+}
+
+void LFP::execute(Job *job) {
+    WorkerStats &stats = workers[currentWorker]->stats;
+    TRACE_REQUEST(job->request);
+    CancelScope cancelScope(job->cancel);
+    if (job->enqueued != 0) {  // a request: time it
+        TRACE_SPAN("lfp task");
+        uint64_t start = steadyNanos();
+        stats.wait.record(start - job->enqueued);
+        job->task();
+        stats.service.record(steadyNanos() - start);
+        bumpCounter(stats.requests);
+    } else {
+        TRACE_SPAN("lfp subtask");
+        job->task();
+        bumpCounter(stats.subtasks);
+    }
+    if (job->pending != nullptr)
+        job->pending->fetch_sub(1, memory_order_release);
+    delete job;
+}
+
+LFP::Job *LFP::findJob(size_t id, bool inboxes) {
+    Worker &self = *workers[id];
+    Job *job = nullptr;
+    if (self.deque.pop(job))
+        return job;
+    if (inboxes && self.inboxSize.load(memory_order_relaxed) > 0) {
+        lock_guard<mutex> lock(self.inboxMutex);
+        if (!self.inbox.empty()) {
+            job = self.inbox.front();
+            self.inbox.pop();
+            self.inboxSize.fetch_sub(1);
+            return job;
+        }
+    }
+
+    // steal, starting from a random victim (xorshift)
+    size_t n = workers.size();
+    self.seed ^= self.seed << 13;
+    self.seed ^= self.seed >> 7;
+    self.seed ^= self.seed << 17;
+    size_t start = static_cast<size_t>(self.seed % n);
+    for (size_t k = 0; k < n; k++) {
+        size_t v = (start + k) % n;
+        if (v == id)
+            continue;
+        Worker &victim = *workers[v];
+        if (victim.deque.steal(job)) {
+            bumpCounter(self.stats.stolen);
+            return job;
+        }
+        if (inboxes && victim.inboxSize.load(memory_order_relaxed) > 0) {
+            unique_lock<mutex> lock(victim.inboxMutex, try_to_lock);  // a busy inbox is left to its owner
+            if (lock.owns_lock() && !victim.inbox.empty()) {
+                job = victim.inbox.front();
+                victim.inbox.pop();
+                victim.inboxSize.fetch_sub(1);
+                bumpCounter(self.stats.stolen);
+                return job;
             }
         }
-        // std::cout << "Executing task from the LFP queue by thread " << id << endl << endl;
-        // locking the leader:
-        {
-            lock_guard<mutex> lock(queueMutex);
-            leader = (size_t)(leader+1) % threads.size();
+    }
+    return nullptr;
+}
+
+bool LFP::hasWork() const {
+    for (const auto &w : workers) {
+        if (w->deque.size() > 0 || w->inboxSize.load() > 0)
+            return true;
+    }
+    return false;
+}
+
+bool LFP::helpOne() {
+    Job *job = findJob(currentWorker, false);
+    if (job == nullptr)
+        return false;
+    execute(job);
+    return true;
+}
+
+bool LFP::waitForWork(size_t id) {
+    Follower &self = workers[id]->follower;
+    unique_lock<mutex> lock(leaderMutex);
+    idle.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);  // pairs with signalWork
+    if (hasWork()) {  // work arrived while this thread was looking elsewhere
+        idle.fetch_sub(1);
+        return true;
+    }
+    if (stopFlag) {
+        idle.fetch_sub(1);
+        return false;
+    }
+
+    if (hasLeader) {  // follow until the leader promotes this thread
+        idleFollowers.push_back(static_cast<int>(id));
+        self.condition.wait(lock, [this, &self]() { return self.promoted || stopFlag; });
+        if (!self.promoted) {  // the pool stops, whoever is busy runs the remaining tasks
+            idleFollowers.erase(find(idleFollowers.begin(), idleFollowers.end(), static_cast<int>(id)));
+            idle.fetch_sub(1);
+            return false;
+        }
+        self.promoted = false;  // hasLeader was left set by the promoting thread
+    } else {
+        hasLeader = true;  // nobody is leading, take over
+    }
+    lock.unlock();
+
+    // lead: wait on the handle set
+    epoll_event ev;
+    while (epoll_wait(epfd, &ev, 1, -1) < 0) {
+        if (errno != EINTR) {
+            perror("LFP epoll_wait");
+            break;
         }
-        task();  // Execute the task
-        
     }
-}
\ No newline at end of file
+    bumpCounter(workers[id]->stats.wakeups);
+    uint64_t count;
+    if (!stopFlag && read(taskFd, &count, sizeof count) < 0 && errno != EAGAIN)  // after stop the count stays set for everyone
+        perror("LFP read");
+
+    // promote a follower before looking for the work, so the handle set is never left unwatched
+    lock.lock();
+    if (!idleFollowers.empty()) {
+        Follower &next = workers[static_cast<size_t>(idleFollowers.back())]->follower;
+        idleFollowers.pop_back();
+        next.promoted = true;
+        next.condition.notify_one();
+    } else {
+        hasLeader = false;
+    }
+    idle.fetch_sub(1);
+    return true;
+}
+
+string LFP::statsReport() const {
+    string report = "lfp: " + to_string(workers.size()) + " threads, " + to_string(idle.load()) + " idle\n";
+    for (size_t i = 0; i < workers.size(); i++) {
+        const Worker &w = *workers[i];
+        HistogramSummary wait, service;
+        w.stats.wait.addTo(wait);
+        w.stats.service.addTo(service);
+        report += "lfp thread " + to_string(i) + ": requests " + to_string(w.stats.requests.load(memory_order_relaxed)) +
+                  ", subtasks " + to_string(w.stats.subtasks.load(memory_order_relaxed)) +
+                  ", stolen " + to_string(w.stats.stolen.load(memory_order_relaxed)) +
+                  ", wakeups " + to_string(w.stats.wakeups.load(memory_order_relaxed)) +
+                  ", queued " + to_string(w.inboxSize.load(memory_order_relaxed) + w.deque.size()) +
+                  ", wait " + wait.format() + ", service " + service.format() + "\n";
+    }
+    return report;
+}
+
+size_t LFP::queuedTasks() const {
+    size_t queued = 0;
+    for (const auto &w : workers)
+        queued += w->inboxSize.load(memory_order_relaxed) + w->deque.size();
+    return queued;
+}
+
+TaskGroup::TaskGroup() : pool(LFP::current()), pending(0) {}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(Task task) {
+    if (pool == nullptr) {  // not on a pool thread: run it now
+        task();
+        return;
+    }
+    pending.fetch_add(1, memory_order_relaxed);
+    pool->spawn(move(task), &pending);
+}
+
+void TaskGroup::wait() {
+    while (pending.load(memory_order_acquire) > 0) {
+        if (!pool->helpOne())
+            this_thread::yield();
+    }
+}
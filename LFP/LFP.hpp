@@ -8,26 +8,101 @@
 #include <condition_variable>
 #include <vector>
 #include <functional>
+#include <atomic>
+#include <memory>
+#include "Task.hpp"
+#include "TaskGroup.hpp"
+#include "CancelToken.hpp"
+#include <string>
+#include "../DataStruct/ChaseLevDeque.hpp"
+#include "../DataStruct/LatencyHistogram.hpp"
+#include "../Trace/Trace.hpp"
 
 using namespace std;
 
+/**
+ * Work-stealing thread pool with Leader/Followers idling.
+ * Every worker owns a Chase-Lev deque for the tasks it spawns (fork/join, see TaskGroup) and an inbox for the tasks
+ * submitted from outside the pool (round-robin, so there is no central queue). A worker runs its own deque (LIFO),
+ * then its inbox, then steals from a random victim.
+ * Idle workers follow the Leader/Followers protocol: at most one of them, the leader, waits on the pool's epoll
+ * handle set (an eventfd signalled when work is added while someone is idle). On a signal it promotes exactly one
+ * follower and goes looking for the work; followers sleep on their own condition variable and never spin.
+ */
 class LFP {
     private:
+        // A task and the TaskGroup counter it decrements when it finishes (nullptr for addTask)
+        struct Job {
+            Task task;
+            atomic<size_t>* pending;
+            uint64_t enqueued;  // steadyNanos() when added with addTask, 0 for TaskGroup tasks
+            uint64_t request;  // the traced request it works for
+            CancelToken* cancel;  // the token of the task that spawned it (TaskGroup tasks, the spawner outlives them)
+        };
+
+        // Counters of one worker thread, written only by it
+        struct WorkerStats {
+            atomic<uint64_t> requests{0};  // addTask tasks run
+            atomic<uint64_t> subtasks{0};  // TaskGroup tasks run
+            atomic<uint64_t> stolen{0};  // tasks taken from another worker
+            atomic<uint64_t> wakeups{0};  // times it woke up as the leader
+            LatencyHistogram wait;  // addTask to start of the task
+            LatencyHistogram service;  // run time of the addTask tasks
+        };
+
+        // An idle thread waiting to be promoted
+        struct Follower {
+            condition_variable condition;
+            bool promoted = false;
+        };
+
+        struct Worker {
+            ChaseLevDeque<Job*> deque;  // tasks spawned on this worker, stolen from the top
+            mutex inboxMutex;  // protects inbox
+            queue<Job*> inbox;  // tasks submitted from outside the pool
+            atomic<size_t> inboxSize{0};
+            Follower follower;
+            uint64_t seed;  // victim selection
+            WorkerStats stats;
+        };
+
         void worker(int id);  // Worker function
+        Job* findJob(size_t id, bool inboxes);  // own deque, own inbox, then steal
+        bool hasWork() const;
+        bool waitForWork(size_t id);  // idle until there may be work, returns false when the pool stops
+        void execute(Job* job);
+        void signalWork();  // wake the leader if a thread is idle
+        void spawn(Task task, atomic<size_t>* pending);  // push onto the calling worker's deque
+        bool helpOne();  // run one spawned task (TaskGroup::wait), false if none was found
+
         vector<thread> threads;  // Vector to store threads
         vector<int> threadIDs;  // Vector to store thread IDs
-        queue<function<void()>> taskQueue;  // Queue to store tasks
-        mutex queueMutex;  // Mutex to protect the tasks queue
-        mutex stopMutex;  // Mutex to protect the stop flag
-        condition_variable condition;  // used to notify the threads that there is a task in the queue
-        bool stopFlag;  // Flag to stop the threads if set to true
-        int leader;  // Leader thread
+        vector<unique_ptr<Worker>> workers;  // one per thread
+        atomic<size_t> nextInbox;  // round-robin for addTask
+        int epfd;  // the handle set the leader waits on
+        int taskFd;  // eventfd (semaphore mode): one count per wakeup
+        mutex leaderMutex;  // protects hasLeader, idleFollowers and the followers' promoted flags
+        vector<int> idleFollowers;  // threads waiting to be promoted, the most recently idle (cache-warm) is promoted first
+        bool hasLeader;  // a thread is waiting on the handle set or was just promoted
+        atomic<int> idle;  // threads in waitForWork
+        atomic<bool> stopFlag;  // Flag to stop the threads if set to true
+
+        friend class TaskGroup;
     public:
         LFP(int num_threads);
         ~LFP();
-        void addTask(function<void()> task);  // Add a task to the queue
+        void addTask(Task task);  // Add a task, from any thread
         void start();
         void stop();
+
+        // The pool the calling thread works for, nullptr if it isn't a pool thread
+        static LFP* current();
+
+        // One line per worker thread (tasks run, steals, wakeups, queue wait and service times), from any thread
+        string statsReport() const;
+
+        // Tasks queued on all the workers and not started yet, from any thread
+        size_t queuedTasks() const;
 };
 
 #endif // LFP_HPP
@@ -0,0 +1,114 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Move-only type-erased callable with a small buffer.
+ * Callables up to INLINE_SIZE bytes (e.g. a lambda capturing a few pointers and a string) are stored inline,
+ * larger ones are moved to the heap. Unlike std::function it never copies the callable
+ * and accepts move-only captures.
+ */
+class Task
+{
+public:
+    static constexpr size_t INLINE_SIZE = 96;
+
+    Task() noexcept : ops(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&f) : ops(nullptr)
+    {
+        using Fn = typename std::decay<F>::type;
+        if constexpr (sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<Fn>::value)
+        {
+            new (storage) Fn(std::forward<F>(f));
+            ops = &inlineOps<Fn>;
+        }
+        else
+        {
+            *reinterpret_cast<Fn **>(storage) = new Fn(std::forward<F>(f));
+            ops = &heapOps<Fn>;
+        }
+    }
+
+    Task(Task &&other) noexcept : ops(other.ops)
+    {
+        if (ops != nullptr)
+        {
+            ops->move(other.storage, storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ops = other.ops;
+            if (ops != nullptr)
+            {
+                ops->move(other.storage, storage);
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+
+    explicit operator bool() const noexcept { return ops != nullptr; }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void *storage);
+        void (*move)(void *from, void *to) noexcept; // move constructs into to and destroys from
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template <typename Fn>
+    static void invokeInline(void *s) { (*static_cast<Fn *>(s))(); }
+    template <typename Fn>
+    static void moveInline(void *from, void *to) noexcept
+    {
+        new (to) Fn(std::move(*static_cast<Fn *>(from)));
+        static_cast<Fn *>(from)->~Fn();
+    }
+    template <typename Fn>
+    static void destroyInline(void *s) noexcept { static_cast<Fn *>(s)->~Fn(); }
+
+    template <typename Fn>
+    static void invokeHeap(void *s) { (**static_cast<Fn **>(s))(); }
+    static void moveHeap(void *from, void *to) noexcept { *static_cast<void **>(to) = *static_cast<void **>(from); }
+    template <typename Fn>
+    static void destroyHeap(void *s) noexcept { delete *static_cast<Fn **>(s); }
+
+    template <typename Fn>
+    static constexpr Ops inlineOps = {&invokeInline<Fn>, &moveInline<Fn>, &destroyInline<Fn>};
+    template <typename Fn>
+    static constexpr Ops heapOps = {&invokeHeap<Fn>, &moveHeap, &destroyHeap<Fn>};
+
+    void reset() noexcept
+    {
+        if (ops != nullptr)
+        {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];
+    const Ops *ops;
+};
+
+#endif // TASK_HPP
@@ -0,0 +1,51 @@
+#ifndef TASK_GROUP_HPP
+#define TASK_GROUP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include "Task.hpp"
+
+class LFP;
+
+/**
+ * Fork/join on the LFP pool the calling thread belongs to.
+ * run() pushes a sub-task onto the worker's own deque where idle workers can steal it,
+ * wait() runs spawned tasks (never new requests) until all of the group's tasks finished.
+ * Outside a pool thread (e.g. the PAO stages) run() just calls the task, so kernels stay correct sequentially.
+ */
+class TaskGroup
+{
+public:
+    TaskGroup();
+    ~TaskGroup();
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    void run(Task task);
+    void wait();
+
+private:
+    LFP *pool;
+    std::atomic<size_t> pending;
+};
+
+// Call f(lo, hi) on sub-ranges of [begin, end) of at most grain elements, splitting recursively on the pool
+template <typename F>
+void parallelFor(size_t begin, size_t end, size_t grain, const F &f)
+{
+    if (end <= begin)
+        return;
+    if (end - begin <= grain)
+    {
+        f(begin, end);
+        return;
+    }
+    TaskGroup group;
+    size_t mid = begin + (end - begin) / 2;
+    group.run([&f, mid, end, grain]()
+              { parallelFor(mid, end, grain, f); });
+    parallelFor(begin, mid, grain, f);
+    group.wait();
+}
+
+#endif // TASK_GROUP_HPP
@@ -4,80 +4,75 @@
 
 Graph* Boruvka::operator()(Graph *g)
 {
+    TRACE_SPAN("mst boruvka");
+    ScratchScope scratch; // the edge list, the union-find and the cheapest edges, released when the MST is built
     // Create a new graph to store the MST with the same vertices as the original graph but no edges
-    Graph* mst = new Graph(*g, false);
+    std::unique_ptr<Graph> mst(new Graph(*g, false));
 
     // Number of vertices in the graph
     size_t V = g->numVertices();
 
     // Initialize Union-Find structure
-    UnionFind uf(V);
+    UnionFind uf(V, scratch.resource());
 
     // Initially, each vertex is its own component
     size_t numComponents = V;
 
-    // Array to store the cheapest edge for each component
-    std::vector<Edge> cheapest(V);
+    // The edges of the graph, collected once for all the rounds
+    std::pmr::vector<WeightedEdge> edges = collectEdges(*g, scratch.resource());
 
+    // Array to store the index of the cheapest edge for each component
+    const size_t NONE = std::numeric_limits<size_t>::max();
+    std::pmr::vector<size_t> cheapest(V, NONE, scratch.resource());
 
     // Continue until there is only one component
     while (numComponents > 1)
     {
         // Initialize the cheapest edges for each component
-        for (size_t i = 0; i < V; ++i)
-        {
-            cheapest[i] = Edge(); // Use a default constructor or a valid edge initialization
-            cheapest[i].getWeight() = std::numeric_limits<size_t>::max();
-        }
+        std::fill(cheapest.begin(), cheapest.end(), NONE);
 
         // Iterate through all edges to find the cheapest edge for each component
-        for (auto e = g->edgesBegin(); e != g->edgesEnd(); ++e)
+        for (size_t i = 0; i < edges.size(); ++i)
         {
-            size_t u = uf.find(e->getStart().getId());
-            size_t v = uf.find(e->getEnd().getId());
-          
+            CancelToken::check();
+            size_t u = uf.find(edges[i].u);
+            size_t v = uf.find(edges[i].v);
 
             if (u != v)
             {
-                if (e->getWeight() < cheapest[u].getWeight())
+                if (cheapest[u] == NONE || edges[i].w < edges[cheapest[u]].w)
                 {
-                    cheapest[u] = *e;
+                    cheapest[u] = i;
                 }
-                if (e->getWeight() < cheapest[v].getWeight())
+                if (cheapest[v] == NONE || edges[i].w < edges[cheapest[v]].w)
                 {
-                    cheapest[v] = *e;
+                    cheapest[v] = i;
                 }
             }
-            
         }
 
-     
-
         // Add the cheapest edges to the MST and unite the components
+        size_t before = numComponents;
         for (size_t i = 0; i < V; ++i)
         {
-            if (cheapest[i].getStart().getId() != -1 && cheapest[i].getEnd().getId() != -1)
+            if (cheapest[i] != NONE)
             {
-                size_t u = uf.find(cheapest[i].getStart().getId());
-                size_t v = uf.find(cheapest[i].getEnd().getId());
+                const WeightedEdge &e = edges[cheapest[i]];
+                size_t u = uf.find(e.u);
+                size_t v = uf.find(e.v);
 
                 if (u != v)
                 {
-                    mst->addEdge(cheapest[i]);
+                    mst->addEdge(Edge(Vertex(e.u), Vertex(e.v), e.w));
                     uf.Union(u,v);
                     --numComponents;
                 }
             }
         }
+        if (numComponents == before) // no edge leaves the components: the graph is not connected
+            break;
     }
 
-     //Cache the distance and parent matrices of the MST for future use
-    std::vector<std::vector<size_t>> dist, per;
-    std::tie(dist, per) = mst->floydWarshall(); // Get the distance and parent matrices of the MST
-    // Update distance and parent matrices in mst
-    mst->setDistances(dist);
-    mst->setParent(per); 
-
     // Return the MST
-    return mst;
+    return mst.release();
 }
\ No newline at end of file
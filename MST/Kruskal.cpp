@@ -2,29 +2,24 @@
 
 
     Graph* Kruskal::operator()(Graph *g){ 
-        Graph* mst = new Graph(*g, false); // Create a new graph with the same vertices as the input graph but no edges
+        TRACE_SPAN("mst kruskal");
+        ScratchScope scratch; // the edge list and the union-find, released when the MST is built
+        std::unique_ptr<Graph> mst(new Graph(*g, false)); // Create a new graph with the same vertices as the input graph but no edges
 
-        std::vector<Edge> edges;  // Create a vector to store the edges
-        for (auto e = g->edgesBegin(); e != g->edgesEnd(); e++)
-        {
-            edges.push_back(*e);
-        }
-        std::sort(edges.begin(), edges.end());  // Sort the edges in non decreasing order of weight
+        std::pmr::vector<WeightedEdge> edges = collectEdges(*g, scratch.resource());  // Create a vector to store the edges
+        std::sort(edges.begin(), edges.end(), [](const WeightedEdge &a, const WeightedEdge &b)
+                  { return a.w < b.w; });  // Sort the edges in non decreasing order of weight
 
-        UnionFind uf(g->numVertices());
-        for (auto e : edges)
+        UnionFind uf(g->numVertices(), scratch.resource());
+        for (const auto &e : edges)
         {
-            if (uf.find(e.getStart().getId()) != uf.find(e.getEnd().getId())) //for each edge E = u,v in G taken in non decreasing order of weight, if u and v are not in the same set, add E to the MST
+            CancelToken::check();
+            if (uf.find(e.u) != uf.find(e.v)) //for each edge E = u,v in G taken in non decreasing order of weight, if u and v are not in the same set, add E to the MST
             {
-                mst->addEdge(e);
-                uf.Union(e.getStart().getId(), e.getEnd().getId());
+                mst->addEdge(Edge(Vertex(e.u), Vertex(e.v), e.w));
+                uf.Union(e.u, e.v);
             }
         }
-        std::vector<std::vector<size_t>> dist, per;
-        std::tie(dist, per) = mst->floydWarshall(); // Get the distance and parent matrices of the MST
-        //update distance and parent matrices in mst
-        mst->setDistances(dist);
-        mst->setParent(per);
-        return mst;
+        return mst.release();
     }
 
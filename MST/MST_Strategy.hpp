@@ -1,9 +1,32 @@
 #pragma once
 #include "../GraphObj/graph.hpp"
+#include "../DataStruct/ScratchArena.hpp"
+#include "../LFP/CancelToken.hpp"
+#include "../Trace/Trace.hpp"
 
 class MST_Strategy
 {
 public:
+    // A new graph with the MST of g, its distances are not cached (see Graph::cacheDistances).
+    // Throws Cancelled if the calling thread's request is cancelled meanwhile.
     virtual Graph* operator()(Graph *g) = 0;
     virtual ~MST_Strategy() = default;
-};
\ No newline at end of file
+};
+
+// An edge of the input graph as the strategies scan it, three ids instead of an Edge and its two Vertex objects
+struct WeightedEdge
+{
+    size_t u;
+    size_t v;
+    size_t w;
+};
+
+// The edges of g, in memory from resource (the strategy's ScratchScope)
+inline std::pmr::vector<WeightedEdge> collectEdges(const Graph &g, std::pmr::memory_resource *resource)
+{
+    std::pmr::vector<WeightedEdge> edges(resource);
+    edges.reserve(g.numEdges());
+    g.forEachEdge([&edges](size_t u, size_t v, size_t w)
+                  { edges.push_back({u, v, w}); });
+    return edges;
+}
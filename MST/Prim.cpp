@@ -14,37 +14,39 @@ struct CompareVertex
 // Prim's algorithm based on the pseudocode
 Graph* Prim::operator()(Graph *g)
 {
+    TRACE_SPAN("mst prim");
     size_t V = g->numVertices();
+    ScratchScope scratch; // the heap and the arrays, released when the MST is built
 
     // Create a new graph with the same vertices as the input graph but no edges
-    Graph *mst = new Graph(*g, false);
+    std::unique_ptr<Graph> mst(new Graph(*g, false));
 
     const int INTINF = std::numeric_limits<int>::max(); // Infinity value for key values
 
     // Fibonacci min Heap to select the next vertex with the minimum key value
-    BinaryHeap<std::pair<size_t, int>, CompareVertex> pq;
+    BinaryHeap<std::pair<size_t, int>, CompareVertex> pq(scratch.resource());
 
     // Key values (weights) used to pick the minimum weight edge
-    std::vector<int> key(V, INTINF);
+    std::pmr::vector<int> key(V, INTINF, scratch.resource());
 
     // Array to store the parent of each vertex in the MST
-    std::vector<int> parent(V, -1);
+    std::pmr::vector<int> parent(V, -1, scratch.resource());
 
     // Boolean array to track vertices already included in the MST
-    std::vector<bool> inMST(V, false);
+    std::pmr::vector<bool> inMST(V, false, scratch.resource());
 
     // Start from the first vertex (arbitrarily chosen as 0)
     size_t startVertex = 0;
     key[startVertex] = 0;
-    for (auto v : *g)
+    for (size_t v = 0; v < V; v++)
     {
-        pq.push({v.first, key[(size_t)v.first]});
-      
+        pq.push({v, key[v]});
     }
 
     while (!pq.empty())
     {
         // Extract the vertex with the minimum key value
+       CancelToken::check();
        auto minNode = pq.top();
        pq.pop();
        
@@ -52,10 +54,9 @@ Graph* Prim::operator()(Graph *g)
         size_t u = minNode.first;
 
         // Iterate over all edges of the vertex u (Adj[u])
-        for (auto v = g->getVertex(u).adjBegin(); v != g->getVertex(u).adjEnd(); v++)
+        g->forEachNeighbor(u, [&](size_t vertex, size_t w)  // vertex is adjacent to u
         {
-            size_t vertex = v->first; // Get the vertex v adjacent to u
-            int weight = v->second; // Get the weight of the edge (u, v)
+            int weight = w; // Get the weight of the edge (u, v)
 
             // If v is not yet in MST and the weight of (u, v) is less than key[v]
             if (!inMST[vertex]&& weight < key[vertex])
@@ -65,7 +66,7 @@ Graph* Prim::operator()(Graph *g)
                 pq.decreaseKey(index,{vertex,key[vertex]}); // Decrease the key value of the vertex in the priority queue
                 parent[vertex] = u;        // Update parent[v]
             }
-        }
+        });
        
          // Mark the vertex as included in the MST
         inMST[u] = true;
@@ -76,15 +77,9 @@ Graph* Prim::operator()(Graph *g)
     {
         if (parent[i] != -1)
         {
-            mst->addEdge(g->getVertex((size_t)parent[i]), g->getVertex(i), (size_t)key[i]);
+            mst->addEdge(Edge(Vertex((size_t)parent[i]), Vertex(i), (size_t)key[i]));
         }
     }
 
-    std::vector<std::vector<size_t>> dist, per;
-    std::tie(dist, per) = mst->floydWarshall(); // Get the distance and parent matrices of the MST
-    // Update distance and parent matrices in mst
-    mst->setDistances(dist);
-    mst->setParent(per);
-
-    return mst; // Return the MST
+    return mst.release(); // Return the MST
 }
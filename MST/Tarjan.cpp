@@ -3,20 +3,22 @@
 // The () operator implements the Kruskal's algorithm to find the MST
 Graph* Tarjan::operator()(Graph *g)
 {
+    TRACE_SPAN("mst tarjan");
+    ScratchScope scratch; // the edge list and the parents, released when the MST is built
     // Create a new graph to store the MST with the same vertices as the original graph but no edges
-    Graph* mst = new Graph(*g, false);
+    std::unique_ptr<Graph> mst(new Graph(*g, false));
 
     // Extract edges from the original graph and sort them by weight
-    std::vector<Edge> edges(g->edgesBegin(), g->edgesEnd());
-    std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
-        return a.getWeight() < b.getWeight();
+    std::pmr::vector<WeightedEdge> edges = collectEdges(*g, scratch.resource());
+    std::sort(edges.begin(), edges.end(), [](const WeightedEdge &a, const WeightedEdge &b) {
+        return a.w < b.w;
     });
 
     // Number of vertices in the graph
     size_t V = g->numVertices();
 
     // Vector to store the parent of each vertex in the MST
-    std::vector<int> parent(V);
+    std::pmr::vector<int> parent(V, scratch.resource());
     for (size_t i = 0; i < V; ++i)
         parent[i] = i;
 
@@ -38,13 +40,14 @@ Graph* Tarjan::operator()(Graph *g)
     // Iterate through the edges in sorted order
     for (const auto &edge : edges)
     {
-        int u = edge.getStart().getId();
-        int v = edge.getEnd().getId();
+        CancelToken::check();
+        int u = edge.u;
+        int v = edge.v;
 
         // If the vertices belong to different sets, add the edge to the MST
         if (find(u) != find(v))
         {
-            mst->addEdge(edge);
+            mst->addEdge(Edge(Vertex(edge.u), Vertex(edge.v), edge.w));
             unionSets(u, v);
         }
 
@@ -52,13 +55,7 @@ Graph* Tarjan::operator()(Graph *g)
         if (mst->numEdges() == V - 1)
             break;
     }
-    //Cache the distance and parent matrices of the MST for future use
-    std::vector<std::vector<size_t>> dist, per;
-    std::tie(dist, per) = mst->floydWarshall(); // Get the distance and parent matrices of the MST
-    // Update distance and parent matrices in mst
-    mst->setDistances(dist);
-    mst->setParent(per); 
 
     // Return the MST
-    return mst;
+    return mst.release();
 }
\ No newline at end of file
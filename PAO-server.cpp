@@ -1,3 +1,7 @@
+/*
+** PAO-server -- MST server computing the MST stats on a Pipeline of Active Objects
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,7 +11,6 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <poll.h>
 #include <algorithm>
 #include <string>
 #include <iostream>
@@ -16,303 +19,265 @@
 #include "MST/MST_Strategy.hpp"
 #include "MST/MST_Factory.hpp"
 #include "ServerUtils/serverUtils.hpp"
+#include "ServerUtils/serverCore.hpp"
+#include "ServerUtils/metrics.hpp"
+#include "ServerUtils/mstFlights.hpp"
 #include "PAO/PAO.hpp"
 #include <memory>
-#include <mutex>
+#include <atomic>
 
 // to handle the CTRL+C signal
 #include <signal.h>
 
-#define PORT "9036"   // Port we're listening on
-#define WELCOME_MSG_SIZE 480
-
 using namespace std;
 
 /**
- * Struct to store the graph and the message to be sent to the client.
- * This will be used by the PAO object to execute the functions.
+ * A MST request flowing through the pipeline.
+ * It is self-contained: the stages only touch their own request, so requests of the same client pipeline freely.
+ * The identical requests that came while it was computed wait in its flight and get the same reply.
+ * Reference counted: the pipeline holds one reference, dropped by the last stage (or when the pipeline drops it).
  */
-struct Triple{
-    Graph* g;
-    string msg;
-    int clientFd;
+struct MSTRequest{
+    atomic<int> refs;
+    Graph* g;  // the snapshot of the client's graph, then its MST
+    string out;  // the reply being built
+    shared_ptr<MSTFlight> flight;  // the connections the result is queued on
+    ReplyFormat fmt;  // text clients get out, binary clients get summary and the MST edges
+    binproto::MSTSummary summary;
+    MemoryReservation memory;  // the request's share of the client's memory budget
+    bool matrixFree = false;  // the distance matrices didn't fit: the stats are computed without them, the paths not listed
+    CancelToken* cancel = nullptr;  // the flight's, cancelled once all its waiters hung up or sent a newer mst
+    bool abandoned = false;  // a computing stage was cancelled, the reply says so instead of the stats
+    shared_ptr<const TreeIndex> tree;  // the MST's index, kept for the waiters' path/dist/bottleneck queries
+    TreeIndex::Centrality centrality;  // the eccentricities and distance sums of the MST's vertices
+
+    void retain() { refs.fetch_add(1, memory_order_relaxed); }
+    void release() {
+        if (refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+            delete g;
+            delete this;
+        }
+    }
 };
 
 // global variable:
-map<int, pair<Graph*, Triple*>> clients_graphs;  // dictionary to store the client file descriptor and its graph
-map<int, mutex> clients_mtx;  // dictionary to store the client file descriptor and its mutex
-struct pollfd* pfds;  // set of file descriptors (global to maintain correct memory management when interrupting the server)
-int fd_count = 0;
+ServerCore* server = nullptr;  // the connections and their graphs (global to maintain correct memory management when interrupting the server)
 PAO* pao = nullptr;
-mutex mtx;
+MSTFlights flights;  // the MST computations in progress, identical requests share one
 
 /**
  * Function to handle MST request.
- * creates a new triple on the heap and adds it to the PAO object as a task.
+ * creates a new request on the heap and adds it to the PAO object as a task.
+ * The request holds a snapshot of the graph, the MST itself is computed by the first active object.
  */
-std::pair<std::string, Graph *> MST(Graph *g, int clientFd, const std::string& strat)
+std::pair<std::string, Graph *> MST(Graph *g, int clientFd, const std::string& strat, ReplyFormat fmt)
 {
-    Graph* tmp = nullptr;
-    Triple* t = nullptr;
-    {
-        unique_lock<mutex> lock(clients_mtx[clientFd]);
-        if(clients_graphs[clientFd].second != nullptr) {  // if the triple is not null, delete it
-        if (clients_graphs[clientFd].second->g != nullptr)
-        {
-            delete clients_graphs[clientFd].second->g;
-            clients_graphs[clientFd].second->g = nullptr;
-        }
-        delete clients_graphs[clientFd].second;
+    bool matrixFree;
+    MemoryReservation memory = reserveMST(*g, clientFd, fmt, matrixFree);
+    if (!memory)
+        return {mstOverBudget(clientFd, fmt), nullptr};
+
+    // the reply is queued on the client's connection (ClientRef), even if the fd is reused meanwhile
+    shared_ptr<CancelToken> cancel = make_shared<CancelToken>();  // cancelled by the client's next mst or its hang up
+    shared_ptr<MSTFlight> flight = flights.join(MSTKey{g->identity(), strat, fmt, matrixFree}, MSTWaiter{clientRef(clientFd), steadyNanos(), cancel});
+    supersedeMST(clientFd, cancel);  // after joining: a repeated command shares the computation instead of cancelling it
+    std::cout << "User " << clientFd << " requested to find MST of the Graph" << std::endl;
+    if (flight == nullptr) {  // the same MST is going through the pipeline, this client gets its result too
+        metrics::countCoalescedMST();
+        return {"", nullptr};
     }
-    
-    clients_graphs[clientFd].second = new Triple{g, strat, clientFd};  // creating a new triple on the heap := {&g, strat, clientFd}. it will be deleted in the last function
 
-    t = clients_graphs[clientFd].second;  // get the triple
-    MST_Strategy* MST_strategy = MST_Factory::getInstance()->createMST(t->msg);  // create the MST strategy
-     tmp = (*MST_strategy)(t->g);                                         // create the MST using the strategy
-    }
-    t->g =  tmp;                                                        // create the MST using the strategy and store it in temp
-    t->msg = "MST created using " + t->msg + " strategy\n";
+    // the reactor keeps mutating g (a CSR graph is shared, not copied)
+    MSTRequest* request = new MSTRequest{{1}, new Graph(*g, true), "", flight, fmt};
+    request->summary.strat = strat;
+    request->memory = std::move(memory);
+    request->matrixFree = matrixFree;
+    request->cancel = flight->cancel.get();
 
-    pao->addTask(clients_graphs[clientFd].second);  // add the triple to the PAO object (means the first function will execute its function on this triple)
-    std::cout << "User " << clientFd << " requested to find MST of the Graph" << std::endl;
+    pao->addTask(request);  // add the request to the PAO object (means the first function will execute its function on it)
     return {"", nullptr};
 }
 
 /**
- * Handle the signal, actually stopping the server's while loop
+ * Handle the signal, actually stopping the server's while loop: only reactor 0's thread takes SIGINT, the rest of the
+ * shutdown runs in main once run() returned (closeAll joins the reactors and takes locks, not in a signal handler)
  */
 void handleSig(int sig) {
+    if (server != nullptr)
+        server->stop();
+}
+
+/**
+ * Free the graphs, the clients and the pipeline after the server's while loop stopped
+ */
+void cleanUp() {
     {
-        for(auto& mtx : clients_mtx) {
-            mtx.second.lock();
-        }
         cout << "\nPAO-server: cleaning up resources..." << endl;
 
         // graphs:
-        for(auto& graph_triple : clients_graphs) {
-            if(graph_triple.second.first != nullptr) {  // freeing the graph
-                delete graph_triple.second.first;
-            }
-            if(graph_triple.second.second != nullptr) {  // freeing the triple
-                if(graph_triple.second.second->g != nullptr){  // freeing the graph in the triple
-                    delete graph_triple.second.second->g;
-                    graph_triple.second.second->g = nullptr;
-                }
-                delete graph_triple.second.second;  // freeing the triple itself
-                graph_triple.second.second = nullptr;
-            }
+        if (server != nullptr) {
+            OutputStats stats = server->outputStats();
+            cout << "PAO-server: " << stats.writtenBytes << " bytes sent, at most " << stats.peakQueuedBytes
+                 << " bytes queued, reads paused " << stats.readPauses << " times" << endl;
+            server->closeAll();
         }
-
         cout << "PAO-server: Graphs freed," << endl;
-        // Clients: cleans the pfds
-        for (int i = 0; i < fd_count; i++)
-        {
-            if (pfds[i].fd != -1)
-            {
-                close(pfds[i].fd);
-            }
-        }
-        free(pfds);
         if (pao != nullptr) {
-            delete pao;  // delete the PAO object
+            delete pao;  // delete the PAO object, the requests still in flight are released
+            pao = nullptr;
         }
         cout << "PAO-server: Clients freed,\n" << "Good Bye!" << endl;
-        for (auto& mtx : clients_mtx) {
-            mtx.second.unlock();
-        }
-        
     }
-    exit(0);
 }
 
  
 // Main
-int main(void) {   
+int main(int argc, char* argv[]) {   
+    ServerOptions options = parseServerOptions(argc, argv);
+    blockInterrupt();  // before any thread starts, they all inherit it
+    MST_Factory::getInstance();  // create the strategies before the workers use them
+
+    // A computing stage runs in the request's cancel scope (the strategy, floydWarshall and the paths poll the token),
+    // a cancelled request skips the rest of them and only goes on to the sending stage
+    auto computing = [](void (*stage)(MSTRequest*)) {
+        return [stage](void* task) {
+            MSTRequest* t = (MSTRequest*)task;  // cast the void* to MSTRequest*
+            if (t->abandoned || t->cancel->cancelled()) {
+                t->abandoned = true;
+                return;
+            }
+            CancelScope cancelScope(t->cancel);
+            try {
+                stage(t);
+            } catch (const Cancelled&) {  // t->g is the snapshot or the MST, freed with the request
+                t->abandoned = true;
+            }
+        };
+    };
 
     // Create a list of functions to be executed by the PAO
     std::vector<std::function<void(void*)>> functions = {
 
-        // second function calculates the total weight of the edges
-        [](void* triple) { 
-                            Triple* t = (Triple*)triple;  // cast the void* to Triple*
-                            unique_lock<mutex> lock(clients_mtx[t->clientFd]);;  // lock the mutex
-                            t->msg += "Total weight of edges: " + std::to_string((t->g)->totalWeight()) + "\n";
-                            },
-
-        // third function calculates the longest path
-        [](void* triple) {Triple* t = (Triple*)triple;  // cast the void* to Triple*
-                            unique_lock<mutex> lock(clients_mtx[t->clientFd]);;  // lock the mutex
-                            t->msg += (t->g)->longestPath() + "\n";},
-
-        // fourth function calculates the average distance between vertices
-        [](void* triple) { Triple* t = (Triple*)triple;  // cast the void* to Triple*
-                            unique_lock<mutex> lock(clients_mtx[t->clientFd]);;  // lock the mutex
-                            t->msg += "The average distance between vertices is: " + std::to_string((t->g)->avgDistance()) + "\n";},
-
-        // fifth function calculates the shortest paths
-        [](void* triple) { Triple* t = (Triple*)triple;  // cast the void* to Triple*
-                            unique_lock<mutex> lock(clients_mtx[t->clientFd]);;  // lock the mutex
-                            t->msg += "The shortest paths are: \n" + (t->g)->allShortestPaths() + "\n"; 
-                          
-                            },  // delete the mst graph
+        // first function computes the MST of the snapshot using the requested strategy
+        computing([](MSTRequest* t) {
+                            Graph* snapshot = t->g;
+                            t->g = (*MST_Factory::getInstance()->createMST(t->summary.strat))(snapshot);  // create the MST using the strategy
+                            delete snapshot;
+                            if (!t->matrixFree)
+                                (t->g)->cacheDistances();
+                            t->out = "MST created using " + t->summary.strat + " strategy\n";
+                            }),
+
+        // second function indexes the MST for the clients' path, dist and bottleneck queries
+        computing([](MSTRequest* t) {
+                            t->tree = make_shared<TreeIndex>(*(t->g), t->flight->key.graph);
+                            }),
+
+        // third function calculates the total weight of the edges
+        computing([](MSTRequest* t) {
+                            t->summary.totalWeight = (t->g)->totalWeight();
+                            t->out += "Total weight of edges: " + std::to_string(t->summary.totalWeight) + "\n";
+                            }),
+
+        // fourth function calculates the longest path
+        computing([](MSTRequest* t) {
+                            if (t->fmt == ReplyFormat::Binary) {
+                                std::tie(t->summary.longestFrom, t->summary.longestTo, t->summary.longestDist) = (t->g)->longestPathInfo();
+                                return;
+                            }
+                            t->out += (t->g)->longestPath() + "\n";}),
+
+        // fifth function calculates the average distance between vertices
+        computing([](MSTRequest* t) {
+                            t->summary.avgDistance = (t->g)->avgDistance();
+                            t->out += "The average distance between vertices is: " + std::to_string(t->summary.avgDistance) + "\n";}),
+
+        // sixth function calculates every vertex's eccentricity and distance sum on the MST (rerooting, no matrices)
+        computing([](MSTRequest* t) {
+                            t->centrality = t->tree->centrality();
+                            }),
+
+        // seventh function reports the center(s), the radius and the median of the MST
+        computing([](MSTRequest* t) {
+                            if (t->fmt == ReplyFormat::Binary) return;  // the binary summary has no room for them
+                            t->out += centralityReport(t->centrality, false);
+                            }),
+
+        // eighth function calculates the shortest paths
+        computing([](MSTRequest* t) {
+                            if (t->fmt == ReplyFormat::Binary) return;  // binary clients get the MST edges instead of the paths
+                            if (t->matrixFree) {
+                                t->out += "The shortest paths are not listed: the distance matrices don't fit in the memory budget\n";
+                                return;
+                            }
+                            t->out += "The shortest paths are: \n" + (t->g)->allShortestPaths() + "\n"; 
+                            }),
         
-        // sixth function sends the result msg to the clientFd and deletes the triple
-        [](void* triple) { Triple* t = (Triple*)triple;  // cast the void* to Triple*
-                            unique_lock<mutex> lock(clients_mtx[t->clientFd]);;  // lock the mutex
-                            if (send(t->clientFd, t->msg.c_str(), t->msg.size(), 0) < 0)  // send the message to the client
-                                perror("send");
-                           
-                            }  // delete the triple
+        // ninth function queues the reply on the connections of the flight's waiters and releases the request
+        [](void* task) { MSTRequest* t = (MSTRequest*)task;  // cast the void* to MSTRequest*
+                            if (!t->abandoned && t->fmt == ReplyFormat::Binary)
+                                t->out = binproto::encodeMSTResult(*(t->g), t->summary);
+                            for (MSTWaiter& waiter : flights.finish(*t->flight)) {
+                                if (t->abandoned || waiter.cancel->cancelled()) {  // every waiter hung up or was superseded, or this one sent a newer mst and the flight ran on for the others
+                                    metrics::countCancelledMST();
+                                    sendMSTCancelled(waiter.client, t->fmt);
+                                    continue;
+                                }
+                                keepTree(waiter.client, t->tree);
+                                queueSend(waiter.client, t->out);
+                                metrics::recordMST(t->summary.strat, steadyNanos() - waiter.started);
+                            }
+                            t->memory.release();
+                            t->release();
+                            }
     };
 
-    pao = new PAO(functions);  // create a new PAO object with the functions
+    // the computing stages scale with their measured service times, the sending stage keeps the replies in order
+    pao = new PAO(functions, {0, 0, 0, 0, 0, 0, 0, 0, 1});  // create a new PAO object with the functions
+    pao->onDrop = [](void* task) { ((MSTRequest*)task)->release(); };  // requests left in the pipeline when it stops
     pao->start();  // start the PAO object (start the threads). no need to stop it because it will be stopped in the destructor.
-    const vector<string> graphActions = {"newgraph", "newedge", "removeedge", "mst"};
-    const vector<string> mstStrats = {"prim", "kruskal", "tarjan", "boruvka"};
-
-    string action = "";
-    string actualAction = "";
-    int m =0, n= 0, weight= 0;  // n := number of vertices, m := number of edges, weight := weight of the edge
-    string strat = "";  // strategy for the MST
  
-    char welcomeMsg[WELCOME_MSG_SIZE] = 
+    string welcomeMsg = 
         "Welcome to the PAO-server!\n"
         "This server can perform the following actions:\n"
         "1. Create a new graph: newgraph n m where \"n\" is the number of vertices and \"m\" is the number of edges.\n"
         "2. Add an edge to the graph: newedge n m w where \"n\" and \"m\" are the vertices and \"w\" is the weight of the edge.\n"
         "3. Remove an edge from the graph: removeedge n m where \"n\" and \"m\" are the vertices.\n"
-        "4. Find the Minimum Spanning Tree of the graph: mst strat -  where strat is either 'prim' or 'kruskal'\n";
-
-
-    int newfd;                          // Newly accepted socket descriptor
-    struct sockaddr_storage remoteaddr; // Client address
-    socklen_t addrlen;
-    char buf[256]= {0}; // Buffer for client data
-    char remoteIP[INET6_ADDRSTRLEN] ={0};
-
-    // Start off with room for 5 connections (isnt it four? because one is the listener..)
-    // (We'll realloc as necessary)
-    int fd_size = 5;
-
-    // Set up and get a listening socket
-    int listener = getListenerSocket();
-    if (listener == -1){
-        fprintf(stderr, "error getting listening socket\n");
-        exit(1);
-    }
-
-    // Add the listener to set
-    pfds = (struct pollfd *)malloc(sizeof *pfds * (size_t)fd_size);
-    memset(pfds, 0, sizeof *pfds * (size_t)fd_size);
-    pfds[0].fd = listener;
-    pfds[0].events = POLLIN; // Report ready to read on incoming connection
-    fd_count = 1; // For the listener
-    cout << "PAO-server: waiting for connections..." << endl;
-
-    signal(SIGINT, handleSig);  // handle the CTRL+C signal
-
-    // Main loop
-    while(true){
-        int poll_count = poll(pfds, (size_t)fd_count, -1);
-
-        if (poll_count == -1){
-            perror("poll");
-            exit(1);
+        "4. Find the Minimum Spanning Tree of the graph: mst strat -  where strat is either 'prim' or 'kruskal'\n"
+        "5. Switch to the binary protocol: binary\n"
+        "6. Load a graph file: loadgraph name (a file in the server's -d directory)\n"
+        "7. Save the graph to a graph file: savegraph name (in the server's -d directory)\n"
+        "8. Show the server's counters: serverstats\n"
+        "9. Write the recorded request trace to a file on the server: tracedump name (in the server's -d directory)\n"
+        "10. Share your graph with the other clients under a name: creategraph name\n"
+        "11. Work on a graph another client shared (instead of your own): usegraph name\n"
+        "12. Add k edges at once: newedges k, then the k edges as \"u v w\" lines\n"
+        "13. Remove k edges at once: removeedges k, then the k edges as \"u v\" lines\n"
+        "14. Ask about the last MST: path u v, dist u v or bottleneck u v (the heaviest edge on the MST path)\n"
+        "15. Ask about many pairs at once: querybatch k, then the k pairs as \"u v\" lines\n"
+        "16. Get the center, radius, median and every vertex's eccentricity of the last MST: mststats\n"
+        "Every command ends with a newline, several commands can be sent at once.\n";
+
+    server = new ServerCore("PAO-server", welcomeMsg, options);
+    server->statsReport = []() { return pao->statsReport(); };  // the stages' counters in the serverstats reply
+    server->metricsReport = []() {  // and their queues and replicas on /metrics
+        vector<pair<string, double>> waiting, replicas;
+        vector<uint64_t> queued = pao->waitingTasks();
+        vector<size_t> active = pao->activeReplicas();
+        for (size_t i = 0; i < queued.size(); i++) {
+            waiting.push_back({"stage=\"" + to_string(i) + "\"", static_cast<double>(queued[i])});
+            replicas.push_back({"stage=\"" + to_string(i) + "\"", static_cast<double>(active[i])});
         }
+        string out;
+        metrics::appendFamily(out, "mstserver_pao_waiting_tasks", "gauge", "Tasks waiting for each PAO stage.", waiting);
+        metrics::appendFamily(out, "mstserver_pao_active_replicas", "gauge", "Threads serving each PAO stage.", replicas);
+        return out;
+    };
 
-        // Run through the existing connections looking for data to read
-        for (int i = 0; i < fd_count; i++){
-
-            // Check if someone's ready to read
-            if (pfds[i].revents & POLLIN){ // We got one!!
-
-                if (pfds[i].fd == listener){ // If listener is ready to read, handle new connection
-
-                    addrlen = sizeof remoteaddr;
-                    newfd = accept(listener, (struct sockaddr *)&remoteaddr, &addrlen);
-
-                    if (newfd == -1){
-                        perror("accept");
-                    }
-                    else{
-                        add_to_pfds(&pfds, newfd, &fd_count, &fd_size);
-
-                        // Add the new client to the dictionary:
-                        clients_graphs[newfd].first = nullptr;
-                        clients_graphs[newfd].second = nullptr;
-
-                        printf("pollserver: new connection from %s on socket %d\n",
-                                    inet_ntop(remoteaddr.ss_family,
-                                                getInAddr((struct sockaddr *)&remoteaddr),
-                                                remoteIP, INET6_ADDRSTRLEN),
-                                    newfd);
-                        if (send(newfd, welcomeMsg, sizeof(welcomeMsg), 0) < 0){
-                            perror("send");
-                        }
-                    }
-                }
-                else{ // handle existing connection 
-                    int nbytes = recv(pfds[i].fd, buf, sizeof buf, 0); // receiving the msg from the client
-                    int sender_fd = pfds[i].fd;
-
-                    if (nbytes <= 0){ // Got error or connection closed by client
-                        if (nbytes == 0)
-                            printf("pollserver: socket %d hung up\n", sender_fd);
-                        else
-                            perror("ERROR: receiving data from client");
-
-                        close(pfds[i].fd);  // close the connection 
-                        del_from_pfds(pfds, i, &fd_count);  // remove the connection from the set of connections
-                        {
-                            unique_lock<mutex> lock(clients_mtx[sender_fd]);;
-                            if (clients_graphs[sender_fd].first != nullptr){  // if the client has a graph, delete it
-                            delete clients_graphs[sender_fd].first;
-                            clients_graphs[sender_fd].first = nullptr;
-                        }
-                        if (clients_graphs[sender_fd].second != nullptr){  // if the client has a triple, delete it
-                            if(clients_graphs[sender_fd].second->g != nullptr) {  // if the triple has a graph, delete it
-                                delete clients_graphs[sender_fd].second->g;
-                                clients_graphs[sender_fd].second->g = nullptr;
-                            }
-                            delete clients_graphs[sender_fd].second;  // delete the triple
-                            clients_graphs[sender_fd].second = nullptr;
-                        }
-                        clients_graphs.erase(sender_fd);  // remove the client from the dictionary
-                        }
-                    }
-                    else {  // the client sent a message
-                        parseInput(buf, nbytes, n, m, weight, strat, action, actualAction, graphActions, mstStrats);
-                        cout << "Action received: " << action << " from client " << sender_fd << endl;
-
-                        // handling the input:
-                        pair<string, Graph*> result = handleInput(clients_graphs[sender_fd].first, action, sender_fd, actualAction, n, m, weight, strat);
-                        //string msg = result.first;
-                        if (result.second != nullptr) {  // if the result is not null, store it in the dictionary for this client
-                            clients_graphs[sender_fd].first = result.second;
-                        }
-
-                        // print the message to the server
-                        if(actualAction == "message") {
-                            cout << result.first << endl;
-                            continue;
-                        }
-
-                        // if the actualAction is in the graphActions, then send the result to all the clients
-                        if(find(graphActions.begin(), graphActions.end(), actualAction) != graphActions.end()) {
-                            for (int j = 0; j < fd_count; j++) {
-                                int dest_fd = pfds[j].fd;
-                                if (dest_fd != listener)  // if the destination is not the listener
-                                    if (send(dest_fd, result.first.c_str(), result.first.size() + 1, 0) < 0)  // send the result to the client include the null terminator
-                                        perror("send");
-                            }
-                        }
-                    }
-                }
-            } // END handle data from client
-        } // END got ready-to-read from poll()
-    } // END looping through file descriptors
-    // END for(;;)--and you thought it would never end!
+    signal(SIGINT, handleSig);  // handle the CTRL+C signal
+    signal(SIGPIPE, SIG_IGN);  // a client that hung up is detected by recv, not by a signal
 
-    return 0;
-}
\ No newline at end of file
+    int status = server->run();
+    cleanUp();
+    return status;
+}
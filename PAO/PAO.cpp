@@ -1,20 +1,40 @@
 #include "PAO.hpp"
+#include <chrono>
 
 /**
  * Construct a new PAO object.
- * Get the functions to be executed by the workers.
+ * Get the functions to be executed by the workers and the replicas of every stage (0 = automatic).
+ * An automatic stage gets threads for the spare cores, but starts with a single active replica.
  */
-PAO::PAO(const std::vector<std::function<void(void*)>>& functions): stopFlag(false) {
-    // filling the workers vector with the struct Worker:
-    for (const auto& func : functions) {
-        // std::thread* trd = new std::thread();  // creating a new thread
-        std::mutex* mtx = new std::mutex();  // creating a new mutex
-        std::condition_variable* cond = new std::condition_variable();  // creating a new condition variable
-        workers.push_back({nullptr, func, std::queue<void*>(), mtx, cond, nullptr});
-    }
-    // Set the nextTaskQueue pointer for each worker except the last one:
-    for (size_t i = 0; i < workers.size() - 1; ++i) {
-        workers[i].nextTaskQueue = &workers[i + 1].taskQueue;
+PAO::PAO(const std::vector<std::function<void(void*)>>& functions, const std::vector<size_t>& replicas): stopFlag(false) {
+    size_t budget = std::max(static_cast<size_t>(std::thread::hardware_concurrency()), functions.size());  // threads worth running at once
+    size_t fixed = 0;
+    for (size_t i = 0; i < functions.size(); ++i) {
+        fixed += (i < replicas.size() && replicas[i] > 0) ? replicas[i] : 1;
+    }
+    size_t spare = budget > fixed ? budget - fixed : 0;
+
+    // filling the stages vector with the struct Stage:
+    for (size_t i = 0; i < functions.size(); ++i) {
+        Stage* stage = new Stage();
+        stage->index = i;
+        stage->function = functions[i];
+        stage->automatic = i < replicas.size() && replicas[i] == 0;
+        stage->replicas = stage->automatic ? std::min(spare + 1, MAX_REPLICAS) : (i < replicas.size() ? replicas[i] : 1);
+        stage->active = stage->automatic ? 1 : stage->replicas;
+        stage->serviceNanos = 0;
+        stage->input = nullptr;
+        stage->output = nullptr;
+        measuring = measuring || stage->automatic;
+        stages.push_back(stage);
+        for (size_t r = 0; r < stage->replicas; ++r) {
+            workers.push_back({nullptr, stage, r, new WorkerStats()});
+        }
+    }
+    // Connect every pair of consecutive stages with a ring:
+    for (size_t i = 0; i + 1 < stages.size(); ++i) {
+        stages[i]->output = new SequencedRing<Handoff>(RING_CAPACITY);
+        stages[i + 1]->input = stages[i]->output;
     }
 }
 
@@ -22,16 +42,28 @@ PAO::~PAO() {
 
     stop();  // stop the threads
 
-    // going over all the workers and deleting the threads, mutexes and condition variables
+    // going over all the workers and deleting the threads
     for (auto& worker : workers) {
         // if the thread is joinable, join it (:= wait for it to finish)
         if (worker.thread && worker.thread->joinable()) {
             worker.thread->join();
         }
-
         delete worker.thread;
-        delete worker.queueMutex;
-        delete worker.condition;
+        delete worker.stats;
+    }
+    // the tasks still queued never reach the last stage
+    if (onDrop) {
+        for (; !inputQueue.empty(); inputQueue.pop()) {
+            onDrop(inputQueue.front().task);
+        }
+        for (Stage* stage : stages) {
+            if (stage->output) stage->output->drain([this](const Handoff& handoff) { onDrop(handoff.task); });
+        }
+    }
+    // only now the stages, a ring is shared by the replicas of two stages
+    for (Stage* stage : stages) {
+        delete stage->output;  // every ring is the output of exactly one stage
+        delete stage;
     }
 }
 
@@ -40,9 +72,10 @@ PAO::~PAO() {
  */
 void PAO::addTask(void* task) {
     
-    std::lock_guard<std::mutex> lock(*(workers[0].queueMutex));
-    workers[0].taskQueue.push(task);
-    workers[0].condition->notify_one();  // notify the first worker to start working
+    std::lock_guard<std::mutex> lock(inputMutex);
+    inputQueue.push({task, steadyNanos(), trace::currentRequest()});
+    submitted.fetch_add(1, std::memory_order_relaxed);
+    inputCondition.notify_one();  // notify the first worker to start working
 }
 
 /**
@@ -53,52 +86,180 @@ void PAO::start() {
     stopFlag = false;
     
     for (size_t i = 0; i < workers.size(); ++i) {
-        Worker* nextWorker = (i + 1 < workers.size()) ? &workers[i + 1] : nullptr;  // if the worker is not the last one, set the nextWorker to the next worker
-        workers[i].thread = new std::thread(&PAO::workerFunction, this, std::ref(workers[i]), nextWorker);
+        workers[i].thread = new std::thread(&PAO::workerFunction, this, std::ref(workers[i]));
     }
 }
 
 void PAO::stop() {
     stopFlag = true;
-    for (auto& worker : workers) {  // notify all the workers to stop
-        std::lock_guard<std::mutex> lock(*worker.queueMutex);
-        worker.condition->notify_all();
-        // if (worker.thread->joinable()) {
-        //     worker.thread->join();
-        // }
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        inputCondition.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(scaleMutex);
+        scaleCondition.notify_all();
+    }
+    for (Stage* stage : stages) {  // wake the workers parked on a ring
+        if (stage->output) stage->output->wake();
+    }
+}
+
+std::vector<size_t> PAO::activeReplicas() const {
+    std::vector<size_t> counts;
+    for (const Stage* stage : stages) {
+        counts.push_back(stage->active.load());
+    }
+    return counts;
+}
+
+bool PAO::takeInput(Handoff& handoff, size_t& seq) {
+    std::unique_lock<std::mutex> lock(inputMutex);
+    // Note that in the wait function, the inputMutex is unlocked and locked again when the condition is met.
+    inputCondition.wait(lock, [&]() { return stopFlag || !inputQueue.empty(); });  // while the inputQueue is empty and the stopFlag is false, wait
+
+    if (stopFlag && inputQueue.empty()) return false;
+    handoff = inputQueue.front();
+    inputQueue.pop();
+    seq = nextSeq++;
+    if (measuring && nextSeq % TUNE_INTERVAL == 0) {
+        rebalance();
+    }
+    return true;
+}
+
+bool PAO::waitActive(const Worker& worker) {
+    if (worker.replica < worker.stage->active.load(std::memory_order_relaxed)) return true;
+    std::unique_lock<std::mutex> lock(scaleMutex);
+    scaleCondition.wait(lock, [&]() { return stopFlag || worker.replica < worker.stage->active.load(); });
+    return !stopFlag;
+}
+
+/**
+ * Give the spare threads, one at a time, to the stage with the longest service time per active replica,
+ * as long as that stage is automatic (more replicas anywhere else would not raise the throughput).
+ */
+void PAO::rebalance() {
+    size_t budget = std::max(static_cast<size_t>(std::thread::hardware_concurrency()), stages.size());
+    std::vector<size_t> counts;
+    size_t used = 0;
+    for (Stage* stage : stages) {
+        counts.push_back(stage->automatic ? 1 : stage->replicas);
+        used += counts.back();
+    }
+    while (used < budget) {
+        size_t slowest = 0;
+        double slowestTime = -1;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            double time = static_cast<double>(stages[i]->serviceNanos.load(std::memory_order_relaxed)) / static_cast<double>(counts[i]);
+            if (time > slowestTime) {
+                slowest = i;
+                slowestTime = time;
+            }
+        }
+        if (!stages[slowest]->automatic || counts[slowest] >= stages[slowest]->replicas) break;
+        counts[slowest]++;
+        used++;
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (stages[i]->automatic && stages[i]->active.exchange(counts[i]) != counts[i]) changed = true;
+    }
+    if (changed) {
+        std::lock_guard<std::mutex> lock(scaleMutex);
+        scaleCondition.notify_all();
     }
 }
 
 /**
  * this function actually wrap the function that the worker will execute so it will not end until the stopFlag is true.
+ * The replicas of a stage take the tasks from the input ring in sequence order and put them on the output ring under
+ * the same sequence number: no lock and no notify while both sides keep up.
  */
-void PAO::workerFunction(Worker& worker, Worker* nextWorker) {
+void PAO::workerFunction(Worker& worker) {
+    Stage& stage = *worker.stage;
+    WorkerStats& stats = *worker.stats;
     while (!stopFlag) {
+        if (!waitActive(worker)) return;
 
-        // creating a task:
-        void* task = nullptr;
-        {
-            std::unique_lock<std::mutex> lock(*worker.queueMutex);
-            // Note that in the wait function, the queueMutex is unlocked and locked again when the condition is met.
-            worker.condition->wait(lock, [&]() { return stopFlag || !worker.taskQueue.empty(); });  // while the taskQueue is empty and the stopFlag is false, wait
+        // taking a task:
+        Handoff handoff{nullptr, 0, 0};
+        size_t seq = 0;
+        bool got = stage.input ? stage.input->take(handoff, seq, stopFlag) : takeInput(handoff, seq);
+        if (!got) return;
+        bumpCounter(stats.taken);
+        bool timed = seq % TIMING_SAMPLE == 0;  // a clock read costs about as much as a hand-off
+        uint64_t start = timed ? steadyNanos() : 0;
+        if (timed) stats.wait.record(start - handoff.enqueued);
 
-            if (stopFlag && worker.taskQueue.empty()) return;
-            task = worker.taskQueue.front();
-            worker.taskQueue.pop();
+        // if the stage has a function to execute:
+        if (stage.function) {
+            TRACE_REQUEST(handoff.request);
+            TRACE_SPAN("pao stage", static_cast<int64_t>(stage.index));
+            stage.function(handoff.task);  // operate the function with the task
         }
-
-        // if the worker has a function to execute:
-        if (worker.function) {
-            worker.function(task);  // operate the function with the task
+        uint64_t end = 0;
+        if (timed) {
+            end = steadyNanos();
+            uint64_t nanos = end - start;
+            stats.service.record(nanos);
+            if (measuring) {
+                uint64_t average = stage.serviceNanos.load(std::memory_order_relaxed);  // replicas racing here only lose a sample
+                stage.serviceNanos.store(average == 0 ? nanos : average - average / 8 + nanos / 8, std::memory_order_relaxed);
+            }
         }
 
-        // if the worker is not the last one
-        if (nextWorker) {  
-            // pushing the task to the next worker:
-            std::lock_guard<std::mutex> lock(*nextWorker->queueMutex);
-            nextWorker->taskQueue.push(task);  // actually pushes a reserence to the mst and the string
-            nextWorker->condition->notify_one();  // notify the next worker to start working
+        // if the stage is not the last one, pass the task on (waits while the next stage is RING_CAPACITY tasks behind)
+        if (stage.output && !stage.output->put(seq, {handoff.task, end, handoff.request}, stopFlag)) {
+            if (onDrop) onDrop(handoff.task);
+            return;
         }
+        bumpCounter(stats.completed);
         if(stopFlag) return;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Aggregate the replicas' counters of every stage. The tasks waiting for a stage are the ones the previous stage
+ * completed (addTask, for the first one) minus the ones it took.
+ */
+std::string PAO::statsReport() const {
+    std::string report;
+    uint64_t arrived = submitted.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < stages.size(); ++i) {
+        uint64_t taken = 0, completed = 0;
+        HistogramSummary wait, service;
+        for (const Worker& worker : workers) {
+            if (worker.stage != stages[i]) continue;
+            completed += worker.stats->completed.load(std::memory_order_relaxed);  // before taken: the counts can only look too high
+            taken += worker.stats->taken.load(std::memory_order_relaxed);
+            worker.stats->wait.addTo(wait);
+            worker.stats->service.addTo(service);
+        }
+        uint64_t waiting = arrived > taken ? arrived - taken : 0;
+        uint64_t inService = taken > completed ? taken - completed : 0;
+        report += "pao stage " + std::to_string(i) + ": replicas " + std::to_string(stages[i]->active.load()) + "/" +
+                  std::to_string(stages[i]->replicas) + ", waiting " + std::to_string(waiting) +
+                  ", in service " + std::to_string(inService) + ", completed " + std::to_string(completed) +
+                  ", wait " + wait.format() + ", service " + service.format() + "\n";
+        arrived = completed;
+    }
+    return report;
+}
+
+std::vector<uint64_t> PAO::waitingTasks() const {
+    std::vector<uint64_t> waiting;
+    uint64_t arrived = submitted.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < stages.size(); ++i) {
+        uint64_t taken = 0, completed = 0;
+        for (const Worker& worker : workers) {
+            if (worker.stage != stages[i]) continue;
+            completed += worker.stats->completed.load(std::memory_order_relaxed);
+            taken += worker.stats->taken.load(std::memory_order_relaxed);
+        }
+        waiting.push_back(arrived > taken ? arrived - taken : 0);
+        arrived = completed;
+    }
+    return waiting;
+}
@@ -6,36 +6,106 @@
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <cstdint>
 #include <string>
 #include <utility>
 #include "../ServerUtils/serverUtils.hpp"
 #include "../GraphObj/graph.hpp"
+#include "../DataStruct/SequencedRing.hpp"
+#include "../DataStruct/LatencyHistogram.hpp"
+#include "../Trace/Trace.hpp"
 
 
+/**
+ * Pipeline of Active Objects.
+ * Every function is a stage; a stage runs on one or more replica threads. The tasks get a sequence number when the
+ * first stage takes them and enter every stage in addTask order (a stage's input ring hands them out by sequence
+ * number), so several replicas of a slow stage work on consecutive tasks and the next stage still sees them in order.
+ * Replicas of the same stage may finish out of order: a stage whose side effects must stay ordered (sending the
+ * replies) keeps a single replica.
+ * The replica count of a stage is fixed at construction, or 0 for automatic: the pipeline measures the service time
+ * of every stage and gives the spare threads to the bottleneck.
+ */
 class PAO {
     private:
 
-        // Worker struct that will represents a worker thread
+        static constexpr size_t RING_CAPACITY = 1024;  // tasks in flight between two stages before the producers wait
+        static constexpr size_t TUNE_INTERVAL = 256;  // tasks between two rebalancing of the automatic stages
+        static constexpr size_t MAX_REPLICAS = 16;
+        static constexpr size_t TIMING_SAMPLE = 8;  // one task in TIMING_SAMPLE is timed (by sequence number, the same task in every stage)
+
+        // A task between two stages
+        struct Handoff {
+            void* task;
+            uint64_t enqueued;  // steadyNanos() when it was queued for the stage, if the task is timed
+            uint64_t request;  // the traced request it works for
+        };
+
+        struct Stage {
+            size_t index;  // position in the pipeline
+            std::function<void(void*)> function;  // The function that the replicas will execute. task = void* because the function can get any type of task
+            size_t replicas;  // threads of this stage
+            bool automatic;  // the active count follows the measured service times
+            std::atomic<size_t> active;  // replicas taking tasks, the others sleep on scaleCondition
+            std::atomic<uint64_t> serviceNanos;  // moving average of the function's run time
+            SequencedRing<Handoff>* input;  // Tasks from the previous stage, nullptr for the first one (it reads the inputQueue)
+            SequencedRing<Handoff>* output;  // Tasks for the next stage (its input), nullptr for the last one
+        };
+
+        // Counters of one replica, written only by its thread
+        struct WorkerStats {
+            std::atomic<uint64_t> taken{0};  // tasks taken from the stage's input
+            std::atomic<uint64_t> completed{0};  // tasks passed on (or finished, for the last stage)
+            LatencyHistogram wait;  // queued for the stage to taken, timed tasks only
+            LatencyHistogram service;  // run time of the function, timed tasks only
+        };
+
+        // Worker struct that will represents a worker thread, a replica of a stage
         struct Worker {
             std::thread* thread;  // The worker thread
-            std::function<void(void*)> function;  // The function that the worker will execute
-            std::queue<void*> taskQueue;  // The queue of tasks for the worker. task = void* because the function can get any type of task
-            std::mutex* queueMutex;  // Mutex for the task queue
-            std::condition_variable* condition;  // Condition variable for the worker to wait on
-            std::queue<void*>* nextTaskQueue;  // Pointer to the next worker's task queue
+            Stage* stage;
+            size_t replica;  // index within the stage
+            WorkerStats* stats;
         };
 
-        void workerFunction(Worker& worker, Worker* nextWorker);
+        void workerFunction(Worker& worker);
+        bool takeInput(Handoff& handoff, size_t& seq);  // first stage only, waits for a task from addTask
+        bool waitActive(const Worker& worker);  // sleeps while the replica is switched off, false if the pipeline stops
+        void rebalance();  // sets the active count of the automatic stages from their service times
 
+        std::vector<Stage*> stages;
         std::vector<Worker> workers;
         std::atomic<bool> stopFlag;   // atomic flag to stop the threads
+        bool measuring = false;  // some stage is automatic
+
+        // addTask may be called from several threads, so the first stage keeps a locked queue
+        std::queue<Handoff> inputQueue;
+        std::atomic<uint64_t> submitted{0};  // tasks given to addTask
+        std::mutex inputMutex;
+        std::condition_variable inputCondition;
+        size_t nextSeq = 0;  // sequence number of the next task taken from inputQueue, protected by inputMutex
+
+        std::mutex scaleMutex;  // protects nothing but the wait for the active counts
+        std::condition_variable scaleCondition;
     
     public:
-        PAO(const std::vector<std::function<void(void*)>>& functions);  // the constructor get the functions to be executed by the workers
+        // the constructor get the functions to be executed by the workers, and the replicas of every stage
+        // (0 = automatic, missing = 1)
+        PAO(const std::vector<std::function<void(void*)>>& functions, const std::vector<size_t>& replicas = {});
         ~PAO();
         PAO() = default;
 
         void addTask(void* task);
         void start();
         void stop();
+
+        std::vector<size_t> activeReplicas() const;  // the current replica count of every stage
+
+        // One line per stage (replicas, tasks waiting and in service, completed, queue wait and service times), from any thread
+        std::string statsReport() const;
+
+        // Tasks waiting for every stage (queued before it, not yet taken), from any thread
+        std::vector<uint64_t> waitingTasks() const;
+
+        std::function<void(void*)> onDrop;  // called for every task the pipeline stops holding without finishing it
 };
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "Reactor.hpp"
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#define MAX_EVENTS 64 // events returned by one epoll_wait
+
+Reactor::Reactor() : stopFlag(false)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epfd < 0 || wakeFd < 0)
+    {
+        perror("reactor");
+        exit(1);
+    }
+    // the wakeup fd is the only entry with a null data pointer
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+}
+
+Reactor::~Reactor()
+{
+    for (auto &entry : entries)
+        delete entry.second;
+    for (Entry *entry : removed)
+        delete entry;
+    close(wakeFd);
+    close(epfd);
+}
+
+bool Reactor::add(int fd, uint32_t events, Handler handler)
+{
+    Entry *entry = new Entry{fd, std::move(handler), true};
+    epoll_event ev{};
+    ev.events = events | EPOLLET;
+    ev.data.ptr = entry;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl add");
+        delete entry;
+        return false;
+    }
+    entries[fd] = entry;
+    return true;
+}
+
+bool Reactor::modify(int fd, uint32_t events)
+{
+    auto it = entries.find(fd);
+    if (it == entries.end())
+        return false;
+    epoll_event ev{};
+    ev.events = events | EPOLLET;
+    ev.data.ptr = it->second;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl mod");
+        return false;
+    }
+    return true;
+}
+
+void Reactor::remove(int fd)
+{
+    auto it = entries.find(fd);
+    if (it == entries.end())
+        return;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    // the entry may still be in the current batch of events (or running), disarm it and free it later
+    it->second->active = false;
+    removed.push_back(it->second);
+    entries.erase(it);
+}
+
+void Reactor::post(std::function<void()> fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(postMutex);
+        posted.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof one) < 0 && errno != EAGAIN)
+        perror("reactor wakeup");
+}
+
+void Reactor::stop()
+{
+    stopFlag = true;
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof one) < 0 && errno != EAGAIN)
+        perror("reactor wakeup");
+}
+
+size_t Reactor::size() const
+{
+    return entries.size();
+}
+
+void Reactor::runPosted()
+{
+    uint64_t count;
+    while (read(wakeFd, &count, sizeof count) > 0)
+        ; // reset the eventfd
+    std::vector<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(postMutex);
+        batch.swap(posted);
+    }
+    for (auto &fn : batch)
+        fn();
+}
+
+void Reactor::run()
+{
+    epoll_event events[MAX_EVENTS];
+    while (!stopFlag)
+    {
+        int ready = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(1);
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            Entry *entry = static_cast<Entry *>(events[i].data.ptr);
+            if (entry == nullptr)
+                runPosted();
+            else if (entry->active)
+                entry->handler(events[i].events);
+        }
+
+        for (Entry *entry : removed)
+            delete entry;
+        removed.clear();
+    }
+}
+
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
@@ -0,0 +1,71 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <sys/epoll.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Edge-triggered epoll reactor.
+ * Every registered fd has a handler that is called with the ready events (EPOLLIN, EPOLLOUT, ...).
+ * A wakeup costs O(ready fds): the handler is reached through epoll's data pointer, no fd scanning.
+ * Registered fds should be non-blocking, and handlers must read/write until EAGAIN (edge-triggered).
+ * All the methods except post() and stop() must be called from the thread running run().
+ */
+class Reactor
+{
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    // Register fd for the given events (EPOLLET is added), the handler is called on every readiness change
+    bool add(int fd, uint32_t events, Handler handler);
+
+    // Change the events fd is registered for
+    bool modify(int fd, uint32_t events);
+
+    // Unregister fd, safe to call from inside any handler (the fd is not closed)
+    void remove(int fd);
+
+    // Run fn on the reactor's thread, can be called from any thread
+    void post(std::function<void()> fn);
+
+    // Dispatch events until stop() is called
+    void run();
+
+    // Stop run(), can be called from any thread
+    void stop();
+
+    // Number of registered fds
+    size_t size() const;
+
+private:
+    struct Entry
+    {
+        int fd;
+        Handler handler;
+        bool active; // false once removed, the handler may still be running
+    };
+
+    void runPosted();
+
+    int epfd;                                 // epoll instance
+    int wakeFd;                               // eventfd used by post() and stop() to wake epoll_wait
+    std::unordered_map<int, Entry *> entries; // registered fds
+    std::vector<Entry *> removed;             // entries removed during the current batch, freed after it
+    std::mutex postMutex;                     // protects posted
+    std::vector<std::function<void()>> posted;
+    std::atomic<bool> stopFlag;
+};
+
+// Set O_NONBLOCK on fd
+bool setNonBlocking(int fd);
+
+#endif // REACTOR_HPP
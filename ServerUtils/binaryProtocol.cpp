@@ -0,0 +1,314 @@
+#include "binaryProtocol.hpp"
+#include "serverUtils.hpp"
+#include <cstring>
+#include <stdexcept>
+#include "../Trace/Trace.hpp"
+#include "metrics.hpp"
+
+namespace binproto
+{
+    // Little-endian helpers, the wire format is little-endian regardless of the host
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    static uint32_t toLE32(uint32_t x) { return __builtin_bswap32(x); }
+    static uint64_t toLE64(uint64_t x) { return __builtin_bswap64(x); }
+    static constexpr bool HOST_IS_LE = false;
+#else
+    static uint32_t toLE32(uint32_t x) { return x; }
+    static uint64_t toLE64(uint64_t x) { return x; }
+    static constexpr bool HOST_IS_LE = true;
+#endif
+
+    static void putU32(std::string &out, uint32_t x)
+    {
+        x = toLE32(x);
+        out.append(reinterpret_cast<const char *>(&x), sizeof x);
+    }
+
+    static void putU64(std::string &out, uint64_t x)
+    {
+        x = toLE64(x);
+        out.append(reinterpret_cast<const char *>(&x), sizeof x);
+    }
+
+    static uint32_t getU32(const char *p)
+    {
+        uint32_t x;
+        memcpy(&x, p, sizeof x);
+        return toLE32(x);
+    }
+
+    // Copy count packed edges out of the payload, a single memcpy on little-endian hosts
+    static std::vector<PackedEdge> getEdges(const char *p, size_t count)
+    {
+        std::vector<PackedEdge> edges(count);
+        memcpy(edges.data(), p, count * sizeof(PackedEdge));
+        if (!HOST_IS_LE)
+        {
+            for (auto &e : edges)
+            {
+                e.u = toLE32(e.u);
+                e.v = toLE32(e.v);
+                e.w = toLE64(e.w);
+            }
+        }
+        return edges;
+    }
+
+    // Check that all the edges are between vertices 1..n
+    static bool validEdges(const std::vector<PackedEdge> &edges, size_t n)
+    {
+        for (const auto &e : edges)
+        {
+            if (e.u < 1 || e.v < 1 || e.u > n || e.v > n)
+                return false;
+        }
+        return true;
+    }
+
+    // The graph's edges of the packed ones, applied with a single invalidation (Graph::addEdges)
+    static std::vector<Edge> toEdges(const std::vector<PackedEdge> &packed)
+    {
+        std::vector<Edge> edges;
+        edges.reserve(packed.size());
+        for (const auto &e : packed)
+            edges.push_back(Edge(Vertex(e.u - 1), Vertex(e.v - 1), e.w));
+        return edges;
+    }
+
+    // The command a request opcode stands for, in the metrics
+    static std::string commandName(uint8_t opcode)
+    {
+        switch (opcode)
+        {
+        case OP_NEWGRAPH:
+            return "newgraph";
+        case OP_NEWEDGES:
+            return "newedges";
+        case OP_MST:
+            return "mst";
+        case OP_TEXTMODE:
+            return "textmode";
+        case OP_REMOVEEDGES:
+            return "removeedges";
+        default:
+            return "unknown";
+        }
+    }
+
+    void sendError(int fd, const std::string &msg)
+    {
+        queueSend(fd, encodeFrame(OP_REPLY_ERROR, msg));
+    }
+
+    std::string encodeFrame(uint8_t opcode, const std::string &payload)
+    {
+        std::string frame;
+        frame.reserve(HEADER_SIZE + payload.size());
+        putU32(frame, static_cast<uint32_t>(payload.size() + 1));
+        frame.push_back(static_cast<char>(opcode));
+        frame += payload;
+        return frame;
+    }
+
+    MSTSummary summarize(const Graph &mst, const std::string &strat)
+    {
+        MSTSummary summary;
+        summary.strat = strat;
+        summary.totalWeight = mst.totalWeight();
+        std::tie(summary.longestFrom, summary.longestTo, summary.longestDist) = mst.longestPathInfo();
+        summary.avgDistance = mst.avgDistance();
+        return summary;
+    }
+
+    std::string encodeMSTResult(Graph &mst, const MSTSummary &summary)
+    {
+        std::string payload;
+        payload.reserve(1 + summary.strat.size() + 44 + mst.numEdges() * sizeof(PackedEdge));
+        payload.push_back(static_cast<char>(summary.strat.size()));
+        payload += summary.strat;
+        putU32(payload, static_cast<uint32_t>(mst.numVertices()));
+        putU32(payload, static_cast<uint32_t>(mst.numEdges()));
+        putU64(payload, summary.totalWeight);
+        putU32(payload, static_cast<uint32_t>(summary.longestFrom + 1));
+        putU32(payload, static_cast<uint32_t>(summary.longestTo + 1));
+        putU64(payload, summary.longestDist);
+        uint64_t avgBits;
+        memcpy(&avgBits, &summary.avgDistance, sizeof avgBits);
+        putU64(payload, avgBits);
+        for (auto e = mst.edgesBegin(); e != mst.edgesEnd(); e++)
+        {
+            putU32(payload, static_cast<uint32_t>(e->getStart().getId() + 1));
+            putU32(payload, static_cast<uint32_t>(e->getEnd().getId() + 1));
+            putU64(payload, e->getWeight());
+        }
+        return encodeFrame(OP_REPLY_MST, payload);
+    }
+
+    ssize_t recvInto(int fd, WireState &wire)
+    {
+        size_t old = wire.inbuf.size();
+        wire.inbuf.resize(old + RECV_CHUNK);
+        ssize_t nbytes = recv(fd, &wire.inbuf[old], RECV_CHUNK, 0);
+        wire.inbuf.resize(old + (nbytes > 0 ? static_cast<size_t>(nbytes) : 0));
+        return nbytes;
+    }
+
+    bool nextFrame(const std::string &buf, size_t &offset, Frame &frame)
+    {
+        if (buf.size() - offset < HEADER_SIZE)
+            return false;
+        uint32_t length = getU32(buf.data() + offset);
+        if (length == 0 || length > MAX_FRAME)
+            throw std::runtime_error("Invalid frame length " + std::to_string(length));
+        if (buf.size() - offset - 4 < length)
+            return false;
+        frame.opcode = static_cast<uint8_t>(buf[offset + 4]);
+        frame.payload = buf.data() + offset + HEADER_SIZE;
+        frame.size = length - 1;
+        offset += 4 + length;
+        return true;
+    }
+
+    void sendText(int fd, const std::string &msg, bool binary)
+    {
+        if (binary)
+        {
+            if (msg.empty()) // nothing to frame (e.g. the broadcast of an mst request)
+                return;
+            queueSend(fd, encodeFrame(OP_REPLY_TEXT, msg));
+        }
+        else
+        {
+            queueSend(fd, std::string(msg.c_str(), msg.size() + 1)); // include the null terminator like the text protocol
+        }
+    }
+
+    std::vector<std::string> handleFrames(WireState &wire, Graph *&g, int clientFd, const std::vector<std::string> &mstStrats)
+    {
+        std::vector<std::string> notifications;
+        std::string client = "Client " + std::to_string(clientFd);
+        size_t offset = 0;
+        Frame frame;
+        try
+        {
+            while (wire.binary && nextFrame(wire.inbuf, offset, frame))
+            {
+                TRACE_REQUEST(trace::newRequest()); // every frame is a request
+                metrics::countCommand(commandName(frame.opcode), true);
+                if (frame.opcode == OP_NEWGRAPH)
+                {
+                    if (frame.size < 8)
+                    {
+                        sendError(clientFd, "newgraph frame is too short\n");
+                        continue;
+                    }
+                    size_t n = getU32(frame.payload);
+                    size_t m = getU32(frame.payload + 4);
+                    if (n == 0 || frame.size != 8 + m * sizeof(PackedEdge))
+                    {
+                        sendError(clientFd, "newgraph frame size does not match its edge count\n");
+                        continue;
+                    }
+                    std::vector<PackedEdge> edges = getEdges(frame.payload + 8, m);
+                    if (!validEdges(edges, n))
+                    {
+                        sendError(clientFd, "newgraph frame contains an edge with an invalid vertex\n");
+                        continue;
+                    }
+                    size_t needed = Graph::estimateBytes(n, m);
+                    size_t old = g != nullptr ? g->memoryBytes() : 0;
+                    MemoryReservation room = reserveMemory(clientFd, needed > old ? needed - old : 0);
+                    if (!room)
+                    {
+                        sendError(clientFd, client + " tried to create a Graph with " + std::to_string(n) + " vertices and " + std::to_string(m) + " edges but it doesn't fit in its memory budget\n");
+                        continue;
+                    }
+                    std::cout << "Creating a new graph with " << n << " vertices and " << m << " edges (binary)" << std::endl;
+                    Graph *newG = new Graph(n);
+                    newG->addEdges(toEdges(edges));
+                    delete g;
+                    g = newG;
+                    notifications.push_back(client + " successfully created a new Graph with " + std::to_string(n) + " vertices and " + std::to_string(m) + " edges\n");
+                }
+                else if (frame.opcode == OP_NEWEDGES)
+                {
+                    if (g == nullptr)
+                    {
+                        sendError(clientFd, client + " tried to perform the operation but there is no graph\n");
+                        continue;
+                    }
+                    size_t k = frame.size >= 4 ? getU32(frame.payload) : 0;
+                    if (frame.size < 4 || frame.size != 4 + k * sizeof(PackedEdge))
+                    {
+                        sendError(clientFd, "newedges frame size does not match its edge count\n");
+                        continue;
+                    }
+                    std::vector<PackedEdge> edges = getEdges(frame.payload + 4, k);
+                    if (!validEdges(edges, g->numVertices()))
+                    {
+                        sendError(clientFd, "newedges frame contains an edge with an invalid vertex\n");
+                        continue;
+                    }
+                    MemoryReservation room = reserveMemory(clientFd, edgeGrowthBytes(*g, k));
+                    if (!room)
+                    {
+                        sendError(clientFd, client + " tried to add " + std::to_string(k) + " edges but they don't fit in its memory budget\n");
+                        continue;
+                    }
+                    g->addEdges(toEdges(edges));
+                    notifications.push_back(client + " added " + std::to_string(k) + " edges\n");
+                }
+                else if (frame.opcode == OP_REMOVEEDGES)
+                {
+                    if (g == nullptr)
+                    {
+                        sendError(clientFd, client + " tried to perform the operation but there is no graph\n");
+                        continue;
+                    }
+                    size_t k = frame.size >= 4 ? getU32(frame.payload) : 0;
+                    if (frame.size < 4 || frame.size != 4 + k * sizeof(PackedEdge))
+                    {
+                        sendError(clientFd, "removeedges frame size does not match its edge count\n");
+                        continue;
+                    }
+                    std::vector<PackedEdge> edges = getEdges(frame.payload + 4, k);
+                    if (!validEdges(edges, g->numVertices()))
+                    {
+                        sendError(clientFd, "removeedges frame contains an edge with an invalid vertex\n");
+                        continue;
+                    }
+                    g->removeEdges(toEdges(edges));
+                    notifications.push_back(client + " removed " + std::to_string(k) + " edges\n");
+                }
+                else if (frame.opcode == OP_MST)
+                {
+                    std::string strat = toLowerCase(std::string(frame.payload, frame.size));
+                    if (find(mstStrats.begin(), mstStrats.end(), strat) == mstStrats.end())
+                        sendError(clientFd, "Unknown MST strategy: " + strat + "\n");
+                    else if (g == nullptr)
+                        sendError(clientFd, client + " tried to perform the operation but there is no graph\n");
+                    else if (!g->isConnected())
+                        sendError(clientFd, client + " tried to perform the operation but the graph is not connected therefore it doesn't have a MST\n");
+                    else
+                        MST(g, clientFd, strat, ReplyFormat::Binary);
+                }
+                else if (frame.opcode == OP_TEXTMODE)
+                {
+                    wire.binary = false; // the rest of the buffer is text lines
+                    std::cout << client << " switched back to the text protocol" << std::endl;
+                }
+                else
+                {
+                    sendError(clientFd, "Unknown opcode " + std::to_string(frame.opcode) + "\n");
+                }
+            }
+        }
+        catch (const std::runtime_error &e)
+        { // a broken header can't be resynchronized, drop everything buffered
+            sendError(clientFd, std::string(e.what()) + "\n");
+            offset = wire.inbuf.size();
+        }
+        wire.inbuf.erase(0, offset);
+        return notifications;
+    }
+}
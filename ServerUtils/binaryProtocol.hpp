@@ -0,0 +1,111 @@
+#ifndef BINARY_PROTOCOL_HPP
+#define BINARY_PROTOCOL_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "../GraphObj/graph.hpp"
+
+/**
+ * Compact binary wire protocol.
+ * A client switches its connection to binary mode by sending the text command "binary".
+ * From then on every message in both directions is a frame:
+ *      u32 length (little-endian, counts the opcode and the payload) | u8 opcode | payload
+ * Vertices are numbered from 1, exactly like in the text commands.
+ */
+
+// How the result of a request should be delivered to the client
+enum class ReplyFormat
+{
+    Text,
+    Binary
+};
+
+namespace binproto
+{
+    // Request opcodes (client -> server)
+    enum Opcode : uint8_t
+    {
+        OP_NEWGRAPH = 0x01, // u32 n, u32 m, m x PackedEdge
+        OP_NEWEDGES = 0x02, // u32 k, k x PackedEdge
+        OP_MST = 0x03,      // strategy name (the rest of the payload)
+        OP_TEXTMODE = 0x04, // no payload, switch the connection back to the text protocol
+        OP_REMOVEEDGES = 0x05, // u32 k, k x PackedEdge (the weights are ignored)
+
+        // Reply opcodes (server -> client)
+        OP_REPLY_TEXT = 0x81,  // utf-8 notification
+        OP_REPLY_MST = 0x82,   // see encodeMSTResult
+        OP_REPLY_ERROR = 0x83, // utf-8 error message
+    };
+
+    // Edge as it travels on the wire, packed little-endian (u32 u, u32 v, u64 w)
+    struct PackedEdge
+    {
+        uint32_t u;
+        uint32_t v;
+        uint64_t w;
+    };
+    static_assert(sizeof(PackedEdge) == 16, "PackedEdge must be 16 bytes on the wire");
+
+    constexpr size_t HEADER_SIZE = 5;          // u32 length + u8 opcode
+    constexpr uint32_t MAX_FRAME = 1u << 30;   // refuse frames larger than 1GB
+    constexpr size_t RECV_CHUNK = 1 << 16;     // read size of a connection
+    constexpr size_t MAX_LINE = 1u << 20;      // refuse text commands longer than 1MB
+
+    // Per connection state of the wire protocol
+    struct WireState
+    {
+        bool binary = false;     // true after the client negotiated the binary protocol
+        std::string inbuf;       // bytes received but not yet consumed as a frame or a text line
+        bool skipLine = false;   // the rest of an over long text line is being dropped
+    };
+
+    // A decoded frame, payload points into the connection's inbuf
+    struct Frame
+    {
+        uint8_t opcode;
+        const char *payload;
+        size_t size;
+    };
+
+    // The stats of a computed MST, sent together with its edges
+    struct MSTSummary
+    {
+        std::string strat;
+        size_t totalWeight = 0;
+        size_t longestFrom = 0;
+        size_t longestTo = 0;
+        size_t longestDist = 0;
+        double avgDistance = 0;
+    };
+
+    // Build a frame out of an opcode and a payload
+    std::string encodeFrame(uint8_t opcode, const std::string &payload);
+
+    // Encode an MST result frame:
+    // u8 strat length, strat, u32 n, u32 edge count, u64 total weight,
+    // u32 longest from, u32 longest to, u64 longest distance, f64 average distance, edge count x PackedEdge
+    std::string encodeMSTResult(Graph &mst, const MSTSummary &summary);
+
+    // Fill the numeric stats of an MST whose distances are already cached
+    MSTSummary summarize(const Graph &mst, const std::string &strat);
+
+    // recv() up to RECV_CHUNK bytes from the socket and append them to the state's buffer
+    ssize_t recvInto(int fd, WireState &wire);
+
+    // Try to cut one complete frame starting at offset. Returns false if more bytes are needed.
+    bool nextFrame(const std::string &buf, size_t &offset, Frame &frame);
+
+    // Queue a text notification for a client in the format it negotiated
+    void sendText(int fd, const std::string &msg, bool binary);
+
+    // Queue an error frame for a binary client
+    void sendError(int fd, const std::string &msg);
+
+    // Handle all complete frames buffered for the client.
+    // Returns the notifications that should be broadcasted to all the clients.
+    std::vector<std::string> handleFrames(WireState &wire, Graph *&g, int clientFd, const std::vector<std::string> &mstStrats);
+}
+
+#endif // BINARY_PROTOCOL_HPP
@@ -0,0 +1,37 @@
+#include "graphRegistry.hpp"
+
+std::shared_ptr<NamedGraph> GraphRegistry::create(const std::string &name, Graph *graph)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (graphs.find(name) != graphs.end())
+        return nullptr;
+    std::shared_ptr<NamedGraph> named = std::make_shared<NamedGraph>(name, graph);
+    named->users = 1;
+    graphs[name] = named;
+    return named;
+}
+
+std::shared_ptr<NamedGraph> GraphRegistry::use(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = graphs.find(name);
+    if (it == graphs.end())
+        return nullptr;
+    it->second->users++;
+    return it->second;
+}
+
+bool GraphRegistry::leave(const std::shared_ptr<NamedGraph> &graph)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--graph->users > 0)
+        return false;
+    graphs.erase(graph->name);
+    return true;
+}
+
+size_t GraphRegistry::users(const NamedGraph &graph)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return graph.users;
+}
@@ -0,0 +1,54 @@
+#ifndef GRAPH_REGISTRY_HPP
+#define GRAPH_REGISTRY_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include "../GraphObj/graph.hpp"
+#include "memoryBudget.hpp"
+
+/**
+ * A graph several clients work on under a name (creategraph/usegraph), instead of a copy each.
+ * Readers (mst snapshots, savegraph, the memory accounting) hold lock shared and run in parallel on any reactor,
+ * writers (newedge, removeedge, and newgraph/loadgraph replacing it) hold it exclusively.
+ * The graph is charged to its own share of the global memory budget, not to the clients using it.
+ */
+struct NamedGraph
+{
+    const std::string name;
+    std::shared_mutex lock;
+    Graph *graph = nullptr;     // guarded by lock
+    bool graphCounted = false;  // the graph as counted in the server's graph gauges, guarded by lock
+    size_t graphVertices = 0;
+    size_t graphEdges = 0;
+    ClientMemory memory;
+    size_t users = 0;           // guarded by the registry's mutex
+
+    NamedGraph(const std::string &name, Graph *graph) : name(name), graph(graph) {}
+};
+
+// The named graphs, each one lives while a client uses it
+class GraphRegistry
+{
+public:
+    // Share graph (nullptr: an empty graph) under name, the caller is its first user. nullptr if the name is taken.
+    std::shared_ptr<NamedGraph> create(const std::string &name, Graph *graph);
+
+    // Become a user of the graph called name, nullptr if there is none
+    std::shared_ptr<NamedGraph> use(const std::string &name);
+
+    // Stop using a graph, true if it was the last user: the name is free again and the graph is the caller's to free
+    bool leave(const std::shared_ptr<NamedGraph> &graph);
+
+    // The number of clients using a graph
+    size_t users(const NamedGraph &graph);
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<NamedGraph>> graphs;
+};
+
+#endif // GRAPH_REGISTRY_HPP
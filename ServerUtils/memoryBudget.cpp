@@ -0,0 +1,79 @@
+#include "memoryBudget.hpp"
+#include <utility>
+
+MemoryReservation::MemoryReservation(MemoryBudget *budget, std::shared_ptr<ClientMemory> client, size_t bytes)
+    : budget(budget), client(std::move(client)), size(bytes) {}
+
+MemoryReservation::MemoryReservation(MemoryReservation &&other) noexcept
+    : budget(other.budget), client(std::move(other.client)), size(other.size)
+{
+    other.budget = nullptr;
+    other.size = 0;
+}
+
+MemoryReservation &MemoryReservation::operator=(MemoryReservation &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        budget = other.budget;
+        client = std::move(other.client);
+        size = other.size;
+        other.budget = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+MemoryReservation::~MemoryReservation()
+{
+    release();
+}
+
+void MemoryReservation::release()
+{
+    if (budget != nullptr && client != nullptr)
+        budget->release(*client, size);
+    budget = nullptr;
+    client = nullptr;
+    size = 0;
+}
+
+MemoryBudget::MemoryBudget(size_t clientLimit, size_t globalLimit) : perClient(clientLimit), global(globalLimit) {}
+
+MemoryReservation MemoryBudget::reserve(const std::shared_ptr<ClientMemory> &client, size_t bytes)
+{
+    // a client's reactor and the pool threads keeping its MST index reserve for it at the same time: its reserved
+    // bytes are raced for like the global total, and given back if the total has no room
+    if (client == nullptr || bytes > perClient)
+        return MemoryReservation();
+    size_t graph = client->graphBytes.load(std::memory_order_relaxed);
+    size_t reserved = client->reservedBytes.load(std::memory_order_relaxed);
+    do
+    {
+        if (graph > perClient - bytes || reserved > perClient - bytes - graph)
+            return MemoryReservation();
+    } while (!client->reservedBytes.compare_exchange_weak(reserved, reserved + bytes, std::memory_order_relaxed));
+    size_t current = total.load(std::memory_order_relaxed);
+    do
+    {
+        if (bytes > global || current > global - bytes)
+        {
+            client->reservedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+            return MemoryReservation();
+        }
+    } while (!total.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+    return MemoryReservation(this, client, bytes);
+}
+
+void MemoryBudget::release(ClientMemory &client, size_t bytes)
+{
+    client.reservedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryBudget::setGraphBytes(ClientMemory &client, size_t bytes)
+{
+    size_t old = client.graphBytes.exchange(bytes, std::memory_order_relaxed);
+    total.fetch_add(bytes - old, std::memory_order_relaxed); // modular arithmetic, only the difference matters
+}
@@ -0,0 +1,83 @@
+#ifndef MEMORY_BUDGET_HPP
+#define MEMORY_BUDGET_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// What one client holds: its graph (measured after every command) and the reservations of its running computations
+struct ClientMemory
+{
+    std::atomic<size_t> graphBytes{0};
+    std::atomic<size_t> reservedBytes{0};
+
+    size_t used() const { return graphBytes.load(std::memory_order_relaxed) + reservedBytes.load(std::memory_order_relaxed); }
+};
+
+class MemoryBudget;
+
+// Bytes reserved on a client's budget until it is destroyed, empty (false) if the reservation was refused
+class MemoryReservation
+{
+public:
+    MemoryReservation() = default;
+    MemoryReservation(MemoryBudget *budget, std::shared_ptr<ClientMemory> client, size_t bytes);
+    MemoryReservation(MemoryReservation &&other) noexcept;
+    MemoryReservation &operator=(MemoryReservation &&other) noexcept;
+    MemoryReservation(const MemoryReservation &) = delete;
+    MemoryReservation &operator=(const MemoryReservation &) = delete;
+    ~MemoryReservation();
+
+    explicit operator bool() const { return budget != nullptr; }
+    size_t bytes() const { return size; }
+
+    // Give the bytes back before the end of the reservation's scope
+    void release();
+
+private:
+    MemoryBudget *budget = nullptr;
+    std::shared_ptr<ClientMemory> client;
+    size_t size = 0;
+};
+
+/**
+ * Memory limits of the server: every client may hold up to clientLimit bytes, all of them together up to globalLimit.
+ * Graphs are charged with what they measure (Graph::memoryBytes) once they are built; the memory a command is about
+ * to allocate (a new graph, the snapshot, MST and distance matrices of an mst request) is reserved first, from the
+ * estimates, and the command is refused or falls back to a smaller computation when it doesn't fit.
+ * Thread-safe: reservations are taken on the reactors and on the workers (an MST index), and released by both.
+ */
+class MemoryBudget
+{
+public:
+    MemoryBudget(size_t clientLimit, size_t globalLimit);
+
+    // Reserve bytes on top of what the client already uses, an empty reservation if a limit would be exceeded
+    MemoryReservation reserve(const std::shared_ptr<ClientMemory> &client, size_t bytes);
+
+    // Charge the client's graph with its current size, the graph exists already so it is never refused
+    void setGraphBytes(ClientMemory &client, size_t bytes);
+
+    // Outcomes of the commands whose reservation didn't fit: refused, or run as a smaller computation (see reserveMST)
+    void countRefusal() { refusals.fetch_add(1, std::memory_order_relaxed); }
+    void countFallback() { fallbackCount.fetch_add(1, std::memory_order_relaxed); }
+
+    size_t used() const { return total.load(std::memory_order_relaxed); }
+    size_t clientLimit() const { return perClient; }
+    size_t globalLimit() const { return global; }
+    uint64_t refused() const { return refusals.load(std::memory_order_relaxed); }
+    uint64_t fallbacks() const { return fallbackCount.load(std::memory_order_relaxed); }
+
+private:
+    friend class MemoryReservation;
+    void release(ClientMemory &client, size_t bytes);
+
+    const size_t perClient;
+    const size_t global;
+    std::atomic<size_t> total{0};     // graphs and reservations of all the clients
+    std::atomic<uint64_t> refusals{0};
+    std::atomic<uint64_t> fallbackCount{0};
+};
+
+#endif // MEMORY_BUDGET_HPP
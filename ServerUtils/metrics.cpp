@@ -0,0 +1,168 @@
+#include "metrics.hpp"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <unistd.h>
+#include "../GraphObj/graph.hpp"
+
+namespace metrics
+{
+    // The commands are bounded: unknown text commands are counted as "message", unknown opcodes as "unknown".
+    // A counter per command and protocol, the reactors count without a lock
+    static const char *const COMMANDS[] = {"newgraph", "newedge", "removeedge", "newedges", "removeedges", "mst",
+                                           "loadgraph", "savegraph", "creategraph", "usegraph", "path", "dist",
+                                           "bottleneck", "querybatch", "mststats", "binary", "textmode", "serverstats",
+                                           "tracedump", "emptyMessage", "unknown", "message"};
+    static constexpr size_t COMMAND_COUNT = sizeof COMMANDS / sizeof COMMANDS[0];
+    static std::atomic<uint64_t> commands[2][COMMAND_COUNT]; // [binary][command]
+
+    static std::mutex mstMutex; // protects the map, the histograms take concurrent records
+    static std::map<std::string, std::unique_ptr<LatencyHistogram>> mstLatency; // strategy -> latency
+    static std::atomic<uint64_t> mstCancelled(0);
+    static std::atomic<uint64_t> mstCoalesced(0);
+
+    static constexpr size_t FIRST_BUCKET = 9; // buckets below 1us are merged into the first one
+    static constexpr size_t LAST_BUCKET = 35; // about 69s, everything above goes to +Inf
+
+    static std::string formatValue(double value)
+    {
+        char buf[32];
+        if (value == static_cast<double>(static_cast<uint64_t>(value))) // counters and gauges stay exact
+            snprintf(buf, sizeof buf, "%.0f", value);
+        else
+            snprintf(buf, sizeof buf, "%.9g", value);
+        return buf;
+    }
+
+    static void appendHeader(std::string &out, const std::string &name, const std::string &type, const std::string &help)
+    {
+        out += "# HELP " + name + " " + help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+    }
+
+    void countCommand(const std::string &command, bool binary)
+    {
+        size_t index = 0;
+        while (index < COMMAND_COUNT - 1 && command != COMMANDS[index])
+            index++; // the last one, "message", takes the rest
+        commands[binary][index].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void recordMST(const std::string &strat, uint64_t nanos)
+    {
+        LatencyHistogram *histogram;
+        {
+            std::lock_guard<std::mutex> lock(mstMutex);
+            std::unique_ptr<LatencyHistogram> &slot = mstLatency[strat];
+            if (slot == nullptr)
+                slot.reset(new LatencyHistogram());
+            histogram = slot.get(); // never freed, records don't need the lock
+        }
+        histogram->recordShared(nanos);
+    }
+
+    void countCancelledMST()
+    {
+        mstCancelled.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countCoalescedMST()
+    {
+        mstCoalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void appendMetric(std::string &out, const std::string &name, const std::string &type, const std::string &help, double value)
+    {
+        appendHeader(out, name, type, help);
+        out += name + " " + formatValue(value) + "\n";
+    }
+
+    void appendFamily(std::string &out, const std::string &name, const std::string &type, const std::string &help,
+                      const std::vector<std::pair<std::string, double>> &samples)
+    {
+        appendHeader(out, name, type, help);
+        for (const auto &sample : samples)
+            out += name + "{" + sample.first + "} " + formatValue(sample.second) + "\n";
+    }
+
+    void appendHistograms(std::string &out, const std::string &name, const std::string &help,
+                          const std::vector<std::pair<std::string, HistogramSummary>> &histograms)
+    {
+        appendHeader(out, name, "histogram", help);
+        for (const auto &h : histograms)
+        {
+            const HistogramSummary &summary = h.second;
+            std::string labels = h.first.empty() ? "" : h.first + ",";
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b < HistogramSummary::BUCKETS; b++)
+            {
+                cumulative += summary.buckets[b];
+                if (b < FIRST_BUCKET || b > LAST_BUCKET)
+                    continue;
+                double le = static_cast<double>(uint64_t(1) << (b + 1)) / 1e9;
+                out += name + "_bucket{" + labels + "le=\"" + formatValue(le) + "\"} " + std::to_string(cumulative) + "\n";
+            }
+            out += name + "_bucket{" + labels + "le=\"+Inf\"} " + std::to_string(summary.count) + "\n";
+            std::string braces = h.first.empty() ? "" : "{" + h.first + "}";
+            out += name + "_sum" + braces + " " + formatValue(static_cast<double>(summary.sumNanos) / 1e9) + "\n";
+            out += name + "_count" + braces + " " + std::to_string(summary.count) + "\n";
+        }
+    }
+
+    size_t residentBytes()
+    {
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (statm == nullptr)
+            return 0;
+        unsigned long size = 0, resident = 0;
+        int fields = fscanf(statm, "%lu %lu", &size, &resident);
+        fclose(statm);
+        if (fields != 2)
+            return 0;
+        return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    std::string processMetrics()
+    {
+        std::string out;
+        std::vector<std::pair<std::string, double>> samples;
+        for (int binary = 0; binary < 2; binary++)
+        {
+            for (size_t i = 0; i < COMMAND_COUNT; i++)
+            {
+                uint64_t count = commands[binary][i].load(std::memory_order_relaxed);
+                if (count > 0) // the commands that were received
+                    samples.push_back({std::string("command=\"") + COMMANDS[i] + "\",protocol=\"" + (binary ? "binary" : "text") + "\"",
+                                       static_cast<double>(count)});
+            }
+        }
+        appendFamily(out, "mstserver_commands_total", "counter", "Commands received, by type and protocol.", samples);
+
+        std::vector<std::pair<std::string, HistogramSummary>> latencies;
+        {
+            std::lock_guard<std::mutex> lock(mstMutex);
+            for (const auto &m : mstLatency)
+            {
+                HistogramSummary summary;
+                m.second->addTo(summary);
+                latencies.push_back({"strategy=\"" + m.first + "\"", summary});
+            }
+        }
+        appendHistograms(out, "mstserver_mst_duration_seconds", "Time from an mst command to its reply being queued, by strategy.", latencies);
+
+        appendMetric(out, "mstserver_mst_cancelled_total", "counter", "MST requests cancelled because the client hung up or sent a newer one.",
+                     static_cast<double>(mstCancelled.load(std::memory_order_relaxed)));
+        appendMetric(out, "mstserver_mst_coalesced_total", "counter", "MST requests served by an identical computation already in flight.",
+                     static_cast<double>(mstCoalesced.load(std::memory_order_relaxed)));
+
+        std::pair<uint64_t, uint64_t> cache = Graph::distanceCacheStats();
+        appendFamily(out, "mstserver_distance_cache_lookups_total", "counter",
+                     "Graph stats that found the all-pairs distances cached (hit) or ran Floyd-Warshall (miss).",
+                     {{"result=\"hit\"", static_cast<double>(cache.first)}, {"result=\"miss\"", static_cast<double>(cache.second)}});
+
+        appendMetric(out, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.", static_cast<double>(residentBytes()));
+        return out;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../DataStruct/LatencyHistogram.hpp"
+
+/**
+ * Prometheus text exposition (format 0.0.4) of the servers' counters.
+ * ServerCore serves it on GET /metrics when it is started with -m port; the process wide counters (commands,
+ * MST latencies, the distance cache, RSS) are kept here, the rest is read from the server, its pool or its pipeline
+ * when the page is scraped. Counting is a relaxed atomic increment, from any thread.
+ */
+namespace metrics
+{
+    // Count a command by type, text commands by their action and binary frames by their opcode
+    void countCommand(const std::string &command, bool binary);
+
+    // Time from an mst command to its reply being queued, from any thread
+    void recordMST(const std::string &strat, uint64_t nanos);
+
+    // An mst request whose computation was cancelled (the client hung up or sent a newer one)
+    void countCancelledMST();
+
+    // An mst request that joined an identical computation in flight instead of starting its own (see MSTFlights)
+    void countCoalescedMST();
+
+    // A single sample, the name may carry labels: name{label="value"}
+    void appendMetric(std::string &out, const std::string &name, const std::string &type, const std::string &help, double value);
+
+    // A family of labelled samples: {labels without the braces, value}
+    void appendFamily(std::string &out, const std::string &name, const std::string &type, const std::string &help,
+                      const std::vector<std::pair<std::string, double>> &samples);
+
+    // A histogram per label set, in seconds, with the log2 buckets of HistogramSummary
+    void appendHistograms(std::string &out, const std::string &name, const std::string &help,
+                          const std::vector<std::pair<std::string, HistogramSummary>> &histograms);
+
+    // Resident set size of the process, from /proc/self/statm (0 if it can't be read)
+    size_t residentBytes();
+
+    // The counters kept in this module, the distance cache and the RSS
+    std::string processMetrics();
+}
+
+#endif // METRICS_HPP
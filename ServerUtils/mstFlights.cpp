@@ -0,0 +1,29 @@
+#include "mstFlights.hpp"
+#include <utility>
+
+std::shared_ptr<MSTFlight> MSTFlights::join(const MSTKey &key, MSTWaiter waiter)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = flights.find(key);
+    if (it != flights.end() && waiter.cancel->join(it->second->cancel))
+    {
+        it->second->waiters.push_back(std::move(waiter));
+        return nullptr;
+    }
+    // none in flight, or all its waiters are gone and it is being cancelled: this request computes
+    std::shared_ptr<MSTFlight> flight = std::make_shared<MSTFlight>();
+    flight->key = key;
+    flight->cancel = waiter.cancel->startGroup();
+    flight->waiters.push_back(std::move(waiter));
+    flights[key] = flight;
+    return flight;
+}
+
+std::vector<MSTWaiter> MSTFlights::finish(MSTFlight &flight)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = flights.find(flight.key);
+    if (it != flights.end() && it->second.get() == &flight) // a cancelled flight may have been replaced already
+        flights.erase(it);
+    return std::move(flight.waiters);
+}
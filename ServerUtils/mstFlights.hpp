@@ -0,0 +1,78 @@
+#ifndef MST_FLIGHTS_HPP
+#define MST_FLIGHTS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "serverUtils.hpp"
+
+// What the reply to an mst request depends on: the graph's content, the strategy, and how the reply is built
+struct MSTKey
+{
+    GraphIdentity graph;
+    std::string strat;
+    ReplyFormat fmt;
+    bool matrixFree;
+
+    bool operator==(const MSTKey &other) const
+    {
+        return graph == other.graph && strat == other.strat && fmt == other.fmt && matrixFree == other.matrixFree;
+    }
+};
+
+struct MSTKeyHash
+{
+    size_t operator()(const MSTKey &key) const
+    {
+        size_t h = std::hash<uint64_t>()(key.graph.source);
+        h = h * 31 + std::hash<uint64_t>()(key.graph.version);
+        h = h * 31 + std::hash<std::string>()(key.strat);
+        return h * 31 + static_cast<size_t>(key.fmt) * 2 + (key.matrixFree ? 1 : 0);
+    }
+};
+
+// An mst request waiting for a computation's result
+struct MSTWaiter
+{
+    ClientRef client;
+    uint64_t started;                   // steadyNanos() of the mst command
+    std::shared_ptr<CancelToken> cancel; // the request's own token, a member of the flight's
+};
+
+// One MST computation and the requests waiting for it
+struct MSTFlight
+{
+    MSTKey key;
+    std::shared_ptr<CancelToken> cancel; // the computation polls it, cancelled once every waiter is
+    std::vector<MSTWaiter> waiters;      // guarded by the registry's mutex
+};
+
+/**
+ * Single-flight registry of the MST computations in progress.
+ * An mst request for a key that is already being computed joins that computation instead of starting its own, and
+ * gets the same result: a burst of identical requests (many clients on one graph file, or a client repeating its
+ * command) costs one computation. The flight's token is a group of the waiters' tokens, the computation is cancelled
+ * only when all of its waiters hung up or were superseded.
+ * The registry only knows of computations in flight, a finished result is not cached.
+ */
+class MSTFlights
+{
+public:
+    // Wait for the result of key: join its computation if one is in flight (nullptr is returned), otherwise start a
+    // new one that the caller computes in the returned flight's cancel scope, then finish()es.
+    // waiter.cancel is a new token, not cancellable yet.
+    std::shared_ptr<MSTFlight> join(const MSTKey &key, MSTWaiter waiter);
+
+    // The flight's computation is over, the requests that come next start a new one: its waiters
+    std::vector<MSTWaiter> finish(MSTFlight &flight);
+
+private:
+    std::mutex mutex;
+    std::unordered_map<MSTKey, std::shared_ptr<MSTFlight>, MSTKeyHash> flights;
+};
+
+#endif // MST_FLIGHTS_HPP
@@ -0,0 +1,62 @@
+#include "outputBuffer.hpp"
+#include <sys/uio.h>
+#include <cerrno>
+
+#define MAX_IOV 64 // messages gathered by one writev
+
+void OutputBuffer::append(std::string data)
+{
+    if (data.empty())
+        return;
+    bytes += data.size();
+    chunks.push_back(std::move(data));
+}
+
+bool OutputBuffer::flush(int fd, size_t &written)
+{
+    written = 0;
+    while (!chunks.empty())
+    {
+        struct iovec iov[MAX_IOV];
+        int count = 0;
+        for (auto it = chunks.begin(); it != chunks.end() && count < MAX_IOV; it++, count++)
+        {
+            size_t skip = count == 0 ? offset : 0;
+            iov[count].iov_base = const_cast<char *>(it->data() + skip);
+            iov[count].iov_len = it->size() - skip;
+        }
+
+        ssize_t sent = writev(fd, iov, count);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK; // the socket is full, wait for EPOLLOUT
+        }
+
+        // drop the chunks that were sent completely
+        size_t left = static_cast<size_t>(sent);
+        written += left;
+        bytes -= left;
+        while (left > 0)
+        {
+            size_t remaining = chunks.front().size() - offset;
+            if (left < remaining)
+            {
+                offset += left;
+                break;
+            }
+            left -= remaining;
+            offset = 0;
+            chunks.pop_front();
+        }
+    }
+    return true;
+}
+
+void OutputBuffer::clear()
+{
+    chunks.clear();
+    offset = 0;
+    bytes = 0;
+}
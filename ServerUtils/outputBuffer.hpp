@@ -0,0 +1,34 @@
+#ifndef OUTPUT_BUFFER_HPP
+#define OUTPUT_BUFFER_HPP
+
+#include <deque>
+#include <string>
+
+/**
+ * Outbound queue of one connection: a chain of messages written with writev,
+ * so a reply is never copied into a contiguous buffer and partial writes just move the offset.
+ * Not thread-safe, owned by the connection's reactor thread.
+ */
+class OutputBuffer
+{
+public:
+    // Queue a message (moved, not copied)
+    void append(std::string data);
+
+    // Write as much as the non-blocking socket takes, written is set to the number of bytes sent.
+    // Returns false if the connection is broken.
+    bool flush(int fd, size_t &written);
+
+    // Drop everything that was not sent
+    void clear();
+
+    size_t size() const { return bytes; } // bytes waiting to be sent
+    bool empty() const { return bytes == 0; }
+
+private:
+    std::deque<std::string> chunks;
+    size_t offset = 0; // bytes of chunks.front() already sent
+    size_t bytes = 0;
+};
+
+#endif // OUTPUT_BUFFER_HPP
@@ -0,0 +1,1180 @@
+#include "serverCore.hpp"
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include "../Trace/Trace.hpp"
+#include "metrics.hpp"
+
+static ServerCore *activeCore = nullptr;               // the running server, used by queueSend()
+static thread_local const void *currentShard = nullptr; // the shard run by this thread, if it is a reactor thread
+
+ClientRef clientRef(int fd)
+{
+    if (activeCore == nullptr)
+        return ClientRef{fd, 0};
+    return activeCore->clientRef(fd);
+}
+
+void queueSend(const ClientRef &client, std::string data)
+{
+    if (activeCore != nullptr)
+        activeCore->send(client, std::move(data));
+}
+
+void queueSend(int fd, std::string data)
+{
+    queueSend(clientRef(fd), std::move(data));
+}
+
+MemoryReservation reserveMemory(int fd, size_t bytes, bool countRefusal)
+{
+    if (activeCore == nullptr)
+        return MemoryReservation();
+    MemoryReservation reservation = activeCore->reserveMemory(fd, bytes);
+    if (!reservation && countRefusal)
+        activeCore->memoryBudget().countRefusal();
+    return reservation;
+}
+
+MemoryBudget *memoryBudget()
+{
+    return activeCore == nullptr ? nullptr : &activeCore->memoryBudget();
+}
+
+void supersedeMST(int fd, const std::shared_ptr<CancelToken> &token)
+{
+    if (activeCore != nullptr)
+        activeCore->supersedeMST(fd, token);
+}
+
+void keepTree(const ClientRef &client, std::shared_ptr<const TreeIndex> tree)
+{
+    if (activeCore != nullptr)
+        activeCore->keepTree(client, std::move(tree));
+}
+
+// A size in bytes, with an optional k, m or g suffix
+static long long parseBytes(const char *arg)
+{
+    char *end;
+    long long bytes = strtoll(arg, &end, 10);
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        return bytes << 10;
+    case 'm':
+    case 'M':
+        return bytes << 20;
+    case 'g':
+    case 'G':
+        return bytes << 30;
+    default:
+        return *end == '\0' ? bytes : -1;
+    }
+}
+
+ServerOptions parseServerOptions(int argc, char *argv[])
+{
+    ServerOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:m:b:B:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+        {
+            long reactors = strtol(optarg, nullptr, 10);
+            if (reactors < 1 || reactors > 256)
+            {
+                fprintf(stderr, "%s: the number of reactors must be between 1 and 256\n", argv[0]);
+                exit(1);
+            }
+            options.reactors = static_cast<size_t>(reactors);
+            break;
+        }
+        case 'w':
+        {
+            long long highWaterMark = strtoll(optarg, nullptr, 10);
+            if (highWaterMark < 1024)
+            {
+                fprintf(stderr, "%s: the high-water mark must be at least 1024 bytes\n", argv[0]);
+                exit(1);
+            }
+            options.highWaterMark = static_cast<size_t>(highWaterMark);
+            break;
+        }
+        case 'm':
+        {
+            long port = strtol(optarg, nullptr, 10);
+            if (port < 1 || port > 65535 || std::string(optarg) == PORT)
+            {
+                fprintf(stderr, "%s: the metrics port must be between 1 and 65535 and differ from %s\n", argv[0], PORT);
+                exit(1);
+            }
+            options.metricsPort = std::to_string(port);
+            break;
+        }
+        case 'b':
+        case 'B':
+        {
+            long long bytes = parseBytes(optarg);
+            if (bytes < 1 << 20)
+            {
+                fprintf(stderr, "%s: a memory budget must be at least 1M\n", argv[0]);
+                exit(1);
+            }
+            (opt == 'b' ? options.clientMemory : options.globalMemory) = static_cast<size_t>(bytes);
+            break;
+        }
+        case 'd':
+        {
+            struct stat st;
+            if (stat(optarg, &st) < 0 || !S_ISDIR(st.st_mode))
+            {
+                fprintf(stderr, "%s: %s is not a directory\n", argv[0], optarg);
+                exit(1);
+            }
+            options.fileDir = optarg;
+            while (options.fileDir.size() > 1 && options.fileDir.back() == '/')
+                options.fileDir.pop_back();
+            break;
+        }
+        default:
+            fprintf(stderr, "usage: %s [-r reactors] [-w high-water mark in bytes] [-m metrics port] "
+                            "[-b client memory budget] [-B global memory budget] [-d graph file directory]\n", argv[0]);
+            exit(1);
+        }
+    }
+    return options;
+}
+
+ServerCore::ServerCore(const std::string &name, const std::string &welcomeMsg, const ServerOptions &options)
+    : name(name), welcomeMsg(welcomeMsg), options(options), memory(options.clientMemory, options.globalMemory) {}
+
+ServerCore::~ServerCore()
+{
+    closeAll();
+}
+
+void blockInterrupt()
+{
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &interrupt, nullptr);
+}
+
+int ServerCore::run()
+{
+    // Set up a listening socket per reactor, the kernel balances the connections between them
+    for (size_t i = 0; i < options.reactors; i++)
+    {
+        std::unique_ptr<Shard> shard(new Shard());
+        shard->id = i;
+        shard->listener = getListenerSocket(options.reactors > 1);
+        if (shard->listener == -1 || !setNonBlocking(shard->listener))
+        {
+            fprintf(stderr, "error getting listening socket\n");
+            if (shard->listener != -1)
+                close(shard->listener);
+            closeAll();
+            return 1;
+        }
+        Shard *s = shard.get();
+        s->reactor.add(s->listener, EPOLLIN, [this, s](uint32_t)
+                       { acceptClients(*s); });
+        shards.push_back(std::move(shard));
+    }
+
+    // The metrics listener is served by reactor 0
+    if (!options.metricsPort.empty())
+    {
+        Shard *s = shards[0].get();
+        s->metricsListener = getListenerSocket(false, options.metricsPort.c_str());
+        if (s->metricsListener == -1 || !setNonBlocking(s->metricsListener))
+        {
+            fprintf(stderr, "error getting the metrics listening socket on port %s\n", options.metricsPort.c_str());
+            closeAll();
+            return 1;
+        }
+        s->reactor.add(s->metricsListener, EPOLLIN, [this, s](uint32_t)
+                       { acceptScrapers(*s); });
+        std::cout << name << ": serving /metrics on port " << options.metricsPort << std::endl;
+    }
+
+    activeCore = this;
+    std::cout << name << ": waiting for connections on " << shards.size() << " reactor thread(s)..." << std::endl;
+    for (size_t i = 1; i < shards.size(); i++)
+    {
+        Shard *s = shards[i].get();
+        s->thread = std::thread([s]()
+                                {
+                                    currentShard = s;
+                                    s->reactor.run(); });
+    }
+    currentShard = shards[0].get();
+    // the other reactors inherited SIGINT blocked: it interrupts this loop only, and stop() sees every shard
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    pthread_sigmask(SIG_UNBLOCK, &interrupt, nullptr);
+    shards[0]->reactor.run();
+    for (size_t i = 1; i < shards.size(); i++)
+    {
+        if (shards[i]->thread.joinable())
+            shards[i]->thread.join();
+    }
+    return 0;
+}
+
+void ServerCore::stop()
+{
+    for (auto &shard : shards)
+        shard->reactor.stop();
+}
+
+void ServerCore::closeAll()
+{
+    // the other reactor threads must be done with their sessions first
+    stop();
+    for (auto &shard : shards)
+    {
+        if (shard->thread.joinable() && shard->thread.get_id() != std::this_thread::get_id())
+            shard->thread.join();
+    }
+    for (auto &shard : shards)
+    {
+        for (auto &session : shard->sessions)
+        {
+            if (session.second.graph != nullptr)
+            {
+                delete session.second.graph;
+                session.second.graph = nullptr;
+            }
+            accountGraph(session.second);
+            leaveNamed(session.second);
+            close(session.first);
+        }
+        shard->sessions.clear();
+        for (auto &scrape : shard->scrapes)
+            close(scrape.first);
+        shard->scrapes.clear();
+        if (shard->metricsListener != -1)
+        {
+            close(shard->metricsListener);
+            shard->metricsListener = -1;
+        }
+        std::lock_guard<std::mutex> lock(ownersMutex);
+        for (auto &owner : owners)
+        {
+            if (owner.second.mst != nullptr)
+                owner.second.mst->cancel();
+        }
+        owners.clear();
+        if (shard->listener != -1)
+        {
+            close(shard->listener);
+            shard->listener = -1;
+        }
+    }
+}
+
+void ServerCore::acceptClients(Shard &shard)
+{
+    char remoteIP[INET6_ADDRSTRLEN] = {0};
+    while (true) // edge-triggered: accept until the backlog is empty
+    {
+        struct sockaddr_storage remoteaddr; // Client address
+        socklen_t addrlen = sizeof remoteaddr;
+        int newfd = accept4(shard.listener, (struct sockaddr *)&remoteaddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newfd == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        // Add the new client to the dictionary:
+        uint64_t id = nextClientId++;
+        ClientSession &session = shard.sessions[newfd];
+        session.fd = newfd;
+        session.id = id;
+        session.memory = std::make_shared<ClientMemory>();
+        {
+            std::lock_guard<std::mutex> lock(ownersMutex);
+            owners[newfd] = Owner{&shard, id, session.memory};
+        }
+        Shard *s = &shard;
+        shard.reactor.add(newfd, EPOLLIN, [this, s, newfd](uint32_t events)
+                          { handleEvents(*s, newfd, events); });
+
+        printf("%s: new connection from %s on socket %d\n", name.c_str(),
+               inet_ntop(remoteaddr.ss_family, getInAddr((struct sockaddr *)&remoteaddr), remoteIP, INET6_ADDRSTRLEN),
+               newfd);
+        enqueue(shard, session, std::string(welcomeMsg.c_str(), welcomeMsg.size() + 1));
+    }
+}
+
+void ServerCore::handleEvents(Shard &shard, int fd, uint32_t events)
+{
+    auto it = shard.sessions.find(fd);
+    if (it == shard.sessions.end())
+        return;
+    if (events & EPOLLOUT)
+        flush(shard, it->second);
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        readClient(shard, fd); // an error or a hang up is reported by recv
+}
+
+void ServerCore::readClient(Shard &shard, int fd)
+{
+    shard.batching = true; // the replies to everything read now are written once, at the end
+    while (true)           // edge-triggered: read until the socket is drained
+    {
+        auto it = shard.sessions.find(fd);
+        if (it == shard.sessions.end())
+            break;
+        ClientSession &session = it->second;
+        if (session.readsPaused) // resumed by flush() once the client reads its replies
+            break;
+
+        ssize_t nbytes = binproto::recvInto(fd, session.wire); // commands may be cut anywhere, keep them in the connection's buffer
+        if (nbytes < 0 && errno == EINTR)
+            continue;
+        if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (nbytes <= 0)
+        { // Got error or connection closed by client
+            if (nbytes == 0)
+                printf("%s: socket %d hung up\n", name.c_str(), fd);
+            else
+                perror("ERROR: receiving data from client");
+            disconnect(shard, fd);
+            break;
+        }
+
+        handleReceived(shard, session);
+    }
+    flushBatch(shard);
+}
+
+void ServerCore::flushBatch(Shard &shard)
+{
+    shard.batching = false;
+    std::vector<int> unflushed = std::move(shard.unflushed);
+    shard.unflushed.clear();
+    for (int fd : unflushed)
+    {
+        auto it = shard.sessions.find(fd);
+        if (it != shard.sessions.end() && !it->second.out.empty())
+            flush(shard, it->second);
+    }
+}
+
+void ServerCore::enqueue(Shard &shard, ClientSession &session, std::string data)
+{
+    size_t size = data.size();
+    bool wasEmpty = session.out.empty();
+    session.out.append(std::move(data));
+    size_t total = queuedBytes += size;
+    size_t peak = peakQueuedBytes;
+    while (total > peak && !peakQueuedBytes.compare_exchange_weak(peak, total))
+        ;
+    if (wasEmpty && !shard.batching) // otherwise the reactor is already waiting for EPOLLOUT
+    {
+        flush(shard, session);
+        return;
+    }
+    if (wasEmpty) // written by flushBatch()
+        shard.unflushed.push_back(session.fd);
+    if (!session.readsPaused && session.out.size() > options.highWaterMark)
+        updateEvents(shard, session);
+}
+
+void ServerCore::flush(Shard &shard, ClientSession &session)
+{
+    TRACE_SPAN("send");
+    size_t written = 0;
+    bool ok = session.out.flush(session.fd, written);
+    queuedBytes -= written;
+    writtenBytes += written;
+    if (!ok)
+    { // the connection is broken, drop its output and let recv report the error
+        queuedBytes -= session.out.size();
+        session.out.clear();
+        Shard *s = &shard;
+        int fd = session.fd;
+        uint64_t id = session.id;
+        shard.reactor.post([this, s, fd, id]()
+                           {
+                               auto it = s->sessions.find(fd);
+                               if (it != s->sessions.end() && it->second.id == id)
+                                   disconnect(*s, fd); });
+        return;
+    }
+    updateEvents(shard, session);
+}
+
+void ServerCore::updateEvents(Shard &shard, ClientSession &session)
+{
+    if (!session.readsPaused && session.out.size() > options.highWaterMark)
+    {
+        session.readsPaused = true;
+        readPauses++;
+    }
+    else if (session.readsPaused && session.out.size() <= options.highWaterMark / 2)
+        session.readsPaused = false; // re-registering EPOLLIN reports the data that is already waiting
+
+    uint32_t events = (session.readsPaused ? 0 : EPOLLIN) | (session.out.empty() ? 0 : EPOLLOUT);
+    if (events != session.events)
+    {
+        session.events = events;
+        shard.reactor.modify(session.fd, events);
+    }
+}
+
+ClientRef ServerCore::clientRef(int fd)
+{
+    for (auto &shard : shards)
+    {
+        if (currentShard != shard.get())
+            continue;
+        auto it = shard->sessions.find(fd);
+        if (it != shard->sessions.end())
+            return ClientRef{fd, it->second.id, shard.get()};
+    }
+    // not on the connection's reactor thread
+    std::lock_guard<std::mutex> lock(ownersMutex);
+    auto it = owners.find(fd);
+    if (it == owners.end())
+        return ClientRef{fd, 0};
+    return ClientRef{fd, it->second.id, it->second.shard};
+}
+
+MemoryReservation ServerCore::reserveMemory(int fd, size_t bytes)
+{
+    std::shared_ptr<ClientMemory> client;
+    {
+        std::lock_guard<std::mutex> lock(ownersMutex);
+        auto it = owners.find(fd);
+        if (it == owners.end())
+            return MemoryReservation();
+        client = it->second.memory;
+    }
+    return memory.reserve(client, bytes);
+}
+
+void ServerCore::supersedeMST(int fd, const std::shared_ptr<CancelToken> &token)
+{
+    std::lock_guard<std::mutex> lock(ownersMutex);
+    auto it = owners.find(fd);
+    if (it == owners.end())
+    {
+        token->cancel(); // the client hung up
+        return;
+    }
+    if (it->second.mst != nullptr)
+        it->second.mst->cancel();
+    it->second.mst = token;
+}
+
+// Whether tree was built from an older version of the graph held's index was built from
+static bool olderTree(const TreeIndex &tree, const std::shared_ptr<const TreeIndex> &held)
+{
+    return held != nullptr && held->source().source == tree.source().source && tree.source().version < held->source().version;
+}
+
+void ServerCore::keepTree(const ClientRef &client, std::shared_ptr<const TreeIndex> tree)
+{
+    MemoryReservation previous; // given back outside the lock
+    std::shared_ptr<ClientMemory> charged;
+    {
+        std::lock_guard<std::mutex> lock(ownersMutex);
+        auto it = owners.find(client.fd);
+        if (it == owners.end() || it->second.id != client.id)
+            return; // the client hung up
+        if (olderTree(*tree, it->second.tree))
+            return; // a flight of an older graph finished after the client's newer one
+        it->second.tree = nullptr;
+        previous = std::move(it->second.treeMemory);
+        charged = it->second.memory;
+    }
+    previous.release(); // the new index replaces the old one
+    MemoryReservation room = memory.reserve(charged, TreeIndex::estimateBytes(tree->numVertices()));
+    if (!room)
+        return; // the queries say there is no MST to query
+    std::lock_guard<std::mutex> lock(ownersMutex);
+    auto it = owners.find(client.fd);
+    if (it == owners.end() || it->second.id != client.id || olderTree(*tree, it->second.tree))
+        return;
+    it->second.tree = std::move(tree);
+    it->second.treeMemory = std::move(room);
+}
+
+void ServerCore::send(const ClientRef &client, std::string data)
+{
+    // the connection's reactor is in the reference, it checks the session is still the client's
+    Shard *shard = static_cast<Shard *>(client.shard);
+    if (shard == nullptr)
+        return; // the client had hung up when it was referenced
+    if (currentShard == shard)
+    {
+        auto it = shard->sessions.find(client.fd);
+        if (it != shard->sessions.end() && it->second.id == client.id)
+            enqueue(*shard, it->second, std::move(data));
+        return;
+    }
+    // the session belongs to another reactor thread
+    shard->reactor.post([this, shard, client, data = std::move(data)]() mutable
+                        {
+                            auto it = shard->sessions.find(client.fd);
+                            if (it != shard->sessions.end() && it->second.id == client.id)
+                                enqueue(*shard, it->second, std::move(data)); });
+}
+
+OutputStats ServerCore::outputStats() const
+{
+    return OutputStats{queuedBytes, peakQueuedBytes, writtenBytes, readPauses};
+}
+
+std::string ServerCore::serverStats()
+{
+    size_t connections;
+    {
+        std::lock_guard<std::mutex> lock(ownersMutex);
+        connections = owners.size();
+    }
+    OutputStats stats = outputStats();
+    std::string report = name + ": " + std::to_string(connections) + " connections on " + std::to_string(shards.size()) + " reactors\n" +
+                         "output: " + std::to_string(stats.queuedBytes) + " bytes queued (peak " + std::to_string(stats.peakQueuedBytes) +
+                         "), " + std::to_string(stats.writtenBytes) + " bytes sent, reads paused " + std::to_string(stats.readPauses) + " times\n" +
+                         "memory: " + std::to_string(memory.used()) + " of " + std::to_string(memory.globalLimit()) + " bytes in use (" +
+                         std::to_string(memory.clientLimit()) + " per client), " + std::to_string(memory.refused()) + " commands refused, " +
+                         std::to_string(memory.fallbacks()) + " stats computed without the distance matrices\n";
+    if (statsReport)
+        report += statsReport();
+    return report;
+}
+
+std::string ServerCore::metricsText()
+{
+    size_t connections;
+    {
+        std::lock_guard<std::mutex> lock(ownersMutex);
+        connections = owners.size();
+    }
+    OutputStats stats = outputStats();
+    std::string out;
+    metrics::appendMetric(out, "mstserver_connections", "gauge", "Open client connections.", static_cast<double>(connections));
+    metrics::appendMetric(out, "mstserver_connections_accepted_total", "counter", "Client connections accepted.",
+                          static_cast<double>(nextClientId.load() - 1));
+    metrics::appendMetric(out, "mstserver_reactors", "gauge", "Reactor threads.", static_cast<double>(shards.size()));
+    metrics::appendMetric(out, "mstserver_output_queued_bytes", "gauge", "Reply bytes waiting in output buffers.",
+                          static_cast<double>(stats.queuedBytes));
+    metrics::appendMetric(out, "mstserver_output_queued_bytes_peak", "gauge", "The most reply bytes that were ever waiting.",
+                          static_cast<double>(stats.peakQueuedBytes));
+    metrics::appendMetric(out, "mstserver_output_written_bytes_total", "counter", "Bytes written to client sockets.",
+                          static_cast<double>(stats.writtenBytes));
+    metrics::appendMetric(out, "mstserver_read_pauses_total", "counter", "Times a slow reader's input was paused.",
+                          static_cast<double>(stats.readPauses));
+    metrics::appendMetric(out, "mstserver_graphs", "gauge", "Client graphs held by the server.", static_cast<double>(graphCount.load()));
+    metrics::appendMetric(out, "mstserver_graph_vertices", "gauge", "Vertices of all the client graphs.", static_cast<double>(graphVertices.load()));
+    metrics::appendMetric(out, "mstserver_graph_edges", "gauge", "Edges of all the client graphs.", static_cast<double>(graphEdges.load()));
+    metrics::appendMetric(out, "mstserver_memory_used_bytes", "gauge", "Bytes of client graphs and reserved for running computations.",
+                          static_cast<double>(memory.used()));
+    metrics::appendFamily(out, "mstserver_memory_limit_bytes", "gauge", "Memory budgets of a client and of all the clients.",
+                          {{"scope=\"client\"", static_cast<double>(memory.clientLimit())}, {"scope=\"global\"", static_cast<double>(memory.globalLimit())}});
+    metrics::appendMetric(out, "mstserver_memory_refusals_total", "counter", "Commands refused because they didn't fit in the memory budget.",
+                          static_cast<double>(memory.refused()));
+    metrics::appendMetric(out, "mstserver_memory_fallbacks_total", "counter", "MST stats computed without the distance matrices to fit in the memory budget.",
+                          static_cast<double>(memory.fallbacks()));
+    out += metrics::processMetrics();
+    if (metricsReport)
+        out += metricsReport();
+    return out;
+}
+
+void ServerCore::handleReceived(Shard &shard, ClientSession &session)
+{
+    bool binary;
+    do
+    { // a protocol switch hands the rest of the buffer to the other protocol
+        binary = session.wire.binary;
+        if (binary)
+            handleBinary(shard, session);
+        else
+            handleLines(shard, session);
+    } while (binary != session.wire.binary && !session.wire.inbuf.empty());
+}
+
+void ServerCore::handleLines(Shard &shard, ClientSession &session)
+{
+    std::string &in = session.wire.inbuf;
+    size_t start = 0, end;
+    if (session.wire.skipLine)
+    { // the rest of a line that was too long
+        start = in.find('\n');
+        if (start == std::string::npos)
+        {
+            in.clear();
+            return;
+        }
+        start++;
+        session.wire.skipLine = false;
+    }
+    while (!session.wire.binary && (end = in.find('\n', start)) != std::string::npos)
+    {
+        std::string line = in.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!session.pending.command.empty())
+        { // the edges of a newgraph, newedges or removeedges
+            if (readEdges(session.pending, line))
+                finishEdges(shard, session);
+        }
+        else
+            handleText(shard, session, line);
+    }
+    in.erase(0, start);
+
+    if (!session.wire.binary && in.size() > binproto::MAX_LINE)
+    { // no command is that long, drop it up to its newline
+        std::string msg = "Client " + std::to_string(session.fd) + " sent a line longer than " + std::to_string(binproto::MAX_LINE) + " bytes, it was dropped\n";
+        std::cout << msg;
+        enqueue(shard, session, std::string(msg.c_str(), msg.size() + 1));
+        in.clear();
+        session.wire.skipLine = true;
+    }
+}
+
+void ServerCore::handleText(Shard &shard, ClientSession &session, std::string &line)
+{
+    TRACE_REQUEST(trace::newRequest()); // every command is a request
+    std::string action = "";
+    std::string actualAction = "";
+    int n = 0, m = 0, weight = 0; // n := number of vertices, m := number of edges, weight := weight of the edge
+    std::string strat = "";       // strategy for the MST (or the path of loadgraph/savegraph)
+
+    parseInput(&line[0], static_cast<int>(line.size()), n, m, weight, strat, action, actualAction, graphActions, mstStrats);
+    std::cout << "Action received: " << action << " from client " << session.fd << std::endl;
+    metrics::countCommand(actualAction, false);
+
+    // the files a client names are under the server's file directory, the refusal goes to the asking client only
+    if (actualAction == "loadgraph" || actualAction == "savegraph" || actualAction == "tracedump")
+    {
+        std::string path, reason;
+        if (!serverPath(options.fileDir, strat, path, reason))
+        {
+            std::string reply = "Client " + std::to_string(session.fd) + " can't use " + strat + ": " + reason + "\n";
+            enqueue(shard, session, std::string(reply.c_str(), reply.size() + 1));
+            return;
+        }
+        strat = path;
+    }
+
+    // the counters go to the asking client only
+    if (actualAction == "serverstats")
+    {
+        std::string report = serverStats();
+        enqueue(shard, session, std::string(report.c_str(), report.size() + 1));
+        return;
+    }
+
+    // write the recorded spans to a file on the server
+    if (actualAction == "tracedump")
+    {
+        std::string reply;
+        if (!trace::enabled)
+            reply = "Tracing is not compiled in (build with make TRACING=1)\n";
+        else
+        {
+            long spans = trace::dumpChromeJson(strat);
+            reply = spans < 0 ? "Failed to write the trace to " + strat + "\n"
+                              : "Wrote " + std::to_string(spans) + " spans to " + strat + "\n";
+        }
+        enqueue(shard, session, std::string(reply.c_str(), reply.size() + 1));
+        return;
+    }
+
+    // questions about the client's last MST go to the asking client only, answered from its index
+    if (actualAction == "path" || actualAction == "dist" || actualAction == "bottleneck")
+    {
+        std::string reply = queryTree(session, actualAction, n, m);
+        enqueue(shard, session, std::string(reply.c_str(), reply.size() + 1));
+        return;
+    }
+    if (actualAction == "mststats")
+    {
+        std::string reply;
+        std::shared_ptr<const TreeIndex> tree = currentTree(session, reply);
+        if (tree != nullptr)
+            reply = "Client " + std::to_string(session.fd) + "'s MST stats: \n" + centralityReport(tree->centrality(), true);
+        enqueue(shard, session, std::string(reply.c_str(), reply.size() + 1));
+        return;
+    }
+    if (actualAction == "querybatch")
+    {
+        std::string refusal = startQueries(n, session.fd, session.pending);
+        if (!refusal.empty())
+            enqueue(shard, session, std::string(refusal.c_str(), refusal.size() + 1));
+        else if (session.pending.edges == 0)
+            answerQueries(shard, session);
+        return;
+    }
+
+    // share the client's graph under a name, or work on a graph another client shared
+    if (actualAction == "creategraph" || actualAction == "usegraph")
+    {
+        std::string msg = switchGraph(session, actualAction == "creategraph", strat);
+        std::cout << msg;
+        broadcast(shard, msg);
+        return;
+    }
+
+    // the graph is replaced or edited once the client sent the edges, in the lines that follow
+    if (actualAction == "newgraph" || actualAction == "newedges" || actualAction == "removeedges")
+    {
+        auto start = [&](const Graph *graph)
+        {
+            return actualAction == "newgraph" ? newGraph(n, m, session.fd, graph, session.pending)
+                                              : editEdges(actualAction, n, session.fd, graph, session.pending);
+        };
+        std::string refusal;
+        if (session.named == nullptr)
+            refusal = start(session.graph);
+        else
+        {
+            std::shared_lock<std::shared_mutex> lock(session.named->lock);
+            refusal = start(session.named->graph);
+        }
+        if (!refusal.empty())
+            broadcast(shard, refusal);
+        else if (session.pending.edges == 0)
+            finishEdges(shard, session);
+        return;
+    }
+
+    // handling the input:
+    std::pair<std::string, Graph *> result;
+    auto run = [&](Graph *&graph)
+    {
+        result = handleInput(graph, action, session.fd, actualAction, n, m, weight, strat);
+        if (result.second != nullptr)
+        { // if the result is not null, store it as this client's graph
+            graph = result.second;
+        }
+    };
+    if (session.named == nullptr)
+    {
+        run(session.graph);
+        accountGraph(session);
+    }
+    else if (find(graphWriters.begin(), graphWriters.end(), actualAction) != graphWriters.end())
+    { // a named graph is changed by one client at a time
+        std::unique_lock<std::shared_mutex> lock(session.named->lock);
+        run(session.named->graph);
+        accountNamed(*session.named);
+    }
+    else
+    { // and read by many at once (mst takes its snapshot under the lock)
+        std::shared_lock<std::shared_mutex> lock(session.named->lock);
+        run(session.named->graph);
+    }
+
+    // print the message to the server
+    if (actualAction == "message")
+    {
+        std::cout << result.first << std::endl;
+        return;
+    }
+
+    // switch the connection to the binary protocol, the acknowledgement is the last text message
+    if (actualAction == "binary")
+    {
+        std::cout << result.first;
+        binproto::sendText(session.fd, "OK binary\n", false);
+        session.wire.binary = true;
+        return;
+    }
+
+    // if the actualAction is in the graphActions, then send the result to all the clients
+    if (find(graphActions.begin(), graphActions.end(), actualAction) != graphActions.end())
+        broadcast(shard, result.first);
+}
+
+void ServerCore::handleBinary(Shard &shard, ClientSession &session)
+{
+    std::vector<std::string> notifications;
+    if (session.named == nullptr)
+    {
+        notifications = binproto::handleFrames(session.wire, session.graph, session.fd, mstStrats);
+        accountGraph(session);
+    }
+    else
+    { // the frames of one read may change the graph, they hold its lock exclusively
+        std::unique_lock<std::shared_mutex> lock(session.named->lock);
+        notifications = binproto::handleFrames(session.wire, session.named->graph, session.fd, mstStrats);
+        accountNamed(*session.named);
+    }
+    for (const std::string &note : notifications)
+    {
+        std::cout << note;
+        broadcast(shard, note);
+    }
+}
+
+void ServerCore::finishEdges(Shard &shard, ClientSession &session)
+{
+    if (session.pending.command == "querybatch")
+    { // the pairs are answered to the client, the graph stays as it is
+        answerQueries(shard, session);
+        return;
+    }
+    std::pair<std::string, Graph *> result;
+    if (session.named == nullptr)
+    {
+        result = ::finishEdges(session.pending, session.fd, session.graph);
+        session.graph = result.second;
+        accountGraph(session);
+    }
+    else
+    {
+        std::unique_lock<std::shared_mutex> lock(session.named->lock);
+        result = ::finishEdges(session.pending, session.fd, session.named->graph);
+        session.named->graph = result.second;
+        accountNamed(*session.named);
+    }
+    broadcast(shard, result.first);
+}
+
+void ServerCore::answerQueries(Shard &shard, ClientSession &session)
+{
+    std::vector<size_t> pairs = std::move(session.pending.numbers);
+    MemoryReservation room = std::move(session.pending.room);
+    session.pending.numbers.clear();
+    session.pending.command.clear();
+    session.pending.edges = 0;
+
+    std::string client = "Client " + std::to_string(session.fd);
+    std::string refusal;
+    std::shared_ptr<const TreeIndex> tree = currentTree(session, refusal);
+    // the workspace and the answers, and the reply's text: a line of at most 64 bytes per pair
+    static constexpr size_t LINE_BYTES = 64;
+    MemoryReservation workspace;
+    if (tree != nullptr)
+    {
+        workspace = reserveMemory(session.fd, TreeIndex::batchBytes(tree->numVertices(), pairs.size() / 2) + pairs.size() / 2 * LINE_BYTES);
+        if (!workspace)
+            refusal = client + "'s " + std::to_string(pairs.size() / 2) + " queries don't fit in its memory budget\n";
+    }
+    if (!refusal.empty())
+    {
+        enqueue(shard, session, std::string(refusal.c_str(), refusal.size() + 1));
+        return;
+    }
+
+    for (size_t &x : pairs)
+        x--; // 0 wraps around, past the last vertex
+    std::vector<TreeIndex::BatchAnswer> answers = tree->answerBatch(pairs);
+
+    // the answers go out in chunks as they are written, in the order of the pairs: each chunk is flushed at once,
+    // the replies to the rest of the read wait for the end of it (batching)
+    static constexpr size_t CHUNK = 64 << 10;
+    std::string chunk = client + "'s answers to " + std::to_string(answers.size()) +
+                        " queries, one per line: u v distance heaviest-edge weight\n";
+    for (size_t q = 0; q < answers.size(); q++)
+    {
+        size_t u = pairs[2 * q], v = pairs[2 * q + 1];
+        chunk += std::to_string(u + 1) + " " + std::to_string(v + 1);
+        if (u >= tree->numVertices() || v >= tree->numVertices())
+            chunk += " invalid vertices\n";
+        else if (!tree->connected(u, v))
+            chunk += " no path\n";
+        else if (answers[q].heaviest == TreeIndex::NO_EDGE)
+            chunk += " 0 none 0\n";
+        else
+        {
+            TreeIndex::TreeEdge edge = tree->edgeAbove(answers[q].heaviest);
+            chunk += " " + std::to_string(answers[q].distance) + " " + std::to_string(edge.from + 1) + "-" +
+                     std::to_string(edge.to + 1) + " " + std::to_string(edge.weight) + "\n";
+        }
+        if (chunk.size() >= CHUNK)
+        {
+            enqueue(shard, session, std::move(chunk));
+            flush(shard, session);
+            chunk.clear();
+        }
+    }
+    chunk.push_back('\0');
+    enqueue(shard, session, std::move(chunk));
+}
+
+void ServerCore::disconnect(Shard &shard, int fd)
+{
+    shard.reactor.remove(fd);
+    {
+        std::lock_guard<std::mutex> lock(ownersMutex); // before close(), the fd number can be reused right after it
+        auto owner = owners.find(fd);
+        if (owner != owners.end() && owner->second.mst != nullptr)
+            owner->second.mst->cancel(); // nobody is waiting for the result anymore
+        owners.erase(fd);
+    }
+    if (onDisconnect)
+        onDisconnect(fd);
+    close(fd); // close the connection
+    auto it = shard.sessions.find(fd);
+    if (it != shard.sessions.end())
+    {
+        if (it->second.graph != nullptr) // if the client has a graph, delete it
+        {
+            delete it->second.graph;
+            it->second.graph = nullptr;
+        }
+        accountGraph(it->second);
+        leaveNamed(it->second);
+        queuedBytes -= it->second.out.size();
+        shard.sessions.erase(it); // remove the client from the dictionary
+    }
+}
+
+void ServerCore::broadcast(Shard &from, const std::string &msg)
+{
+    for (auto &shard : shards)
+    {
+        if (shard.get() == &from)
+        {
+            broadcastLocal(from, msg);
+            continue;
+        }
+        Shard *s = shard.get(); // the other reactors own their sessions, let them send
+        s->reactor.post([this, s, msg]()
+                        { broadcastLocal(*s, msg); });
+    }
+}
+
+void ServerCore::broadcastLocal(Shard &shard, const std::string &msg)
+{
+    for (auto &session : shard.sessions) // text clients get the null terminator, binary clients a frame
+        binproto::sendText(session.first, msg, session.second.wire.binary);
+}
+
+void ServerCore::accountGraph(ClientSession &session)
+{
+    account(session.graph, session.graphCounted, session.graphVertices, session.graphEdges, session.memory.get());
+}
+
+void ServerCore::accountNamed(NamedGraph &named)
+{
+    account(named.graph, named.graphCounted, named.graphVertices, named.graphEdges, &named.memory);
+}
+
+void ServerCore::account(const Graph *graph, bool &counted, size_t &vertices, size_t &edges, ClientMemory *charged)
+{
+    bool exists = graph != nullptr;
+    size_t n = exists ? graph->numVertices() : 0;
+    size_t m = exists ? graph->numEdges() : 0;
+    if (exists != counted)
+    {
+        if (exists)
+            graphCount++;
+        else
+            graphCount--;
+    }
+    graphVertices += n - vertices; // modular arithmetic, only the difference matters
+    graphEdges += m - edges;
+    counted = exists;
+    vertices = n;
+    edges = m;
+    if (charged != nullptr)
+        memory.setGraphBytes(*charged, exists ? graph->memoryBytes() : 0);
+}
+
+std::string ServerCore::switchGraph(ClientSession &session, bool create, const std::string &name)
+{
+    std::string client = "Client " + std::to_string(session.fd);
+    std::shared_ptr<NamedGraph> named;
+    std::string msg;
+    if (create)
+    { // the client's own graph is moved into the named graph, not copied
+        named = namedGraphs.create(name, session.graph);
+        if (named == nullptr)
+            return client + " tried to create the graph " + name + " but the name is taken\n";
+        msg = client + (session.graph != nullptr ? " shared its graph as " : " created the empty graph ") + name + "\n";
+        session.graph = nullptr;
+        accountGraph(session);
+        std::unique_lock<std::shared_mutex> lock(named->lock);
+        accountNamed(*named);
+    }
+    else
+    { // the client's own graph is replaced by the named graph
+        named = namedGraphs.use(name);
+        if (named == nullptr)
+            return client + " tried to use the graph " + name + " but there is no graph with that name\n";
+        if (session.graph != nullptr)
+        {
+            delete session.graph;
+            session.graph = nullptr;
+            accountGraph(session);
+        }
+        msg = client + " is using the graph " + name + " with " + std::to_string(namedGraphs.users(*named) - 1) + " other clients\n";
+    }
+    leaveNamed(session); // after joining the new one: using the same graph again doesn't free it
+    session.named = named;
+    return msg;
+}
+
+std::shared_ptr<const TreeIndex> ServerCore::currentTree(ClientSession &session, std::string &refusal)
+{
+    std::string client = "Client " + std::to_string(session.fd);
+    std::shared_ptr<const TreeIndex> tree;
+    {
+        std::lock_guard<std::mutex> lock(ownersMutex);
+        auto it = owners.find(session.fd);
+        if (it != owners.end())
+            tree = it->second.tree;
+    }
+    if (tree == nullptr)
+    {
+        refusal = client + " has no MST to query, send mst first\n";
+        return nullptr;
+    }
+
+    // the answers are about the graph the MST was computed from
+    bool current;
+    if (session.named == nullptr)
+        current = session.graph != nullptr && session.graph->identity() == tree->source();
+    else
+    {
+        std::shared_lock<std::shared_mutex> lock(session.named->lock);
+        current = session.named->graph != nullptr && session.named->graph->identity() == tree->source();
+    }
+    if (!current)
+    {
+        refusal = client + "'s graph changed since its last mst, send mst again\n";
+        return nullptr;
+    }
+    return tree;
+}
+
+std::string ServerCore::queryTree(ClientSession &session, const std::string &query, int u, int v)
+{
+    std::string refusal;
+    std::shared_ptr<const TreeIndex> tree = currentTree(session, refusal);
+    if (tree == nullptr)
+        return refusal;
+
+    if (u < 1 || v < 1 || static_cast<size_t>(u) > tree->numVertices() || static_cast<size_t>(v) > tree->numVertices())
+        return "Invalid vertices\n";
+    size_t a = static_cast<size_t>(u - 1), b = static_cast<size_t>(v - 1);
+    std::string ends = std::to_string(u) + " and " + std::to_string(v);
+    if (!tree->connected(a, b))
+        return "No path exists between " + ends + "\n";
+
+    if (query == "dist")
+        return "The distance between " + ends + " on the MST is " + std::to_string(tree->distance(a, b)) + "\n";
+    if (query == "bottleneck")
+    {
+        TreeIndex::TreeEdge edge;
+        if (!tree->bottleneck(a, b, edge))
+            return "The MST path between " + ends + " has no edges\n";
+        return "The heaviest edge on the MST path between " + ends + " is " + std::to_string(edge.from + 1) + " - " +
+               std::to_string(edge.to + 1) + " with a weight of " + std::to_string(edge.weight) + "\n";
+    }
+    std::string reply = "The MST path between " + ends + " is: ";
+    for (size_t x : tree->path(a, b))
+        reply += std::to_string(x + 1) + " -> ";
+    reply.resize(reply.size() - 4); // Remove the last arrow
+    return reply + " with a distance of " + std::to_string(tree->distance(a, b)) + "\n";
+}
+
+void ServerCore::leaveNamed(ClientSession &session)
+{
+    std::shared_ptr<NamedGraph> named = std::move(session.named);
+    session.named = nullptr;
+    if (named == nullptr || !namedGraphs.leave(named))
+        return;
+    std::unique_lock<std::shared_mutex> lock(named->lock); // nobody else can take it anymore
+    delete named->graph;
+    named->graph = nullptr;
+    accountNamed(*named);
+}
+
+void ServerCore::acceptScrapers(Shard &shard)
+{
+    while (true) // edge-triggered: accept until the backlog is empty
+    {
+        int fd = accept4(shard.metricsListener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept metrics");
+            return;
+        }
+        shard.scrapes[fd];
+        Shard *s = &shard;
+        shard.reactor.add(fd, EPOLLIN, [this, s, fd](uint32_t)
+                          { handleScrape(*s, fd); });
+    }
+}
+
+void ServerCore::handleScrape(Shard &shard, int fd)
+{
+    auto it = shard.scrapes.find(fd);
+    if (it == shard.scrapes.end())
+        return;
+    Scrape &scrape = it->second;
+    if (!scrape.responded)
+    {
+        char buf[1024];
+        while (scrape.request.find("\r\n\r\n") == std::string::npos)
+        {
+            ssize_t nbytes = recv(fd, buf, sizeof buf, 0);
+            if (nbytes < 0 && errno == EINTR)
+                continue;
+            if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return; // the rest of the headers is still on its way
+            if (nbytes <= 0 || scrape.request.size() > 8192)
+            {
+                closeScrape(shard, fd);
+                return;
+            }
+            scrape.request.append(buf, static_cast<size_t>(nbytes));
+        }
+
+        std::string requestLine = scrape.request.substr(0, scrape.request.find("\r\n"));
+        std::string status = "200 OK", body;
+        if (requestLine.compare(0, 13, "GET /metrics ") == 0 || requestLine.compare(0, 13, "GET /metrics?") == 0)
+            body = metricsText();
+        else
+        {
+            status = "404 Not Found";
+            body = "Only GET /metrics is served here\n";
+        }
+        scrape.out.append("HTTP/1.1 " + status + "\r\n"
+                          "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                          "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n");
+        scrape.out.append(std::move(body));
+        scrape.responded = true;
+        shard.reactor.modify(fd, EPOLLOUT);
+    }
+
+    size_t written = 0;
+    if (!scrape.out.flush(fd, written) || scrape.out.empty())
+        closeScrape(shard, fd); // sent, or the scraper went away
+}
+
+void ServerCore::closeScrape(Shard &shard, int fd)
+{
+    shard.reactor.remove(fd);
+    close(fd);
+    shard.scrapes.erase(fd);
+}
@@ -0,0 +1,217 @@
+#ifndef SERVER_CORE_HPP
+#define SERVER_CORE_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "serverUtils.hpp"
+#include "outputBuffer.hpp"
+#include "memoryBudget.hpp"
+#include "graphRegistry.hpp"
+#include "../Reactor/Reactor.hpp"
+
+// State of one client connection, owned by the reactor thread that accepted it
+struct ClientSession
+{
+    int fd;
+    uint64_t id;                // see ClientRef
+    Graph *graph = nullptr;     // the client's own graph
+    std::shared_ptr<NamedGraph> named; // the shared graph the client works on instead, if it joined one
+    binproto::WireState wire;   // text/binary protocol state and the bytes read but not handled yet
+    PendingEdges pending;       // a newgraph, newedges, removeedges or querybatch reading the next lines
+    OutputBuffer out;           // replies waiting for the socket
+    bool readsPaused = false;   // the output buffer is above the high-water mark
+    uint32_t events = EPOLLIN;  // events the connection is registered for
+    bool graphCounted = false;  // the graph as counted in the server's graph gauges
+    size_t graphVertices = 0;
+    size_t graphEdges = 0;
+    std::shared_ptr<ClientMemory> memory; // the client's share of the memory budget
+};
+
+// Command line options shared by the servers
+struct ServerOptions
+{
+    size_t reactors = 1;               // event loop threads, each with its own listener (-r)
+    size_t highWaterMark = 4u << 20;   // bytes queued for a client before its reads are paused (-w), resumed at half
+    std::string metricsPort;           // port of the Prometheus /metrics listener (-m), none if empty
+    size_t clientMemory = 512u << 20;  // bytes of graphs and computations a client may hold (-b)
+    size_t globalMemory = 2048u << 20; // and all the clients together (-B)
+    std::string fileDir;               // directory of the files clients name (-d), none if empty: they are refused
+};
+
+// Parse the server's command line, prints the usage and exits on an invalid option
+ServerOptions parseServerOptions(int argc, char *argv[]);
+
+// Output buffer counters of all the connections
+struct OutputStats
+{
+    size_t queuedBytes;     // bytes waiting in output buffers
+    size_t peakQueuedBytes; // the most that was ever waiting
+    uint64_t writtenBytes;  // bytes written to the sockets
+    uint64_t readPauses;    // times a slow reader's input was paused
+};
+
+// Block SIGINT in the calling thread and the threads it starts from then on. Called first in main: ServerCore::run
+// takes SIGINT back on reactor 0's thread once its reactors exist, so a handler calling stop() never runs elsewhere.
+void blockInterrupt();
+
+/**
+ * The connection handling shared by the LF and the PAO servers:
+ * accepts clients, reads and parses their commands on epoll reactors and broadcasts the results.
+ * Text commands are newline terminated lines cut from a per-connection buffer, so a client can pipeline any number
+ * of them in one write: all the complete lines of a read are handled in one wakeup, and the replies they queue are
+ * written together when the read is done.
+ * With N reactors every reactor thread has its own SO_REUSEPORT listener and owns the connections
+ * (and graphs) it accepted, so accepting and parsing scale with the cores; broadcasts are posted to the other reactors.
+ * Nothing is sent with a blocking call: replies and broadcasts are queued on the connection's output buffer
+ * and written by its reactor on EPOLLOUT. A client that doesn't read its replies has its reads paused above
+ * the high-water mark, so it can only slow itself down.
+ * Every client's graph and running computations are charged to a MemoryBudget, the commands that would allocate
+ * more than the budget allows are refused (see reserveMemory).
+ * A client's mst computation is cancelled when it hangs up or sends a newer mst request (see supersedeMST).
+ * The index of its latest MST is kept for its path, dist and bottleneck queries until the graph changes.
+ * A client works on its own graph or on a named graph shared with other clients (creategraph/usegraph), the commands
+ * on a named graph hold its reader/writer lock.
+ * With a metrics port, reactor 0 also serves the Prometheus text format on GET /metrics over plain HTTP/1.1,
+ * one response per connection.
+ * The servers differ only in how they compute the MST (the extern MST function).
+ */
+class ServerCore
+{
+public:
+    ServerCore(const std::string &name, const std::string &welcomeMsg, const ServerOptions &options = ServerOptions());
+    ~ServerCore();
+
+    // Called on the client's reactor thread after it hung up, before its session is freed
+    std::function<void(int fd)> onDisconnect;
+
+    // Lines appended to the serverstats reply (the server's pool or pipeline), called on a reactor thread
+    std::function<std::string()> statsReport;
+
+    // Prometheus samples appended to /metrics (the server's pool or pipeline), called on reactor 0
+    std::function<std::string()> metricsReport;
+
+    // Listen on PORT and dispatch events until stop() is called, reactor 0 runs on the calling thread and takes SIGINT
+    // (see blockInterrupt). Returns 1 if listening failed.
+    int run();
+
+    // Make run() return, can be called from any thread and from a SIGINT handler once run() took SIGINT
+    void stop();
+
+    // Stop the reactors and wait for their threads, then free all the graphs and close all the connections.
+    // Called on the main thread after run() returned.
+    void closeAll();
+
+    // The connection currently using fd
+    ClientRef clientRef(int fd);
+
+    // Reserve bytes on the budget of the client using fd, empty if they don't fit or the client hung up
+    MemoryReservation reserveMemory(int fd, size_t bytes);
+
+    MemoryBudget &memoryBudget() { return memory; }
+
+    // Make token the one of the latest mst request of the client using fd, its previous request is cancelled
+    void supersedeMST(int fd, const std::shared_ptr<CancelToken> &token);
+
+    // Keep the index of a client's latest MST for its queries, see ::keepTree
+    void keepTree(const ClientRef &client, std::shared_ptr<const TreeIndex> tree);
+
+    // Queue data for a client, from any thread
+    void send(const ClientRef &client, std::string data);
+
+    OutputStats outputStats() const;
+
+    // The reply to serverstats: connections, output buffers, memory, then statsReport
+    std::string serverStats();
+
+    // The /metrics page: connections, output buffers, graphs, memory, the process wide counters, then metricsReport
+    std::string metricsText();
+
+private:
+    // An HTTP exchange on the metrics port: the request is read, then the response is written and the connection closed
+    struct Scrape
+    {
+        std::string request;
+        OutputBuffer out;
+        bool responded = false;
+    };
+
+    // One event loop thread and the connections it owns
+    struct Shard
+    {
+        size_t id;
+        Reactor reactor;
+        int listener = -1;
+        std::unordered_map<int, ClientSession> sessions; // client fd -> session
+        std::thread thread;                              // not used by reactor 0
+        int metricsListener = -1;                        // reactor 0 only
+        std::unordered_map<int, Scrape> scrapes;         // metrics connection fd -> its exchange
+        bool batching = false;                           // replies are queued, not written, until the read is handled
+        std::vector<int> unflushed;                      // the connections that got replies during the batch
+    };
+
+    // The reactor that owns a connection
+    struct Owner
+    {
+        Shard *shard;
+        uint64_t id;
+        std::shared_ptr<ClientMemory> memory;
+        std::shared_ptr<CancelToken> mst; // the client's latest mst request, cancelled when it hangs up
+        std::shared_ptr<const TreeIndex> tree; // the index of the client's latest MST (shared with coalesced requests)
+        MemoryReservation treeMemory;          // the index's bytes on the client's budget
+    };
+
+    void acceptClients(Shard &shard);
+    void handleEvents(Shard &shard, int fd, uint32_t events);
+    void readClient(Shard &shard, int fd);
+    void enqueue(Shard &shard, ClientSession &session, std::string data);
+    void flush(Shard &shard, ClientSession &session);
+    void updateEvents(Shard &shard, ClientSession &session);
+    void flushBatch(Shard &shard);
+    void handleReceived(Shard &shard, ClientSession &session); // the buffered input, in the connection's protocol
+    void handleLines(Shard &shard, ClientSession &session);
+    void handleText(Shard &shard, ClientSession &session, std::string &line);
+    void handleBinary(Shard &shard, ClientSession &session);
+    void finishEdges(Shard &shard, ClientSession &session); // the pending command has all its edges
+    void answerQueries(Shard &shard, ClientSession &session); // a querybatch has all its pairs
+    void disconnect(Shard &shard, int fd);
+    void accountGraph(ClientSession &session); // bring the graph gauges and the client's memory up to date with its graph
+    void accountNamed(NamedGraph &named);      // the same for a named graph, its lock is held
+    void account(const Graph *graph, bool &counted, size_t &vertices, size_t &edges, ClientMemory *charged);
+    std::string switchGraph(ClientSession &session, bool create, const std::string &name); // creategraph/usegraph
+    std::string queryTree(ClientSession &session, const std::string &query, int u, int v); // path/dist/bottleneck
+    std::shared_ptr<const TreeIndex> currentTree(ClientSession &session, std::string &refusal); // the index to query
+    void leaveNamed(ClientSession &session); // the last client to leave a named graph frees it
+    void acceptScrapers(Shard &shard);
+    void handleScrape(Shard &shard, int fd);
+    void closeScrape(Shard &shard, int fd);
+    void broadcast(Shard &from, const std::string &msg);
+    void broadcastLocal(Shard &shard, const std::string &msg);
+
+    std::string name;       // server name used in the logs
+    std::string welcomeMsg; // sent to every new client
+    ServerOptions options;
+    std::vector<std::unique_ptr<Shard>> shards;
+    MemoryBudget memory;
+    GraphRegistry namedGraphs;
+    std::mutex ownersMutex;                   // protects owners
+    std::unordered_map<int, Owner> owners;    // client fd -> the reactor owning it
+    std::atomic<uint64_t> nextClientId{1};
+    std::atomic<size_t> queuedBytes{0};
+    std::atomic<size_t> peakQueuedBytes{0};
+    std::atomic<uint64_t> writtenBytes{0};
+    std::atomic<uint64_t> readPauses{0};
+    std::atomic<size_t> graphCount{0};    // the gauges are only written by the reactors owning the sessions
+    std::atomic<size_t> graphVertices{0};
+    std::atomic<size_t> graphEdges{0};
+    const std::vector<std::string> graphActions = {"newgraph", "newedge", "removeedge", "newedges", "removeedges", "mst", "loadgraph", "savegraph", "creategraph", "usegraph"};
+    const std::vector<std::string> graphWriters = {"newgraph", "newedge", "removeedge", "newedges", "removeedges", "loadgraph"}; // take a named graph's lock exclusively
+    const std::vector<std::string> mstStrats = {"prim", "kruskal", "tarjan", "boruvka"};
+};
+
+#endif // SERVER_CORE_HPP
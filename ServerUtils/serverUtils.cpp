@@ -1,7 +1,18 @@
 #include "serverUtils.hpp"
+#include <cerrno>
+#include <climits>
+#include "../Trace/Trace.hpp"
 
 extern LFP lfp; // Leader-Follower pattern instance
 
+// The int of a token of digits, -1 when it doesn't fit in an int (stoi would throw out of the reactor and abort the server)
+static int toInt(const std::string &token)
+{
+    errno = 0;
+    long value = strtol(token.c_str(), nullptr, 10);
+    return errno == ERANGE || value > INT_MAX ? -1 : static_cast<int>(value);
+}
+
 // Function to convert a string to lowercase
 std::string toLowerCase(std::string s)
 {
@@ -26,25 +37,6 @@ bool isNumber(const std::vector<std::string> &s)
     return true;
 }
 
-void initGraph(Graph *g, int m, int clientFd)
-{
-    std::string msg = "To create an edge u->v with weight w please enter the edge number in the format: u v w \n";
-    if (send(clientFd, msg.c_str(), msg.size(), 0) < 0)
-    {
-        perror("send");
-    }
-    int stdin_save = dup(STDIN_FILENO); // Save the current state of STDIN
-    dup2(clientFd, STDIN_FILENO);       // Redirect STDIN to the socket
-    for (int i = 0; i < m; i++)
-    { // Read the edges
-        size_t u, v, weight;
-        std::cin >> u >> v >> weight;
-        Edge e = Edge(g->getVertex(u - 1), g->getVertex(v - 1), weight);
-        g->addEdge(e); // Add edge from u to v
-    }
-    dup2(stdin_save, STDIN_FILENO); // Restore the original STDIN
-}
-
 std::vector<std::string> splitStringBySpaces(const std::string &input)
 {
     std::istringstream stream(input);
@@ -61,6 +53,7 @@ std::vector<std::string> splitStringBySpaces(const std::string &input)
 
 void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string &strat, std::string &action, std::string &actualAction, const std::vector<std::string> &graphActions, const std::vector<std::string> &mstStrats)
 {
+    TRACE_SPAN("parseInput");
 
     buf[nbytes] = '\0';
     action = toLowerCase(std::string(buf));
@@ -74,7 +67,28 @@ void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string
     {
         actualAction = "emptyMessage";
     }
-    if (find(graphActions.begin(), graphActions.end(), actualAction) == graphActions.end())
+    if ((actualAction == "binary" || actualAction == "serverstats" || actualAction == "mststats") && tokens.size() == 1)
+    {
+        // the client asks to switch the connection to the binary protocol, for the server's counters or for its MST's
+        // centrality stats
+    }
+    else if (actualAction == "tracedump" && tokens.size() == 2)
+    { // format: tracedump name (under the server's file directory), the name is taken from the raw buffer to keep its case
+        strat = splitStringBySpaces(std::string(buf))[1];
+    }
+    else if ((actualAction == "path" || actualAction == "dist" || actualAction == "bottleneck") && tokens.size() == 3 && isNumber(tokens))
+    { // format: path u v / dist u v / bottleneck u v, a question about the client's last MST (-1 is an invalid vertex)
+        n = toInt(tokens[1]);
+        m = toInt(tokens[2]);
+        weight = -1;
+    }
+    else if (actualAction == "querybatch" && tokens.size() == 2 && isNumber(tokens))
+    { // format: querybatch k, the k pairs "u v" follow on the next lines (startQueries refuses k = -1)
+        n = toInt(tokens[1]);
+        m = -1;
+        weight = -1;
+    }
+    else if (find(graphActions.begin(), graphActions.end(), actualAction) == graphActions.end())
     {
         actualAction = "message";
     }
@@ -100,6 +114,21 @@ void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string
             actualAction = "message";
         }
     }
+    else if (actualAction == "loadgraph" || actualAction == "savegraph" || actualAction == "creategraph" || actualAction == "usegraph")
+    { // format: loadgraph path / savegraph path / creategraph name / usegraph name, the path or the name is taken from the raw buffer to keep its case
+        std::vector<std::string> rawTokens = splitStringBySpaces(std::string(buf));
+        if (rawTokens.size() != 2)
+        {
+            actualAction = "message";
+        }
+        else
+        {
+            n = -1;
+            m = -1;
+            weight = -1;
+            strat = rawTokens[1]; // the file path or the graph's name
+        }
+    }
     else if (!isNumber(tokens))
     {
         actualAction = "message";
@@ -113,9 +142,11 @@ void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string
         }
         else
         {
-            n = stoi(tokens[1]);
-            m = stoi(tokens[2]);
+            n = toInt(tokens[1]);
+            m = toInt(tokens[2]);
             weight = -1;
+            if (n < 0 || m < 0)
+                actualAction = "message";
         }
     }
     else if (actualAction == "newedge")
@@ -126,9 +157,26 @@ void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string
         }
         else
         {
-            n = stoi(tokens[1]);
-            m = stoi(tokens[2]);
-            weight = stoi(tokens[3]);
+            n = toInt(tokens[1]);
+            m = toInt(tokens[2]);
+            weight = toInt(tokens[3]);
+            if (n < 0 || m < 0 || weight < 0)
+                actualAction = "message";
+        }
+    }
+    else if (actualAction == "newedges" || actualAction == "removeedges")
+    { // format: newedges k / removeedges k, the k edges follow on the next lines
+        if (tokens.size() != 2)
+        {
+            actualAction = "message";
+        }
+        else
+        {
+            n = toInt(tokens[1]);
+            m = -1;
+            weight = -1;
+            if (n < 0)
+                actualAction = "message";
         }
     }
     else if (actualAction == "removeedge") // removeedge
@@ -139,9 +187,11 @@ void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string
         }
         else
         {
-            n = stoi(tokens[1]);
-            m = stoi(tokens[2]);
+            n = toInt(tokens[1]);
+            m = toInt(tokens[2]);
             weight = -1;
+            if (n < 0 || m < 0)
+                actualAction = "message";
         }
     }
 }
@@ -156,31 +206,217 @@ std::unordered_set<Vertex> initVertices(int n)
     return vertices;
 }
 
-std::pair<std::string, Graph *> newGraph(int n, int m, int clientFd, Graph *g)
+std::string newGraph(int n, int m, int clientFd, const Graph *g, PendingEdges &pending)
 {
     std::cout << "Creating a new graph with " << n << " vertices and " << m << " edges" << std::endl;
 
-    if (g != nullptr)
-        delete g;
-    std::unordered_set<Vertex> vertices = initVertices(n); // Initialize the vertices
+    // the old graph is freed, its bytes count towards the new one
+    size_t needed = Graph::estimateBytes(static_cast<size_t>(n), static_cast<size_t>(m));
+    size_t old = g != nullptr ? g->memoryBytes() : 0;
+    MemoryReservation room = reserveMemory(clientFd, needed > old ? needed - old : 0);
+    if (!room)
+        return "Client " + std::to_string(clientFd) + " tried to create a Graph with " + std::to_string(n) + " vertices and " + std::to_string(m) + " edges but it doesn't fit in its memory budget\n";
+
+    pending.command = "newgraph";
+    pending.graph.reset(new Graph(static_cast<size_t>(n))); // Create a new graph of n vertices
+    pending.edges = static_cast<size_t>(m);
+    pending.fields = 3;
+    pending.numbers.clear();
+    pending.room = std::move(room);
+    std::string msg = "To create an edge u->v with weight w please enter the edge number in the format: u v w \n";
+    queueSend(clientFd, msg);
+    return "";
+}
 
-    g = new Graph(vertices);   // Create a new graph of n vertices
-    initGraph(g, m, clientFd); // Initialize the graph with m edges
+std::string editEdges(const std::string &command, int k, int clientFd, const Graph *g, PendingEdges &pending)
+{
+    std::string client = "Client " + std::to_string(clientFd);
+    if (g == nullptr)
+        return client + " tried to perform the operation but there is no graph\n";
+    bool adding = command == "newedges";
+    MemoryReservation room;
+    if (adding)
+    {
+        room = reserveMemory(clientFd, edgeGrowthBytes(*g, static_cast<size_t>(k)));
+        if (!room)
+            return client + " tried to add " + std::to_string(k) + " edges but they don't fit in its memory budget\n";
+    }
 
-    std::string msg = "Client " + std::to_string(clientFd) + " successfully created a new Graph with " + std::to_string(n) + " vertices and " + std::to_string(m) + " edges" + "\n";
-    std::cout << "Graph created successfully\n";
-    return {msg, g};
+    pending.command = command;
+    pending.edges = static_cast<size_t>(k);
+    pending.fields = adding ? 3 : 2;
+    pending.numbers.clear();
+    pending.numbers.reserve(pending.fields * pending.edges);
+    pending.room = std::move(room);
+    std::string msg = adding ? "To add an edge u->v with weight w please enter it in the format: u v w \n"
+                             : "To remove the edge u->v please enter it in the format: u v \n";
+    queueSend(clientFd, msg);
+    return "";
+}
+
+std::string startQueries(int k, int clientFd, PendingEdges &pending)
+{
+    if (k < 0)
+        return "Client " + std::to_string(clientFd) + " sent an invalid command: querybatch takes at most " + std::to_string(INT_MAX) + " pairs\n";
+    MemoryReservation room = reserveMemory(clientFd, 2 * sizeof(size_t) * static_cast<size_t>(k));
+    if (!room)
+        return "Client " + std::to_string(clientFd) + " tried to send " + std::to_string(k) + " queries but they don't fit in its memory budget\n";
+
+    pending.command = "querybatch";
+    pending.edges = static_cast<size_t>(k);
+    pending.fields = 2;
+    pending.numbers.clear();
+    pending.numbers.reserve(pending.fields * pending.edges);
+    pending.room = std::move(room);
+    queueSend(clientFd, "To ask about the MST path between u and v please enter it in the format: u v \n");
+    return "";
+}
+
+bool readEdges(PendingEdges &pending, const std::string &line)
+{
+    // the numbers of an edge are separated by white spaces, an edge may be split over several lines
+    size_t needed = pending.fields * pending.edges;
+    for (const std::string &token : splitStringBySpaces(line))
+    {
+        if (pending.numbers.size() >= needed)
+            break;
+        // a number too big for size_t is as invalid as a non-digit (stoul would throw out of the reactor)
+        bool digits = std::all_of(token.begin(), token.end(), ::isdigit);
+        errno = 0;
+        unsigned long long number = digits ? strtoull(token.c_str(), nullptr, 10) : 0;
+        if (!digits || errno == ERANGE || number > SIZE_MAX)
+        {
+            std::cout << "Invalid edge token: " << token << std::endl;
+            pending.numbers.resize(pending.numbers.size() - pending.numbers.size() % pending.fields); // stop reading, keep the complete edges
+            return true;
+        }
+        pending.numbers.push_back(static_cast<size_t>(number));
+    }
+    return pending.numbers.size() >= needed;
+}
+
+std::pair<std::string, Graph *> finishEdges(PendingEdges &pending, int clientFd, Graph *g)
+{
+    std::string command = std::move(pending.command);
+    pending.command.clear();
+    Graph *graph = command == "newgraph" ? pending.graph.release() : g;
+    std::vector<Edge> batch;
+    batch.reserve(pending.numbers.size() / pending.fields);
+    for (size_t i = 0; i + pending.fields - 1 < pending.numbers.size(); i += pending.fields)
+    {
+        size_t u = pending.numbers[i], v = pending.numbers[i + 1], weight = pending.fields == 3 ? pending.numbers[i + 2] : 0;
+        if (u < 1 || v < 1 || u > graph->numVertices() || v > graph->numVertices())
+        {
+            std::cout << "Skipping edge with invalid vertices: " << u << " " << v << std::endl;
+            continue;
+        }
+        batch.push_back(Edge(Vertex(u - 1), Vertex(v - 1), weight));
+    }
+    pending.numbers.clear();
+    pending.room.release(); // the graph is charged for what it measures from now on
+
+    std::string msg = "Client " + std::to_string(clientFd);
+    if (command == "newgraph")
+    {
+        graph->addEdges(batch);
+        if (g != nullptr)
+            delete g;
+        msg += " successfully created a new Graph with " + std::to_string(graph->numVertices()) + " vertices and " + std::to_string(pending.edges) + " edges" + "\n";
+        std::cout << "Graph created successfully\n";
+    }
+    else if (command == "newedges")
+    {
+        graph->addEdges(batch);
+        msg += " added " + std::to_string(batch.size()) + " edges\n";
+    }
+    else
+    {
+        graph->removeEdges(batch);
+        msg += " removed " + std::to_string(batch.size()) + " edges\n";
+    }
+    pending.edges = 0;
+    return {msg, graph};
 }
 
 std::pair<std::string, Graph *> newEdge(size_t n, size_t m, size_t weight, int clientFd, Graph *g)
 {
     std::cout << "Adding an edge from " << n << " to " << m << std::endl;
+    MemoryReservation room = reserveMemory(clientFd, edgeGrowthBytes(*g, 1));
+    if (!room)
+    {
+        std::string msg = "Client " + std::to_string(clientFd) + " tried to add an edge but it doesn't fit in its memory budget\n";
+        return {msg, nullptr};
+    }
     g->addEdge(Edge(g->getVertex(n - 1), g->getVertex(m - 1), weight)); // Add edge from u to v
     std::string msg = "Client " + std::to_string(clientFd) + " added an edge from " + std::to_string(n) + " to " + std::to_string(m) + " with weight " + std::to_string(weight) + "\n";
 
     return {msg, g};
 }
 
+size_t edgeGrowthBytes(const Graph &g, size_t k)
+{
+    size_t n = g.numVertices(), m = g.numEdges();
+    if (g.csrView() != nullptr)
+        return Graph::estimateBytes(n, m + k);
+    return Graph::estimateBytes(n, m + k) - Graph::estimateBytes(n, m);
+}
+
+MemoryReservation reserveMST(const Graph &g, int clientFd, ReplyFormat fmt, bool &matrixFree)
+{
+    size_t n = g.numVertices();
+    // the snapshot (a CSR view is shared), the MST and the strategy's scratch (edge lists, heaps, union-find)
+    size_t tree = g.memoryBytes() + Graph::estimateBytes(n, n > 0 ? n - 1 : 0) + (n + g.numEdges()) * 4 * sizeof(size_t);
+    // a line per pair of vertices, in the reply and in the output buffer
+    size_t paths = fmt == ReplyFormat::Text ? n * (n - 1) * 64 : 0;
+    matrixFree = false;
+    MemoryReservation full = reserveMemory(clientFd, tree + Graph::estimateDistanceBytes(n, g.totalWeight()) + paths, false);
+    if (full)
+        return full;
+    MemoryReservation reduced = reserveMemory(clientFd, tree);
+    if (reduced)
+    {
+        matrixFree = true;
+        memoryBudget()->countFallback();
+    }
+    return reduced;
+}
+
+void sendMSTCancelled(const ClientRef &client, ReplyFormat fmt)
+{
+    std::string msg = "Client " + std::to_string(client.fd) + "'s MST request was cancelled by a newer one\n";
+    if (fmt == ReplyFormat::Binary)
+        queueSend(client, binproto::encodeFrame(binproto::OP_REPLY_ERROR, msg));
+    else
+        queueSend(client, std::string(msg.c_str(), msg.size() + 1));
+}
+
+std::string centralityReport(const TreeIndex::Centrality &stats, bool perVertex)
+{
+    std::string report = stats.centers.size() == 1 ? "The center of the MST is" : "The centers of the MST are";
+    for (size_t v : stats.centers)
+        report += " " + std::to_string(v + 1);
+    report += " with a radius of " + std::to_string(stats.radius) + "\n";
+    if (stats.distanceSum.empty())
+        return report;
+    report += "The median of the MST is " + std::to_string(stats.median + 1) + " with a distance sum of " +
+              std::to_string(stats.distanceSum[stats.median]) + "\n";
+    if (!perVertex)
+        return report;
+    report += "The eccentricity and the distance sum of every vertex are: \n";
+    for (size_t v = 0; v < stats.eccentricity.size(); v++)
+        report += "Vertex " + std::to_string(v + 1) + ": eccentricity " + std::to_string(stats.eccentricity[v]) +
+                  ", distance sum " + std::to_string(stats.distanceSum[v]) + "\n";
+    return report;
+}
+
+std::string mstOverBudget(int clientFd, ReplyFormat fmt)
+{
+    std::string msg = "Client " + std::to_string(clientFd) + " tried to find the MST of the Graph but it doesn't fit in its memory budget\n";
+    if (fmt == ReplyFormat::Binary)
+        binproto::sendError(clientFd, msg);
+    return msg;
+}
+
 std::pair<std::string, Graph *> removeedge(int n, int m, int clientFd, Graph *g)
 {
     std::cout << "Removing an edge from " << n << " to " << m << std::endl;
@@ -190,8 +426,72 @@ std::pair<std::string, Graph *> removeedge(int n, int m, int clientFd, Graph *g)
     return {msg, g};
 }
 
+bool serverPath(const std::string &dir, const std::string &name, std::string &path, std::string &reason)
+{
+    if (dir.empty())
+    {
+        reason = "the server has no file directory (start it with -d dir)";
+        return false;
+    }
+    if (name.empty() || name[0] == '/')
+    {
+        reason = "file names are relative to the server's file directory";
+        return false;
+    }
+    std::istringstream components(name);
+    std::string component;
+    while (std::getline(components, component, '/'))
+    {
+        if (component == "..")
+        {
+            reason = "file names can't leave the server's file directory";
+            return false;
+        }
+    }
+    path = dir + "/" + name;
+    return true;
+}
+
+std::pair<std::string, Graph *> loadGraph(const std::string &path, int clientFd, Graph *g)
+{
+    std::cout << "Loading a graph from " << path << std::endl;
+    std::shared_ptr<const CSRGraph> view;
+    try
+    {
+        view = CSRGraph::open(path);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::string msg = "Client " + std::to_string(clientFd) + " failed to load a graph: " + e.what() + "\n";
+        return {msg, nullptr};
+    }
+
+    if (g != nullptr)
+        delete g;
+    g = new Graph(view); // zero-copy view of the mapped file
+    std::string msg = "Client " + std::to_string(clientFd) + " loaded a Graph with " + std::to_string(g->numVertices()) + " vertices and " + std::to_string(g->numEdges()) + " edges from " + path + "\n";
+    return {msg, g};
+}
+
+std::pair<std::string, Graph *> saveGraph(const std::string &path, int clientFd, Graph *g)
+{
+    std::cout << "Saving a graph to " << path << std::endl;
+    try
+    {
+        CSRGraph::save(*g, path);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::string msg = "Client " + std::to_string(clientFd) + " failed to save the graph: " + e.what() + "\n";
+        return {msg, nullptr};
+    }
+    std::string msg = "Client " + std::to_string(clientFd) + " saved a Graph with " + std::to_string(g->numVertices()) + " vertices and " + std::to_string(g->numEdges()) + " edges to " + path + "\n";
+    return {msg, nullptr};
+}
+
 std::pair<std::string, Graph *> handleInput(Graph *g, std::string action, int clientFd, std::string actualAction, int n, int m, int w, std::string strat)
 {
+    TRACE_SPAN("handleInput");
     std::string msg;
     std::vector<std::string> tokens = splitStringBySpaces(action);
     if (tokens.size() < 1)
@@ -200,11 +500,7 @@ std::pair<std::string, Graph *> handleInput(Graph *g, std::string action, int cl
         return {msg, nullptr};
     }
 
-    if (actualAction == "newgraph")
-    { // format: newgraph n m
-        return newGraph(n, m, clientFd, g);
-    }
-    else if (actualAction == "newedge")
+    if (actualAction == "newedge")
     { // format: newedge n m (add an edge from n to m)
         if (g != nullptr)
         {
@@ -228,6 +524,22 @@ std::pair<std::string, Graph *> handleInput(Graph *g, std::string action, int cl
             return {msg, nullptr};
         }
     }
+    else if (actualAction == "loadgraph")
+    { // format: loadgraph path (map a graph file as the client's graph)
+        return loadGraph(strat, clientFd, g);
+    }
+    else if (actualAction == "savegraph")
+    { // format: savegraph path (write the client's graph to a graph file)
+        if (g != nullptr)
+        {
+            return saveGraph(strat, clientFd, g);
+        }
+        else
+        {
+            msg = "Client " + std::to_string(clientFd) + " tried to perform the operation but there is no graph\n";
+            return {msg, nullptr};
+        }
+    }
     else if (actualAction == "mst")
     { // format: MST
         if (g == nullptr)
@@ -242,9 +554,14 @@ std::pair<std::string, Graph *> handleInput(Graph *g, std::string action, int cl
         }
         else
         {
-            return MST(g, clientFd, strat);
+            return MST(g, clientFd, strat, ReplyFormat::Text);
         }
     }
+    else if (actualAction == "binary")
+    { // format: binary (switch the connection to the binary protocol)
+        msg = "Client " + std::to_string(clientFd) + " switched to the binary protocol\n";
+        return {msg, nullptr};
+    }
     else
     {
         msg = "Client " + std::to_string(clientFd) + " sent a message: " + action;
@@ -264,7 +581,7 @@ void *getInAddr(struct sockaddr *sa)
 }
 
 // Return a listening socket
-int getListenerSocket(void)
+int getListenerSocket(bool reusePort, const char *port)
 {
     int listener; // Listening socket descriptor
     int yes = 1;  // For setsockopt() SO_REUSEADDR, below
@@ -277,7 +594,7 @@ int getListenerSocket(void)
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
-    if ((rv = getaddrinfo(NULL, PORT, &hints, &ai)) != 0)
+    if ((rv = getaddrinfo(NULL, port, &hints, &ai)) != 0)
     {
         fprintf(stderr, "selectserver: %s\n", gai_strerror(rv));
         exit(1);
@@ -294,6 +611,13 @@ int getListenerSocket(void)
         // Lose the pesky "address already in use" error message
         setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
 
+        // Several listeners on the same port, the kernel spreads the new connections between them
+        if (reusePort && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) < 0)
+        {
+            close(listener);
+            continue;
+        }
+
         if (bind(listener, p->ai_addr, p->ai_addrlen) < 0)
         {
             close(listener);
@@ -312,36 +636,11 @@ int getListenerSocket(void)
     }
 
     // Listen
-    if (listen(listener, 10) == -1)
+    if (listen(listener, SOMAXCONN) == -1)
     {
+        close(listener);
         return -1;
     }
 
     return listener;
 }
-
-// Add a new file descriptor to the set
-void add_to_pfds(struct pollfd *pfds[], int newfd, int *fd_count, int *fd_size)
-{
-    // If we don't have room, add more space in the pfds array
-    if (*fd_count == *fd_size)
-    {
-        *fd_size *= 2; // Double it
-
-        *pfds = (struct pollfd *)realloc(*pfds, sizeof(**pfds) * (size_t)(*fd_size));
-    }
-
-    (*pfds)[*fd_count].fd = newfd;
-    (*pfds)[*fd_count].events = POLLIN; // Check ready-to-read
-
-    (*fd_count)++;
-}
-
-// Remove an index from the set
-void del_from_pfds(struct pollfd pfds[], int i, int *fd_count)
-{
-    // Copy the one from the end over this one
-    pfds[i] = pfds[*fd_count - 1];
-
-    (*fd_count)--;
-}
\ No newline at end of file
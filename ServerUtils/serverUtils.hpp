@@ -79,43 +79,127 @@
 #include <string.h>
 #define PORT "9036" // Port we're listening on
 #include "../LFP/LFP.hpp"
+#include "binaryProtocol.hpp"
+#include "memoryBudget.hpp"
+#include "../LFP/CancelToken.hpp"
+#include "../GraphObj/treeIndex.hpp"
 
-// Declare the MST function as extern
-extern std::pair<std::string, Graph *> MST(Graph *g, int clientFd, const std::string &strat);
+// Declare the MST function as extern, the reply is delivered in the given format.
+// Called on the client's reactor thread: g keeps changing after it returns, the computation must use a snapshot.
+extern std::pair<std::string, Graph *> MST(Graph *g, int clientFd, const std::string &strat, ReplyFormat fmt);
 
 // Function to convert a string to lowercase
 std::string toLowerCase(std::string s);
 
-void initGraph(Graph *g, int m, int clientFd);
-
 std::vector<std::string> splitStringBySpaces(const std::string &input);
 
 void parseInput(char *buf, int nbytes, int &n, int &m, int &weight, std::string &strat, std::string &action, std::string &actualAction, const std::vector<std::string> &graphActions, const std::vector<std::string> &mstStrats);
 
 std::unordered_set<Vertex> initVertices(int n);
 
-std::pair<std::string, Graph *> newGraph(int n, int m, int clientFd, Graph *g);
+// A newgraph, newedges, removeedges or querybatch command waiting for its edges: the client's next lines are read as
+// "u v w" numbers ("u v" for removeedges and querybatch's pairs), not as commands
+struct PendingEdges
+{
+    std::string command;          // the command reading the edges, empty when none is
+    std::unique_ptr<Graph> graph; // newgraph's new graph
+    size_t edges = 0;             // m of newgraph n m, k of newedges k
+    size_t fields = 3;            // numbers per edge
+    std::vector<size_t> numbers;  // the edges read so far
+    MemoryReservation room;       // the memory of the new graph or edges until they are in the client's graph
+};
+
+// Start a newgraph command that will replace g: asks the client for the edges.
+// Empty if pending is waiting for them, otherwise the refusal to broadcast (the graph doesn't fit in the budget).
+std::string newGraph(int n, int m, int clientFd, const Graph *g, PendingEdges &pending);
+
+// Start a newedges or removeedges command on g, like newGraph
+std::string editEdges(const std::string &command, int k, int clientFd, const Graph *g, PendingEdges &pending);
+
+// Start a querybatch command: asks the client for the k pairs, empty or the refusal to send the client
+std::string startQueries(int k, int clientFd, PendingEdges &pending);
+
+// Read a line of edge numbers into a pending command, true once it has all of its edges
+// (an invalid number ends them early, the complete edges are kept)
+bool readEdges(PendingEdges &pending, const std::string &line);
+
+// Apply the pending command to the client's graph g: the message to broadcast, and the client's graph from now on
+// (newgraph frees g and returns the new graph, the edits change g in one batch)
+std::pair<std::string, Graph *> finishEdges(PendingEdges &pending, int clientFd, Graph *g);
 
 std::pair<std::string, Graph *> newEdge(size_t n, size_t m, size_t weight, int clientFd, Graph *g);
 
 std::pair<std::string, Graph *> removeedge(int n, int m, int clientFd, Graph *g);
 
+// The path of the file a client names, under the server's file directory dir: false with the reason when there is no
+// directory or the name is absolute or has a ".." component (a client must not reach any other file of the server)
+bool serverPath(const std::string &dir, const std::string &name, std::string &path, std::string &reason);
+
+// Replace the client's graph with a zero-copy view of a graph file
+std::pair<std::string, Graph *> loadGraph(const std::string &path, int clientFd, Graph *g);
+
+// Write the client's graph to a graph file
+std::pair<std::string, Graph *> saveGraph(const std::string &path, int clientFd, Graph *g);
+
 std::pair<std::string, Graph *> handleInput(Graph *g, std::string action, int clientFd, std::string actualAction, int n, int m, int w, std::string strat);
 
+// One client connection: fds are reused after a close, the id is not
+struct ClientRef
+{
+    int fd;
+    uint64_t id;
+    void *shard = nullptr; // the reactor owning the connection (a ServerCore shard), replies go to it without a lookup
+};
 
-// Get sockaddr, IPv4 or IPv6:
-void *getInAddr(struct sockaddr *sa);
+// The connection currently using fd, call it on the connection's reactor thread (e.g. in MST): it is found in the
+// reactor's own sessions
+ClientRef clientRef(int fd);
+
+// Queue data on the client's output buffer, its reactor writes it without blocking.
+// Can be called from any thread, data for a connection that was closed is dropped.
+void queueSend(const ClientRef &client, std::string data);
+void queueSend(int fd, std::string data);
+
+// Reserve bytes on the memory budget of the client using fd until the reservation is destroyed, from any thread.
+// Empty (false) if they don't fit, which is counted as a refused command unless countRefusal is false.
+MemoryReservation reserveMemory(int fd, size_t bytes, bool countRefusal = true);
+
+// The running server's memory budget (nullptr if there is none)
+MemoryBudget *memoryBudget();
+
+// Estimated growth of g when k edges are added to it (a CSR view is materialized first)
+size_t edgeGrowthBytes(const Graph &g, size_t k);
 
+// Reserve the memory of an mst request: the snapshot, the MST, its distance matrices and, for text clients, the
+// listed paths. If that doesn't fit, the stats are computed without the matrices (matrixFree is set) and only the
+// snapshot and the MST are reserved. Empty if even that doesn't fit.
+MemoryReservation reserveMST(const Graph &g, int clientFd, ReplyFormat fmt, bool &matrixFree);
 
-// Return a listening socket
-int getListenerSocket();
+// Make token the cancellation token of the latest mst request of the client using fd, cancels the client's previous
+// mst request (after the new one joined a computation, see MSTFlights). Call it on the connection's reactor thread.
+void supersedeMST(int fd, const std::shared_ptr<CancelToken> &token);
 
+// Keep tree as the index of the client's latest MST, for its path/dist/bottleneck queries, from any thread.
+// The index is charged to the client's memory budget, it is dropped if it doesn't fit (or the client hung up).
+// A tree of an older version of the graph than the kept one's is ignored: flights can finish out of order.
+void keepTree(const ClientRef &client, std::shared_ptr<const TreeIndex> tree);
 
-// Add a new file descriptor to the set
-void add_to_pfds(struct pollfd *pfds[], int newfd, int *fd_count, int *fd_size);
+// The centrality stats of an MST: its center(s), radius and median, then every vertex's eccentricity and distance sum
+// if perVertex (the vertices numbered from 1 like in the commands)
+std::string centralityReport(const TreeIndex::Centrality &stats, bool perVertex);
+
+// Tell the client its mst request was cancelled by a newer one (dropped if the client hung up), from any thread
+void sendMSTCancelled(const ClientRef &client, ReplyFormat fmt);
+
+// The reply to an mst request that doesn't fit in the client's budget: returned for text clients (broadcast like the
+// other mst errors), sent as an error frame to binary clients
+std::string mstOverBudget(int clientFd, ReplyFormat fmt);
+
+// Get sockaddr, IPv4 or IPv6:
+void *getInAddr(struct sockaddr *sa);
 
 
-// Remove an index from the set
-void del_from_pfds(struct pollfd pfds[], int i, int *fd_count);
+// Return a listening socket on port, with reusePort several sockets can listen on it
+int getListenerSocket(bool reusePort = false, const char *port = PORT);
 
 #endif // SERVER_UTILS_HPP
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "Trace.hpp"
+
+#ifdef ENABLE_TRACING
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../DataStruct/LatencyHistogram.hpp"
+
+namespace trace
+{
+    namespace
+    {
+        struct Event
+        {
+            const char *name;
+            int64_t arg;
+            uint64_t request;
+            uint64_t start; // steadyNanos()
+            uint64_t duration;
+        };
+
+        // The spans of one thread. The lock is only contended while a dump copies the ring.
+        struct ThreadBuffer
+        {
+            size_t tid;
+            std::mutex mutex;
+            std::vector<Event> ring;
+            uint64_t written = 0; // the next event goes to ring[written % RING_SIZE]
+        };
+
+        std::mutex registryMutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> registry; // buffers outlive their threads, a dump still shows them
+        std::atomic<uint64_t> nextRequest{1};
+        thread_local ThreadBuffer *localBuffer = nullptr;
+        thread_local uint64_t localRequest = 0;
+
+        ThreadBuffer &buffer()
+        {
+            if (localBuffer == nullptr)
+            {
+                std::unique_ptr<ThreadBuffer> created(new ThreadBuffer());
+                created->ring.resize(RING_SIZE);
+                std::lock_guard<std::mutex> lock(registryMutex);
+                created->tid = registry.size() + 1;
+                localBuffer = created.get();
+                registry.push_back(std::move(created));
+            }
+            return *localBuffer;
+        }
+    }
+
+    Span::Span(const char *name, int64_t arg) : name(name), arg(arg), start(steadyNanos()) {}
+
+    Span::~Span()
+    {
+        uint64_t end = steadyNanos();
+        ThreadBuffer &b = buffer();
+        std::lock_guard<std::mutex> lock(b.mutex);
+        b.ring[b.written % RING_SIZE] = Event{name, arg, localRequest, start, end - start};
+        b.written++;
+    }
+
+    RequestScope::RequestScope(uint64_t request) : previous(localRequest)
+    {
+        localRequest = request;
+    }
+
+    RequestScope::~RequestScope()
+    {
+        localRequest = previous;
+    }
+
+    uint64_t newRequest()
+    {
+        return nextRequest.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t currentRequest()
+    {
+        return localRequest;
+    }
+
+    static void writeEscaped(std::ostream &out, const char *s)
+    {
+        for (; *s != '\0'; s++)
+        {
+            if (*s == '"' || *s == '\\')
+                out << '\\';
+            out << *s;
+        }
+    }
+
+    long dumpChromeJson(const std::string &path)
+    {
+        std::ofstream out(path);
+        if (!out)
+            return -1;
+        std::vector<std::pair<size_t, std::vector<Event>>> copies;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            for (auto &b : registry)
+            {
+                std::lock_guard<std::mutex> bufferLock(b->mutex);
+                uint64_t first = b->written > RING_SIZE ? b->written - RING_SIZE : 0;
+                std::vector<Event> events;
+                for (uint64_t i = first; i < b->written; i++)
+                    events.push_back(b->ring[i % RING_SIZE]);
+                copies.emplace_back(b->tid, std::move(events));
+            }
+        }
+
+        long count = 0;
+        out.setf(std::ios::fixed);
+        out.precision(3); // microseconds with nanosecond resolution
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        for (auto &copy : copies)
+        {
+            for (const Event &e : copy.second)
+            {
+                out << (count++ == 0 ? "\n" : ",\n") << "{\"name\":\"";
+                writeEscaped(out, e.name);
+                out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << copy.first << ",\"ts\":" << static_cast<double>(e.start) / 1e3
+                    << ",\"dur\":" << static_cast<double>(e.duration) / 1e3 << ",\"args\":{\"request\":" << e.request;
+                if (e.arg >= 0)
+                    out << ",\"arg\":" << e.arg;
+                out << "}}";
+            }
+        }
+        out << "\n]}\n";
+        return out ? count : -1;
+    }
+}
+#endif
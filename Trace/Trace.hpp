@@ -0,0 +1,77 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Request tracing, compiled in with -DENABLE_TRACING (make TRACING=1).
+ * TRACE_SPAN(name) records the time until the end of the enclosing scope into the calling thread's ring buffer,
+ * tagged with the request the thread is working for. The server opens a request per command (TRACE_REQUEST) and the
+ * LFP and PAO carry it to the tasks they run, so one request can be followed across threads.
+ * trace::dumpChromeJson writes the spans of all the threads in Chrome's trace_event format (chrome://tracing, Perfetto).
+ * Without ENABLE_TRACING the macros expand to nothing and the functions are empty inline stubs.
+ * Span names must be string literals (only the pointer is stored).
+ */
+namespace trace
+{
+    // Each thread keeps the last RING_SIZE spans
+    inline constexpr size_t RING_SIZE = 1 << 16;
+
+#ifdef ENABLE_TRACING
+    // Scoped span, see TRACE_SPAN
+    class Span
+    {
+    public:
+        explicit Span(const char *name, int64_t arg = -1);
+        ~Span();
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    private:
+        const char *name;
+        int64_t arg; // shown in the span's args when >= 0 (e.g. the PAO stage)
+        uint64_t start;
+    };
+
+    // Makes the calling thread work for a request until the end of the scope, see TRACE_REQUEST
+    class RequestScope
+    {
+    public:
+        explicit RequestScope(uint64_t request);
+        ~RequestScope();
+        RequestScope(const RequestScope &) = delete;
+        RequestScope &operator=(const RequestScope &) = delete;
+
+    private:
+        uint64_t previous;
+    };
+
+    // A new request id
+    uint64_t newRequest();
+
+    // The request the calling thread works for, 0 if none (captured by LFP::addTask and PAO::addTask)
+    uint64_t currentRequest();
+
+    // Write the recorded spans as Chrome trace_event JSON, returns the number of spans or -1 if the file can't be written
+    long dumpChromeJson(const std::string &path);
+
+    inline constexpr bool enabled = true;
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) ::trace::Span TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+#define TRACE_REQUEST(request) ::trace::RequestScope TRACE_CONCAT(traceRequest, __LINE__)(request)
+#else
+    inline uint64_t newRequest() { return 0; }
+    inline uint64_t currentRequest() { return 0; }
+    inline long dumpChromeJson(const std::string &) { return -1; }
+
+    inline constexpr bool enabled = false;
+
+#define TRACE_SPAN(...)
+#define TRACE_REQUEST(request)
+#endif
+}
+
+#endif // TRACE_HPP